@@ -0,0 +1,85 @@
+//===- count-scaling.cpp - Thread scaling of the runtime counters ---------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Calls the flop and memory access counting functions of the runtime, the same
+// way code compiled with -raptor-truncate-count does, from an increasing
+// number of threads and prints the time per call. With per-thread counters the
+// time per call should stay flat as threads are added.
+//
+// usage: count-scaling [iterations per thread] [max threads]
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+extern "C" {
+void __raptor_fprt_ieee_64_count();
+void __raptor_fprt_memory_access(void *ptr, int64_t size, int64_t is_store);
+long long __raptor_get_double_flop_count();
+long long __raptor_get_memory_access_original_load();
+void raptor_fprt_count_dump_status();
+}
+
+static void work(long long iterations) {
+  double x = 0;
+  for (long long i = 0; i < iterations; i++) {
+    __raptor_fprt_memory_access(&x, sizeof(x), 0);
+    __raptor_fprt_ieee_64_count();
+  }
+}
+
+int main(int argc, char **argv) {
+  long long iterations = argc > 1 ? atoll(argv[1]) : 10000000;
+  unsigned max_threads =
+      argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+  if (!max_threads)
+    max_threads = 1;
+
+  printf("%8s %14s %14s %12s\n", "threads", "calls", "ns/call/thread",
+         "Mcalls/s");
+  long long expected = 0;
+  for (unsigned threads = 1; threads <= max_threads;
+       threads = threads < max_threads ? std::min(threads * 2, max_threads)
+                                       : threads + 1) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+      workers.emplace_back(work, iterations);
+    for (auto &w : workers)
+      w.join();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    // Every iteration counts one flop and one access.
+    long long calls = 2 * iterations * threads;
+    expected += iterations * threads;
+    printf("%8u %14lld %14.3f %12.1f\n", threads, calls,
+           1e9 * seconds / (2 * iterations), calls / seconds / 1e6);
+  }
+
+  long long flops = __raptor_get_double_flop_count();
+  long long loads = __raptor_get_memory_access_original_load();
+  if (flops != expected || loads != expected * (long long)sizeof(double)) {
+    fprintf(stderr, "count mismatch: %lld flops and %lld bytes loaded, "
+                    "expected %lld and %lld\n",
+            flops, loads, expected, expected * (long long)sizeof(double));
+    return 1;
+  }
+  if (getenv("RAPTOR_FPRT_COUNT_REPORT") == nullptr)
+    raptor_fprt_count_dump_status();
+  return 0;
+}
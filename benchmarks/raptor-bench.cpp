@@ -0,0 +1,492 @@
+//===- raptor-bench.cpp - Microbenchmarks of the runtime entry points -----===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Calls every entry point of runtime/ir/Flops.def, the way truncated code does,
+// in op and memory mode and at a grid of precisions, and the native operation
+// it replaces. Prints one tab separated row per entry point, mode and
+// precision with the time per call, the time of the native operation, the
+// calls to malloc, calloc and realloc per call (when the C library is glibc)
+// and the cache misses per call (when perf events are available, e.g.
+// kernel.perf_event_paranoid <= 2). Unavailable values are `nan`.
+//
+// Memory mode is only benchmarked for double entry points, as the runtime only
+// supports it for them. The native operations are called through a function
+// pointer like the runtime, so the slowdown does not count the call.
+//
+// usage: raptor-bench [iterations] [entry point substring]
+//
+//===----------------------------------------------------------------------===//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef RAPTOR_BENCH_RUNTIME
+#define RAPTOR_BENCH_RUNTIME "gc"
+#endif
+
+#define RAPTOR_BENCH_INPUTS 16
+#define RAPTOR_BENCH_MAX_ARGS 3
+
+extern "C" {
+double __raptor_fprt_ieee_64_new(double a, int64_t exponent,
+                                 int64_t significand, int64_t mode,
+                                 const char *loc, void *scratch);
+void __raptor_fprt_ieee_64_delete(double a, int64_t exponent,
+                                  int64_t significand, int64_t mode,
+                                  const char *loc, void *scratch);
+void *__raptor_fprt_ieee_64_get_scratch(int64_t to_e, int64_t to_m,
+                                        int64_t mode, const char *loc,
+                                        void *scratch);
+void __raptor_fprt_ieee_64_free_scratch(int64_t to_e, int64_t to_m,
+                                        int64_t mode, const char *loc,
+                                        void *scratch);
+void __raptor_fprt_ieee_64_trunc_change(int64_t is_push, int64_t to_e,
+                                        int64_t to_m, int64_t mode,
+                                        const char *loc, void *scratch);
+void raptor_fprt_gc_doit();
+}
+
+// The mode argument of the runtime, see raptor/Common.h.
+enum bench_mode { BENCH_MEM = 0b0001, BENCH_OP = 0b0010 };
+
+static const char bench_loc[] = "raptor-bench";
+
+typedef double (*bench_call)(const double *args, int64_t exponent,
+                             int64_t significand, int64_t mode, void *scratch);
+
+struct BenchEntry {
+  const char *name; // Without the __raptor_fprt_ prefix.
+  const char *op;   // The LLVM_OP_NAME of Flops.def.
+  bool is_float;
+  unsigned arity;
+  bool int_arg; // The second argument is an integer.
+  bool mem;     // Memory mode is supported.
+  bool compare; // Returns a bool rather than a value.
+  bench_call call;
+};
+
+static std::vector<BenchEntry> &bench_entries() {
+  static std::vector<BenchEntry> entries;
+  return entries;
+}
+
+static bool bench_register(const BenchEntry &entry) {
+  bench_entries().push_back(entry);
+  return true;
+}
+
+#define RAPTOR_BENCH_IS_FLOAT_ieee_64 false
+#define RAPTOR_BENCH_IS_FLOAT_ieee_32 true
+
+// Declares an entry point of the runtime and registers a call of it with the
+// arguments converted from double. In memory mode the double arguments and the
+// result are the bits of the value pointers, which the conversions keep.
+#define RAPTOR_BENCH_ENTRY(NAME, OP, FROM_TYPE, ARITY, INT_ARG, MEM, RET,      \
+                           PARAMS, ARGS)                                       \
+  extern "C" RET __raptor_fprt_##NAME PARAMS;                                  \
+  static double bench_call_##NAME(const double *args, int64_t exponent,       \
+                                  int64_t significand, int64_t mode,           \
+                                  void *scratch) {                             \
+    return (double)__raptor_fprt_##NAME ARGS;                                  \
+  }                                                                            \
+  static bool bench_registered_##NAME =                                        \
+      bench_register({#NAME, #OP, RAPTOR_BENCH_IS_FLOAT_##FROM_TYPE, ARITY,    \
+                      INT_ARG, MEM && !RAPTOR_BENCH_IS_FLOAT_##FROM_TYPE,      \
+                      !strcmp(#RET, "bool"), bench_call_##NAME});
+
+#define RAPTOR_BENCH_PARAMS int64_t, int64_t, int64_t, const char *, void *
+#define RAPTOR_BENCH_ARGS exponent, significand, mode, bench_loc, scratch
+
+#define __RAPTOR_MPFR_LROUND(OP_TYPE, LLVM_OP_NAME, FROM_TYPE, RET, ARG1,      \
+                             MPFR_SET_ARG1, ROUNDING_MODE)                     \
+  RAPTOR_BENCH_ENTRY(FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME, LLVM_OP_NAME,     \
+                     FROM_TYPE, 1, false, false, RET,                          \
+                     (ARG1, RAPTOR_BENCH_PARAMS),                              \
+                     ((ARG1)args[0], RAPTOR_BENCH_ARGS))
+
+#define __RAPTOR_MPFR_SINGOP(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE, \
+                             RET, MPFR_GET, ARG1, MPFR_SET_ARG1,               \
+                             ROUNDING_MODE)                                    \
+  RAPTOR_BENCH_ENTRY(FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME, LLVM_OP_NAME,     \
+                     FROM_TYPE, 1, false, true, RET,                           \
+                     (ARG1, RAPTOR_BENCH_PARAMS),                              \
+                     ((ARG1)args[0], RAPTOR_BENCH_ARGS))
+
+#define __RAPTOR_MPFR_BIN_INT(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME,           \
+                              FROM_TYPE, RET, MPFR_GET, ARG1, MPFR_SET_ARG1,   \
+                              ARG2, ROUNDING_MODE)                             \
+  RAPTOR_BENCH_ENTRY(FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME, LLVM_OP_NAME,     \
+                     FROM_TYPE, 2, true, true, RET,                            \
+                     (ARG1, ARG2, RAPTOR_BENCH_PARAMS),                        \
+                     ((ARG1)args[0], (ARG2)args[1], RAPTOR_BENCH_ARGS))
+
+#define __RAPTOR_MPFR_BIN(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE,    \
+                          RET, MPFR_GET, ARG1, MPFR_SET_ARG1, ARG2,            \
+                          MPFR_SET_ARG2, ROUNDING_MODE)                        \
+  RAPTOR_BENCH_ENTRY(FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME, LLVM_OP_NAME,     \
+                     FROM_TYPE, 2, false, true, RET,                           \
+                     (ARG1, ARG2, RAPTOR_BENCH_PARAMS),                        \
+                     ((ARG1)args[0], (ARG2)args[1], RAPTOR_BENCH_ARGS))
+
+#define __RAPTOR_MPFR_FMULADD(LLVM_OP_NAME, FROM_TYPE, TYPE, MPFR_TYPE,        \
+                              LLVM_TYPE, ROUNDING_MODE)                        \
+  RAPTOR_BENCH_ENTRY(FROM_TYPE##_intr_##LLVM_OP_NAME##_##LLVM_TYPE,            \
+                     LLVM_OP_NAME, FROM_TYPE, 3, false, true, TYPE,            \
+                     (TYPE, TYPE, TYPE, RAPTOR_BENCH_PARAMS),                  \
+                     ((TYPE)args[0], (TYPE)args[1], (TYPE)args[2],             \
+                      RAPTOR_BENCH_ARGS))
+
+#define __RAPTOR_MPFR_FCMP_IMPL(NAME, ORDERED, CMP, FROM_TYPE, TYPE, MPFR_GET, \
+                                ROUNDING_MODE)                                 \
+  RAPTOR_BENCH_ENTRY(FROM_TYPE##_fcmp_##NAME, NAME, FROM_TYPE, 2, false,      \
+                     true, bool, (TYPE, TYPE, RAPTOR_BENCH_PARAMS),            \
+                     ((TYPE)args[0], (TYPE)args[1], RAPTOR_BENCH_ARGS))
+
+#include "Flops.def"
+
+// The native operations, by the name of the operation without the llvm_ or __
+// prefix and the type or _finite suffix. EXPR is evaluated in the type of the
+// entry point.
+#define RAPTOR_BENCH_NATIVE(NAME, EXPR)                                        \
+  {#NAME,                                                                      \
+   [](const double *args) -> double {                                          \
+     double a = args[0], b = args[1], c = args[2];                             \
+     (void)b, (void)c;                                                         \
+     return EXPR;                                                              \
+   },                                                                          \
+   [](const double *args) -> double {                                          \
+     float a = args[0], b = args[1], c = args[2];                              \
+     (void)b, (void)c;                                                         \
+     return EXPR;                                                              \
+   }}
+#define RAPTOR_BENCH_NATIVE_LIBM(NAME)                                         \
+  RAPTOR_BENCH_NATIVE(NAME, std::NAME(a))
+
+static const struct {
+  const char *name;
+  double (*call_double)(const double *args);
+  double (*call_float)(const double *args);
+} bench_natives[] = {
+    RAPTOR_BENCH_NATIVE(fmul, a * b),
+    RAPTOR_BENCH_NATIVE(fadd, a + b),
+    RAPTOR_BENCH_NATIVE(fsub, a - b),
+    RAPTOR_BENCH_NATIVE(fdiv, a / b),
+    RAPTOR_BENCH_NATIVE(frem, std::fmod(a, b)),
+    RAPTOR_BENCH_NATIVE(pow, std::pow(a, b)),
+    RAPTOR_BENCH_NATIVE(copysign, std::copysign(a, b)),
+    RAPTOR_BENCH_NATIVE(fdim, std::fdim(a, b)),
+    RAPTOR_BENCH_NATIVE(remainder, std::remainder(a, b)),
+    RAPTOR_BENCH_NATIVE(atan2, std::atan2(a, b)),
+    RAPTOR_BENCH_NATIVE(hypot, std::hypot(a, b)),
+    RAPTOR_BENCH_NATIVE(fmod, std::fmod(a, b)),
+    RAPTOR_BENCH_NATIVE(maxnum, std::fmax(a, b)),
+    RAPTOR_BENCH_NATIVE(minnum, std::fmin(a, b)),
+    RAPTOR_BENCH_NATIVE(powi, std::pow(a, (int)b)),
+    RAPTOR_BENCH_NATIVE(ldexp, std::ldexp(a, (int)b)),
+    RAPTOR_BENCH_NATIVE_LIBM(sqrt),
+    RAPTOR_BENCH_NATIVE_LIBM(atanh),
+    RAPTOR_BENCH_NATIVE_LIBM(acosh),
+    RAPTOR_BENCH_NATIVE_LIBM(asinh),
+    RAPTOR_BENCH_NATIVE_LIBM(atan),
+    RAPTOR_BENCH_NATIVE_LIBM(acos),
+    RAPTOR_BENCH_NATIVE_LIBM(asin),
+    RAPTOR_BENCH_NATIVE_LIBM(tanh),
+    RAPTOR_BENCH_NATIVE_LIBM(cosh),
+    RAPTOR_BENCH_NATIVE_LIBM(sinh),
+    RAPTOR_BENCH_NATIVE_LIBM(tan),
+    RAPTOR_BENCH_NATIVE_LIBM(cos),
+    RAPTOR_BENCH_NATIVE_LIBM(sin),
+    RAPTOR_BENCH_NATIVE_LIBM(exp),
+    RAPTOR_BENCH_NATIVE_LIBM(exp2),
+    RAPTOR_BENCH_NATIVE_LIBM(expm1),
+    RAPTOR_BENCH_NATIVE_LIBM(log),
+    RAPTOR_BENCH_NATIVE_LIBM(log2),
+    RAPTOR_BENCH_NATIVE_LIBM(log10),
+    RAPTOR_BENCH_NATIVE_LIBM(log1p),
+    RAPTOR_BENCH_NATIVE_LIBM(fabs),
+    RAPTOR_BENCH_NATIVE_LIBM(trunc),
+    RAPTOR_BENCH_NATIVE_LIBM(round),
+    RAPTOR_BENCH_NATIVE_LIBM(floor),
+    RAPTOR_BENCH_NATIVE_LIBM(ceil),
+    RAPTOR_BENCH_NATIVE_LIBM(erf),
+    RAPTOR_BENCH_NATIVE_LIBM(erfc),
+    RAPTOR_BENCH_NATIVE_LIBM(cbrt),
+    RAPTOR_BENCH_NATIVE_LIBM(tgamma),
+    RAPTOR_BENCH_NATIVE_LIBM(lgamma),
+    RAPTOR_BENCH_NATIVE_LIBM(nearbyint),
+    RAPTOR_BENCH_NATIVE(fneg, -a),
+    RAPTOR_BENCH_NATIVE(lround, std::lround(a)),
+    RAPTOR_BENCH_NATIVE(fmuladd, a * b + c),
+    RAPTOR_BENCH_NATIVE(fma, std::fma(a, b, c)),
+    RAPTOR_BENCH_NATIVE(oeq, a == b),
+    RAPTOR_BENCH_NATIVE(ueq, !(a < b || a > b)),
+    RAPTOR_BENCH_NATIVE(ogt, a > b),
+    RAPTOR_BENCH_NATIVE(ugt, !(a <= b)),
+    RAPTOR_BENCH_NATIVE(oge, a >= b),
+    RAPTOR_BENCH_NATIVE(uge, !(a < b)),
+    RAPTOR_BENCH_NATIVE(olt, a < b),
+    RAPTOR_BENCH_NATIVE(ult, !(a >= b)),
+    RAPTOR_BENCH_NATIVE(ole, a <= b),
+    RAPTOR_BENCH_NATIVE(ule, !(a > b)),
+    RAPTOR_BENCH_NATIVE(one, a < b || a > b),
+    RAPTOR_BENCH_NATIVE(une, a != b),
+};
+
+static double (*find_native(const BenchEntry &entry))(const double *) {
+  const char *op = entry.op;
+  if (!strncmp(op, "llvm_", 5))
+    op += 5;
+  else if (!strncmp(op, "__", 2))
+    op += 2;
+  size_t len = strcspn(op, "_");
+  for (const auto &native : bench_natives)
+    if (strlen(native.name) == len && !strncmp(native.name, op, len))
+      return entry.is_float ? native.call_float : native.call_double;
+  return nullptr;
+}
+
+// Inputs within the domain of every operation, the second argument of ldexp
+// and powi is an integer.
+static void bench_inputs(const BenchEntry &entry,
+                         double inputs[RAPTOR_BENCH_INPUTS]
+                                      [RAPTOR_BENCH_MAX_ARGS]) {
+  double base = !strcmp(entry.op, "acosh") ? 1.5 : 0.5;
+  for (unsigned i = 0; i < RAPTOR_BENCH_INPUTS; i++) {
+    inputs[i][0] = base * (1 + i / 32.0);
+    inputs[i][1] = entry.int_arg ? 1 + i % 4 : 0.75 * (1 + i / 64.0);
+    inputs[i][2] = 0.25 * (1 + i / 128.0);
+  }
+}
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+// Counts the allocations of the runtime, of MPFR and GMP and of the C++
+// library, which all end up here.
+static std::atomic<long long> num_allocations = 0;
+
+extern "C" void *malloc(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+static long long read_allocations() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+#else
+static long long read_allocations() { return -1; }
+#endif
+
+#ifdef __linux__
+static int cache_misses_fd = -1;
+
+static void open_cache_misses() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  cache_misses_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_cache_misses() {
+  long long count;
+  if (cache_misses_fd < 0 ||
+      read(cache_misses_fd, &count, sizeof(count)) != sizeof(count))
+    return -1;
+  return count;
+}
+#else
+static void open_cache_misses() {}
+static long long read_cache_misses() { return -1; }
+#endif
+
+struct Measurement {
+  double ns;
+  double allocations; // NaN when not counted.
+  double cache_misses;
+};
+
+// Runs `body`, which makes `iterations` calls, after a shorter warm up run.
+template <typename F>
+static Measurement measure(long iterations, const F &body) {
+  body(iterations / 10 + 1);
+  long long allocations = read_allocations();
+  long long cache_misses = read_cache_misses();
+  auto start = std::chrono::steady_clock::now();
+  body(iterations);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  long long allocations_end = read_allocations();
+  long long cache_misses_end = read_cache_misses();
+  return {1e9 * seconds / iterations,
+          allocations < 0 ? NAN
+                          : (double)(allocations_end - allocations) / iterations,
+          cache_misses < 0 || cache_misses_end < 0
+              ? NAN
+              : (double)(cache_misses_end - cache_misses) / iterations};
+}
+
+// Keeps the results alive without floating-point arithmetic on them, which
+// would be slow on the pointer bits of memory mode.
+static volatile uint64_t bench_sink;
+
+static uint64_t result_bits(double result) {
+  uint64_t bits;
+  memcpy(&bits, &result, sizeof(bits));
+  return bits;
+}
+
+static Measurement measure_native(double (*native)(const double *),
+                                  const double inputs[][RAPTOR_BENCH_MAX_ARGS],
+                                  long iterations) {
+  return measure(iterations, [&](long n) {
+    uint64_t sink = 0;
+    for (long i = 0; i < n; i++)
+      sink ^= result_bits(native(inputs[i % RAPTOR_BENCH_INPUTS]));
+    bench_sink = sink;
+  });
+}
+
+// Emulates the entry point like a truncated function does: the precision is
+// pushed and the scratch space allocated around the calls, and in memory mode
+// the inputs are memory mode values and every result is deleted again.
+static Measurement measure_entry(const BenchEntry &entry, bench_mode mode,
+                                 int64_t exponent, int64_t significand,
+                                 const double inputs[][RAPTOR_BENCH_MAX_ARGS],
+                                 long iterations) {
+  void *scratch = __raptor_fprt_ieee_64_get_scratch(exponent, significand,
+                                                    mode, bench_loc, nullptr);
+  __raptor_fprt_ieee_64_trunc_change(1, exponent, significand, mode, bench_loc,
+                                     scratch);
+  double args[RAPTOR_BENCH_INPUTS][RAPTOR_BENCH_MAX_ARGS];
+  for (unsigned i = 0; i < RAPTOR_BENCH_INPUTS; i++)
+    for (unsigned j = 0; j < RAPTOR_BENCH_MAX_ARGS; j++)
+      args[i][j] = mode == BENCH_MEM && j < entry.arity &&
+                           !(entry.int_arg && j == 1)
+                       ? __raptor_fprt_ieee_64_new(inputs[i][j], exponent,
+                                                   significand, mode,
+                                                   bench_loc, scratch)
+                       : inputs[i][j];
+
+  Measurement measurement = measure(iterations, [&](long n) {
+    uint64_t sink = 0;
+    for (long i = 0; i < n; i++) {
+      double result = entry.call(args[i % RAPTOR_BENCH_INPUTS], exponent,
+                                 significand, mode, scratch);
+      if (mode == BENCH_MEM && !entry.compare)
+        __raptor_fprt_ieee_64_delete(result, exponent, significand, mode,
+                                     bench_loc, scratch);
+      else
+        sink ^= result_bits(result);
+    }
+    bench_sink = sink;
+  });
+
+  if (mode == BENCH_MEM) {
+    for (unsigned i = 0; i < RAPTOR_BENCH_INPUTS; i++)
+      for (unsigned j = 0; j < entry.arity; j++)
+        if (!(entry.int_arg && j == 1))
+          __raptor_fprt_ieee_64_delete(args[i][j], exponent, significand, mode,
+                                       bench_loc, scratch);
+    // The garbage collected runtime ignores the deletes.
+    raptor_fprt_gc_doit();
+  }
+  __raptor_fprt_ieee_64_trunc_change(0, exponent, significand, mode, bench_loc,
+                                     scratch);
+  __raptor_fprt_ieee_64_free_scratch(exponent, significand, mode, bench_loc,
+                                     scratch);
+  return measurement;
+}
+
+static const struct {
+  int64_t exponent;
+  int64_t significand;
+  bool double_only; // Only truncates double entry points.
+} bench_precisions[] = {
+    {11, 52, true}, // double
+    {8, 23, false}, // float
+    {8, 7, false},  // bfloat16
+    {5, 10, false}, // half
+};
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 10000;
+  const char *filter = argc > 2 ? argv[2] : "";
+  if (iterations <= 0) {
+    fprintf(stderr, "usage: %s [iterations] [entry point substring]\n",
+            argv[0]);
+    return 1;
+  }
+  open_cache_misses();
+
+  printf("# raptor-bench runtime=%s iterations=%ld\n", RAPTOR_BENCH_RUNTIME,
+         iterations);
+  printf("# entry\tmode\texponent\tsignificand\tns/op\tnative ns/op\tslowdown"
+         "\tallocs/op\tcache misses/op\n");
+  for (const BenchEntry &entry : bench_entries()) {
+    if (!strstr(entry.name, filter))
+      continue;
+    double inputs[RAPTOR_BENCH_INPUTS][RAPTOR_BENCH_MAX_ARGS];
+    bench_inputs(entry, inputs);
+    double native_ns = NAN;
+    if (auto native = find_native(entry))
+      native_ns = measure_native(native, inputs, iterations).ns;
+
+    for (bench_mode mode : {BENCH_OP, BENCH_MEM}) {
+      if (mode == BENCH_MEM && !entry.mem)
+        continue;
+      for (const auto &precision : bench_precisions) {
+        if (precision.double_only && entry.is_float)
+          continue;
+        Measurement m =
+            measure_entry(entry, mode, precision.exponent,
+                          precision.significand, inputs, iterations);
+        printf("%s\t%s\t%lld\t%lld\t%.2f\t%.2f\t%.1f\t%.2f\t%.2f\n",
+               entry.name, mode == BENCH_OP ? "op" : "mem",
+               (long long)precision.exponent,
+               (long long)precision.significand, m.ns, native_ns,
+               m.ns / native_ns, m.allocations, m.cache_misses);
+        fflush(stdout);
+      }
+    }
+  }
+  return 0;
+}
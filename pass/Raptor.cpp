@@ -24,6 +24,7 @@
 //
 //===----------------------------------------------------------------------===//
 #include "llvm/Config/llvm-config.h"
+#include "llvm/Demangle/Demangle.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/Pass.h"
@@ -101,6 +102,22 @@ llvm::cl::opt<bool> RaptorTruncateCount(
 llvm::cl::opt<bool> RaptorTruncateAccessCount(
     "raptor-truncate-access-count", cl::init(false), cl::Hidden,
     cl::desc("Count all floating-point loads and stores."));
+llvm::cl::opt<bool> RaptorCountPerAccess(
+    "raptor-count-per-access", cl::init(false), cl::Hidden,
+    cl::desc("Instrument every flop and memory access individually instead of "
+             "incrementing the counters once per block."));
+llvm::cl::opt<bool> RaptorCountProfile(
+    "raptor-count-profile", cl::init(false), cl::Hidden,
+    cl::desc("Attribute counted flops and memory accesses to their function "
+             "and source line for the runtime's flop profile."));
+llvm::cl::opt<bool> RaptorCallingContext(
+    "raptor-calling-context", cl::init(false), cl::Hidden,
+    cl::desc("Maintain a shadow call stack of truncated functions so that the "
+             "runtime attributes flops and errors to calling contexts."));
+llvm::cl::opt<bool> RaptorSampleSites(
+    "raptor-sample-sites", cl::init(false), cl::Hidden,
+    cl::desc("Keep the location of the truncated block being executed in a "
+             "thread local slot for the runtime's sampling profiler."));
 
 #define addAttribute addAttributeAtIndex
 #define getAttribute getAttributeAtIndex
@@ -451,6 +468,9 @@ class RaptorBase {
 public:
   RaptorLogic Logic;
   ThinOrFullLTOPhase Phase;
+  // Counting blocks of the functions, shared by the memory and the flop
+  // counting. Lowering the Raptor calls drops the ones whose CFG it changes.
+  DenseMap<Function *, std::unique_ptr<BlockCountPlacement>> Placements;
   RaptorBase(bool PostOpt, ThinOrFullLTOPhase Phase)
       : Logic(RaptorPostOpt.getNumOccurrences() ? RaptorPostOpt : PostOpt),
         Phase(Phase) {
@@ -584,6 +604,68 @@ public:
     return Logic.CreateTruncateValue(context, Addr, Truncation, isTruncate);
   }
 
+  const BlockCountPlacement &getPlacement(Function &F) {
+    auto &Placement = Placements[&F];
+    if (!Placement)
+      Placement = std::make_unique<BlockCountPlacement>(F);
+    return *Placement;
+  }
+
+  // Counts the bytes of floating-point loads and stores statically and
+  // increments the counters once per counting block (and profile site).
+  bool handleFlopMemoryPerBlock(Function &F) {
+    auto M = F.getParent();
+    auto &DL = M->getDataLayout();
+
+    const BlockCountPlacement &Placement = getPlacement(F);
+    MapVector<std::pair<BasicBlock *, unsigned>, std::pair<uint64_t, uint64_t>>
+        Bytes;
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        Type *ty;
+        if (auto load = dyn_cast<LoadInst>(&I))
+          ty = load->getType();
+        else if (auto store = dyn_cast<StoreInst>(&I))
+          ty = store->getValueOperand()->getType();
+        else
+          continue;
+        if (!ty->getScalarType()->isFloatingPointTy())
+          continue;
+        unsigned Site = RaptorCountProfile ? Logic.getProfileSite(I) : 0;
+        auto &Counts = Bytes[{Placement.getCountingBlock(&BB), Site}];
+        (isa<StoreInst>(I) ? Counts.second : Counts.first) +=
+            DL.getTypeStoreSize(ty);
+      }
+    }
+    if (Bytes.empty())
+      return false;
+
+    for (auto &[Key, Counts] : Bytes) {
+      auto [BB, Site] = Key;
+      IRBuilder<> B(BB, BB->getFirstInsertionPt());
+      createMemoryAccessBlockCall(B, Counts.first, Counts.second, Site);
+    }
+    return true;
+  }
+
+  // Counts `Loaded` and `Stored` bytes, attributed to the profile site `Site`
+  // with -raptor-count-profile.
+  void createMemoryAccessBlockCall(IRBuilderBase &B, uint64_t Loaded,
+                                   uint64_t Stored, unsigned Site) {
+    auto M = B.GetInsertBlock()->getModule();
+    SmallVector<Type *, 3> Params = {B.getInt64Ty(), B.getInt64Ty()};
+    SmallVector<Value *, 3> Args = {B.getInt64(Loaded), B.getInt64(Stored)};
+    auto fname = std::string(RaptorFPRTPrefix) + "memory_access_block";
+    if (RaptorCountProfile) {
+      fname = std::string(RaptorFPRTPrefix) + "memory_access_profile";
+      Params.push_back(B.getInt32Ty());
+      Args.push_back(Logic.createProfileSiteId(B, Site));
+    }
+    auto AccessF = M->getOrInsertFunction(
+        fname, FunctionType::get(B.getVoidTy(), Params, /*is_vararg*/ false));
+    B.CreateCall(AccessF, Args);
+  }
+
   bool handleFlopMemory(Function &F) {
     if (F.isDeclaration())
       return false;
@@ -593,21 +675,26 @@ public:
     if (F.getName().starts_with(RaptorFPRTPrefix))
       return false;
 
+    if (!RaptorCountPerAccess)
+      return handleFlopMemoryPerBlock(F);
+
     auto M = F.getParent();
     auto &DL = M->getDataLayout();
     IRBuilder<> B(M->getContext());
 
-    auto fname = std::string(RaptorFPRTPrefix) + "memory_access";
+    // The function name lets the runtime's cache simulator attribute the
+    // accesses to functions.
+    auto fname = std::string(RaptorFPRTPrefix) + "memory_access_fn";
     Function *AccessF = M->getFunction(fname);
     Type *PtrTy = PointerType::get(M->getContext(), 0);
+    Type *I64Ty = Type::getInt64Ty(M->getContext());
     if (!AccessF) {
-      FunctionType *FnTy =
-          FunctionType::get(Type::getVoidTy(M->getContext()),
-                            {PtrTy, Type::getInt64Ty(M->getContext()),
-                             Type::getInt64Ty(M->getContext())},
-                            /*is_vararg*/ false);
+      FunctionType *FnTy = FunctionType::get(
+          Type::getVoidTy(M->getContext()), {PtrTy, I64Ty, I64Ty, I64Ty, PtrTy},
+          /*is_vararg*/ false);
       AccessF = Function::Create(FnTy, Function::ExternalLinkage, fname, M);
     }
+    Value *FuncName = nullptr;
 
     for (auto &BB : F) {
       for (auto &I : BB) {
@@ -626,10 +713,21 @@ public:
           continue;
         }
         uint64_t size = DL.getTypeStoreSize(ty);
-        CallInst::Create(AccessF,
-                         {B.CreateAddrSpaceCast(ptr, PtrTy), B.getInt64(size),
-                          B.getInt64(isStore)},
-                         "", I.getIterator());
+        if (RaptorCountProfile) {
+          IRBuilder<> Builder(&I);
+          createMemoryAccessBlockCall(Builder, isStore ? 0 : size,
+                                      isStore ? size : 0,
+                                      Logic.getProfileSite(I));
+          continue;
+        }
+        B.SetInsertPoint(&I);
+        if (!FuncName)
+          FuncName = B.CreateGlobalString(demangle(F.getName().str()),
+                                          "__raptor_fn_name");
+        bool isFP = ty->getScalarType()->isFloatingPointTy();
+        B.CreateCall(AccessF,
+                     {B.CreateAddrSpaceCast(ptr, PtrTy), B.getInt64(size),
+                      B.getInt64(isStore), B.getInt64(isFP), FuncName});
       }
     }
 
@@ -645,10 +743,12 @@ public:
     if (F.getName().starts_with(RaptorFPRTPrefix))
       return false;
 
+    const BlockCountPlacement *Placement =
+        RaptorCountPerAccess ? nullptr : &getPlacement(F);
     for (auto Repr :
          {FloatRepresentation::getIEEE(16), FloatRepresentation::getIEEE(32),
           FloatRepresentation::getIEEE(64)})
-      Logic.CountInFunc(&F, Repr);
+      Logic.CountInFunc(&F, Repr, Placement);
     return true;
   }
 
@@ -722,8 +822,10 @@ public:
     if (F.empty())
       return false;
 
-    if (handleFullModuleTrunc(F))
+    if (handleFullModuleTrunc(F)) {
+      Placements.erase(&F);
       return true;
+    }
 
     bool Changed = false;
 
@@ -763,6 +865,7 @@ public:
         II->getUnwindDest()->removePredecessor(&BB);
 
         II->eraseFromParent();
+        Placements.erase(&F);
         Changed = true;
       }
 
@@ -1025,6 +1128,7 @@ public:
             fn = ci->getOperand(0);
           }
           if (auto si = dyn_cast<SelectInst>(fn)) {
+            Placements.erase(&F);
             BasicBlock *post = BB.splitBasicBlock(CI);
             BasicBlock *sel1 = BasicBlock::Create(BB.getContext(), "sel1", &F);
             BasicBlock *sel2 = BasicBlock::Create(BB.getContext(), "sel2", &F);
@@ -1163,7 +1267,11 @@ public:
       changed |= handleFlopCount(F);
     }
 
+    if (RaptorCountProfile)
+      Logic.emitProfileSites(M);
+
     Logic.clear();
+    Placements.clear();
 
     if (changed && Logic.PostOpt) {
       TimeTraceScope timeScope("Raptor PostOpt", M.getName());
@@ -12,6 +12,7 @@
 #include "RaptorLogic.h"
 #include "Utils.h"
 #include "llvm-c/Core.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DebugInfoMetadata.h"
@@ -52,6 +53,7 @@
 
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include "llvm/Analysis/BasicAliasAnalysis.h"
 #include "llvm/Analysis/GlobalsModRef.h"
@@ -288,27 +290,151 @@ public:
   }
 };
 
-// TODO we should add an integer parameter to the count function and pass in the
-// instruction cost.
+// Operation classes of the flop counters, the numbering has to match
+// raptor_fprt_op_class in runtime/include/public/raptor/raptor.h. The runtime
+// weighs the classes with a configurable cost table.
+enum class FlopClass : unsigned {
+  Add,
+  Mul,
+  FMA,
+  Div,
+  Sqrt,
+  Transcendental,
+  Compare,
+  Conversion,
+  Sign,
+};
+
+static FlopClass getFlopClass(Intrinsic::ID ID, StringRef FuncName) {
+  switch (ID) {
+  case Intrinsic::vector_reduce_fadd:
+  case Intrinsic::vp_fadd:
+  case Intrinsic::vp_fsub:
+  case Intrinsic::vp_reduce_fadd:
+    return FlopClass::Add;
+  case Intrinsic::vector_reduce_fmul:
+  case Intrinsic::vp_fmul:
+  case Intrinsic::vp_reduce_fmul:
+    return FlopClass::Mul;
+  case Intrinsic::vp_fdiv:
+  case Intrinsic::vp_frem:
+    return FlopClass::Div;
+  case Intrinsic::fma:
+  case Intrinsic::fmuladd:
+    return FlopClass::FMA;
+  case Intrinsic::sqrt:
+    return FlopClass::Sqrt;
+#if LLVM_VERSION_MAJOR >= 17
+  case Intrinsic::ldexp:
+    return FlopClass::Mul;
+  case Intrinsic::vp_fma:
+  case Intrinsic::vp_fmuladd:
+    return FlopClass::FMA;
+  case Intrinsic::vp_sqrt:
+    return FlopClass::Sqrt;
+  case Intrinsic::vp_fabs:
+  case Intrinsic::vp_copysign:
+    return FlopClass::Sign;
+  case Intrinsic::vector_reduce_fmaximum:
+  case Intrinsic::vector_reduce_fminimum:
+  case Intrinsic::vp_minnum:
+  case Intrinsic::vp_maxnum:
+    return FlopClass::Compare;
+  case Intrinsic::vp_floor:
+  case Intrinsic::vp_ceil:
+  case Intrinsic::vp_round:
+  case Intrinsic::vp_roundeven:
+  case Intrinsic::vp_roundtozero:
+  case Intrinsic::vp_rint:
+  case Intrinsic::vp_nearbyint:
+    return FlopClass::Conversion;
+#endif
+  case Intrinsic::fabs:
+  case Intrinsic::copysign:
+    return FlopClass::Sign;
+  case Intrinsic::minnum:
+  case Intrinsic::maxnum:
+  case Intrinsic::minimum:
+  case Intrinsic::maximum:
+  case Intrinsic::vector_reduce_fmax:
+  case Intrinsic::vector_reduce_fmin:
+  case Intrinsic::vp_reduce_fmax:
+  case Intrinsic::vp_reduce_fmin:
+    return FlopClass::Compare;
+  case Intrinsic::floor:
+  case Intrinsic::ceil:
+  case Intrinsic::trunc:
+  case Intrinsic::round:
+  case Intrinsic::roundeven:
+  case Intrinsic::rint:
+  case Intrinsic::nearbyint:
+  case Intrinsic::lround:
+  case Intrinsic::llround:
+  case Intrinsic::lrint:
+  case Intrinsic::llrint:
+    return FlopClass::Conversion;
+  case Intrinsic::not_intrinsic:
+    // libm functions without an intrinsic.
+    if (FuncName.contains("fmod") || FuncName.contains("remainder"))
+      return FlopClass::Div;
+    if (FuncName.contains("fdim"))
+      return FlopClass::Add;
+    return FlopClass::Transcendental;
+  default:
+    return FlopClass::Transcendental;
+  }
+}
+
+// Vector operands may also be passed to intrinsics which only move data, such
+// as masked loads or shuffles, so only these count as vector flops.
+static bool isVectorFlop(Intrinsic::ID ID) {
+  switch (ID) {
+  case Intrinsic::sin:
+  case Intrinsic::cos:
+  case Intrinsic::exp:
+  case Intrinsic::exp2:
+  case Intrinsic::log:
+  case Intrinsic::log2:
+  case Intrinsic::log10:
+  case Intrinsic::pow:
+  case Intrinsic::powi:
+    return true;
+  case Intrinsic::not_intrinsic:
+    return false;
+  default:
+    return getFlopClass(ID, "") != FlopClass::Transcendental;
+  }
+}
+
 class CountGenerator : public llvm::InstVisitor<CountGenerator> {
 private:
   FloatRepresentation FR;
   LLVMContext &Ctx;
   Module &M;
-  Function *CountFunc;
+  const BlockCountPlacement *Placement;
+  // Owns the profile sites if flops are attributed to them.
+  RaptorLogic *Profile;
+  // Lanes per counting block, flop class, whether they were vector flops and
+  // profile site. Scalable vectors are kept apart and multiplied by vscale
+  // when emitted.
+  struct LaneCounts {
+    uint64_t Fixed = 0;
+    uint64_t Scalable = 0;
+  };
+  MapVector<std::tuple<BasicBlock *, unsigned, unsigned, unsigned>, LaneCounts>
+      BlockCounts;
 
 public:
-  CountGenerator(FloatRepresentation FR, Function *F)
-      : FR(FR), Ctx(F->getContext()), M(*F->getParent()) {
-    CountFunc = getCountFunc();
-  }
+  CountGenerator(FloatRepresentation FR, Function *F,
+                 const BlockCountPlacement *Placement, RaptorLogic *Profile)
+      : FR(FR), Ctx(F->getContext()), M(*F->getParent()),
+        Placement(Placement), Profile(Profile) {}
 
-  Function *getCountFunc() {
+  Function *getCountFunc(StringRef Suffix, ArrayRef<Type *> ArgTypes) {
     auto MangledName =
-        std::string(RaptorFPRTPrefix) + FR.getMangling() + "_count";
+        std::string(RaptorFPRTPrefix) + FR.getMangling() + Suffix.str();
     auto F = M.getFunction(MangledName);
     if (!F) {
-      SmallVector<Type *, 4> ArgTypes;
       IRBuilder<> B(Ctx);
       FunctionType *FnTy =
           FunctionType::get(B.getVoidTy(), ArgTypes, /*is_vararg*/ false);
@@ -317,9 +443,105 @@ public:
     return F;
   }
 
-  void flop(Instruction &I) {
-    IRBuilder B(&I);
-    B.CreateCall(CountFunc);
+  // The number of elements of T if T is the counted type or a vector of it
+  // and zero otherwise.
+  ElementCount getLanes(Type *T) {
+    if (T == getFloatType())
+      return ElementCount::getFixed(1);
+    if (auto VT = dyn_cast<VectorType>(T))
+      if (VT->getElementType() == getFloatType())
+        return VT->getElementCount();
+    return ElementCount::getFixed(0);
+  }
+
+  Value *createLaneCount(IRBuilderBase &B, const LaneCounts &Lanes) {
+    if (!Lanes.Scalable)
+      return B.getInt64(Lanes.Fixed);
+    Value *N = B.CreateVScale(B.getInt64(Lanes.Scalable));
+    if (Lanes.Fixed)
+      N = B.CreateAdd(N, B.getInt64(Lanes.Fixed));
+    return N;
+  }
+
+  // The lanes a VP intrinsic operates on, the mask bits which are set below
+  // the explicit vector length.
+  Value *createActiveLanes(VPIntrinsic &VPI) {
+    Value *Mask = VPI.getMaskParam();
+    Value *EVL = VPI.getVectorLengthParam();
+    if (!Mask || !EVL)
+      return nullptr;
+    IRBuilder<> B(&VPI);
+    auto EC = cast<VectorType>(Mask->getType())->getElementCount();
+    Value *Active =
+        B.CreateICmpULT(B.CreateStepVector(VectorType::get(EVL->getType(), EC)),
+                        B.CreateVectorSplat(EC, EVL));
+    Active = B.CreateAnd(Active, Mask);
+    return B.CreateAddReduce(
+        B.CreateZExt(Active, VectorType::get(B.getInt64Ty(), EC)));
+  }
+
+  // Emits the increment of the counters of `Class` by `N` flops, a single
+  // scalar flop if `N` is null.
+  void emitCount(IRBuilderBase &B, unsigned Class, bool IsVector, Value *N,
+                 unsigned Site) {
+    if (Profile) {
+      B.CreateCall(getCountFunc("_count_profile",
+                                {B.getInt32Ty(), B.getInt64Ty(),
+                                 B.getInt32Ty(), B.getInt32Ty()}),
+                   {B.getInt32(Class), N ? N : B.getInt64(1),
+                    B.getInt32(IsVector),
+                    Profile->createProfileSiteId(B, Site)});
+    } else if (IsVector) {
+      B.CreateCall(getCountFunc("_count_vector_block",
+                                {B.getInt32Ty(), B.getInt64Ty()}),
+                   {B.getInt32(Class), N});
+    } else if (N) {
+      B.CreateCall(getCountFunc("_count_class_block",
+                                {B.getInt32Ty(), B.getInt64Ty()}),
+                   {B.getInt32(Class), N});
+    } else {
+      B.CreateCall(getCountFunc("_count_class", {B.getInt32Ty()}),
+                   {B.getInt32(Class)});
+    }
+  }
+
+  // Counts a flop on `Lanes` elements, or on `ActiveLanes` elements if the
+  // number of active lanes is only known at run time.
+  void flop(Instruction &I, FlopClass Class,
+            ElementCount Lanes = ElementCount::getFixed(1),
+            Value *ActiveLanes = nullptr) {
+    unsigned Site = Profile ? Profile->getProfileSite(I) : 0;
+    if (ActiveLanes) {
+      IRBuilder<> B(&I);
+      emitCount(B, (unsigned)Class, /*IsVector*/ true, ActiveLanes, Site);
+      return;
+    }
+    bool IsVector = Lanes.isVector();
+    LaneCounts Counts;
+    (Lanes.isScalable() ? Counts.Scalable : Counts.Fixed) =
+        Lanes.getKnownMinValue();
+    if (Placement) {
+      auto &BlockCount =
+          BlockCounts[{Placement->getCountingBlock(I.getParent()),
+                       (unsigned)Class, IsVector, Site}];
+      BlockCount.Fixed += Counts.Fixed;
+      BlockCount.Scalable += Counts.Scalable;
+      return;
+    }
+    IRBuilder<> B(&I);
+    emitCount(B, (unsigned)Class, IsVector,
+              IsVector ? createLaneCount(B, Counts) : nullptr, Site);
+  }
+
+  // Emits one counter increment per counting block, flop class and profile
+  // site.
+  void emitBlockCounts() {
+    for (auto &[Key, Counts] : BlockCounts) {
+      auto [BB, Class, IsVector, Site] = Key;
+      IRBuilder<> B(BB, BB->getFirstInsertionPt());
+      emitCount(B, Class, IsVector, createLaneCount(B, Counts), Site);
+    }
+    BlockCounts.clear();
   }
 
   Type *getFloatType() { return FR.getBuiltinType(Ctx); }
@@ -328,8 +550,8 @@ public:
     auto oldLHS = BO.getOperand(0);
     auto oldRHS = BO.getOperand(1);
 
-    if (oldLHS->getType() != getFloatType() &&
-        oldRHS->getType() != getFloatType())
+    ElementCount Lanes = getLanes(BO.getType());
+    if (Lanes.isZero())
       return;
 
     switch (BO.getOpcode()) {
@@ -350,29 +572,81 @@ public:
     case BinaryOperator::Xor:
       assert(0 && "Invalid binop opcode for float arg");
       return;
+    case BinaryOperator::FAdd:
+    case BinaryOperator::FSub:
+      flop(BO, FlopClass::Add, Lanes);
+      return;
+    case BinaryOperator::FMul:
+      flop(BO, FlopClass::Mul, Lanes);
+      return;
+    case BinaryOperator::FDiv:
+    case BinaryOperator::FRem:
+      flop(BO, FlopClass::Div, Lanes);
+      return;
     }
 
-    flop(BO);
-
     return;
   }
 
-  bool handleIntrinsic(llvm::CallBase &CI, Intrinsic::ID ID) {
+  void visitUnaryOperator(llvm::UnaryOperator &I) {
+    if (I.getOpcode() != UnaryOperator::FNeg)
+      return;
+    ElementCount Lanes = getLanes(I.getType());
+    if (!Lanes.isZero())
+      flop(I, FlopClass::Sign, Lanes);
+  }
+
+  void visitFCmpInst(llvm::FCmpInst &CI) {
+    ElementCount Lanes = getLanes(CI.getOperand(0)->getType());
+    if (!Lanes.isZero())
+      flop(CI, FlopClass::Compare, Lanes);
+  }
+
+  // Casts between floating point types count in the precision of their
+  // operand, so that an fpext is not counted in both precisions.
+  void visitCastInst(llvm::CastInst &CI) {
+    Type *CountedTy;
+    switch (CI.getOpcode()) {
+    case Instruction::FPTrunc:
+    case Instruction::FPExt:
+    case Instruction::FPToUI:
+    case Instruction::FPToSI:
+      CountedTy = CI.getSrcTy();
+      break;
+    case Instruction::UIToFP:
+    case Instruction::SIToFP:
+      CountedTy = CI.getDestTy();
+      break;
+    default:
+      return;
+    }
+    ElementCount Lanes = getLanes(CountedTy);
+    if (!Lanes.isZero())
+      flop(CI, FlopClass::Conversion, Lanes);
+  }
+
+  bool handleIntrinsic(llvm::CallBase &CI, Intrinsic::ID ID,
+                       StringRef FuncName = "") {
     if (isDbgInfoIntrinsic(ID))
       return true;
 
-    bool hasFromType = false;
-    for (unsigned i = 0; i < CI.arg_size(); ++i)
-      if (CI.getOperand(i)->getType() == getFloatType())
-        hasFromType = true;
-    if (CI.getType() == getFloatType()) {
-      hasFromType = true;
+    // Vector flops and reductions count one operation per element.
+    ElementCount Lanes = getLanes(CI.getType());
+    for (unsigned i = 0; i < CI.arg_size(); ++i) {
+      ElementCount ArgLanes = getLanes(CI.getOperand(i)->getType());
+      if (ElementCount::isKnownGT(ArgLanes, Lanes))
+        Lanes = ArgLanes;
     }
 
-    if (!hasFromType)
+    if (Lanes.isZero())
+      return false;
+    if (Lanes.isVector() && !isVectorFlop(ID))
       return false;
 
-    flop(CI);
+    Value *ActiveLanes = nullptr;
+    if (auto VPI = dyn_cast<VPIntrinsic>(&CI))
+      ActiveLanes = createActiveLanes(*VPI);
+    flop(CI, getFlopClass(ID, FuncName), Lanes, ActiveLanes);
 
     return true;
   }
@@ -385,7 +659,7 @@ public:
     Intrinsic::ID ID;
     StringRef funcName = getFuncNameFromCall(const_cast<CallBase *>(&CI));
     if (isMemFreeLibMFunction(funcName, &ID))
-      if (handleIntrinsic(CI, ID))
+      if (handleIntrinsic(CI, ID, funcName))
         return;
   }
 };
@@ -445,6 +719,10 @@ public:
       }
     };
     if (Truncation.isToFPRT()) {
+      if (RaptorCallingContext)
+        pushCallingContext(oldFunc, newFunc);
+      if (RaptorSampleSites)
+        publishSampleSites(newFunc);
       if (Mode == TruncOpMode) {
         if (TC.NeedTruncChange || TC.NeedNewScratch)
           AllocScratch();
@@ -463,6 +741,82 @@ public:
     }
   }
 
+  // Pushes the truncated function onto the runtime's shadow call stack on entry
+  // and pops it before every return and resume, or before the musttail call
+  // of a return since nothing may come between the two. Frames unwound by an
+  // exception never reach those, so every landing pad also pops the stack back
+  // down to this function, and the pops restore the depth of the push rather
+  // than popping a single context.
+  void pushCallingContext(Function *oldFunc, Function *newFunc) {
+    Module &M = *newFunc->getParent();
+    IRBuilder<> B(newFunc->getContext());
+    B.SetInsertPointPastAllocas(newFunc);
+    Type *PtrTy = PointerType::get(newFunc->getContext(), 0);
+    auto PushF = M.getOrInsertFunction(
+        std::string(RaptorFPRTPrefix) + "context_push",
+        FunctionType::get(B.getInt32Ty(), {PtrTy}, /*is_vararg*/ false));
+    auto PopF = M.getOrInsertFunction(
+        std::string(RaptorFPRTPrefix) + "context_pop",
+        FunctionType::get(B.getVoidTy(), {B.getInt32Ty()},
+                          /*is_vararg*/ false));
+    Value *Name = B.CreateGlobalString(demangle(oldFunc->getName().str()),
+                                       "__raptor_context_name");
+    Value *Depth = B.CreateCall(PushF, {Name}, "raptor_context_depth");
+    for (auto &BB : *newFunc) {
+      if (BB.isLandingPad()) {
+        B.SetInsertPoint(&BB, BB.getFirstInsertionPt());
+        B.CreateCall(PopF, {B.CreateAdd(Depth, B.getInt32(1))});
+      }
+      Instruction *Term = BB.getTerminator();
+      if (isa<ReturnInst>(Term) || isa<ResumeInst>(Term)) {
+        if (CallInst *MustTail = BB.getTerminatingMustTailCall())
+          B.SetInsertPoint(MustTail);
+        else
+          B.SetInsertPoint(Term);
+        B.CreateCall(PopF, {Depth});
+      }
+    }
+  }
+
+  // Stores the location of the first truncated operation of every block into
+  // the runtime's thread local sample site slot on block entry, and restores
+  // the site of the caller before every return, or before its musttail call.
+  void publishSampleSites(Function *newFunc) {
+    Module &M = *newFunc->getParent();
+    Type *PtrTy = PointerType::get(newFunc->getContext(), 0);
+    auto *Slot = cast<GlobalVariable>(M.getOrInsertGlobal(
+        std::string(RaptorFPRTPrefix) + "sample_site", PtrTy));
+    Slot->setThreadLocal(true);
+    IRBuilder<> B(newFunc->getContext());
+    B.SetInsertPointPastAllocas(newFunc);
+    auto *CallerSite = B.CreateLoad(PtrTy, Slot, "raptor_caller_site");
+    auto IsTruncated = [&](Instruction &I) {
+      if (isa<PHINode>(I) || isa<LoadInst>(I) || isa<StoreInst>(I))
+        return false;
+      return I.getType() == getFromType() ||
+             any_of(I.operands(), [&](Use &U) {
+               return U.get()->getType() == getFromType();
+             });
+    };
+    for (auto &BB : *newFunc) {
+      auto Op = find_if(BB, IsTruncated);
+      if (Op != BB.end()) {
+        if (&BB == &newFunc->getEntryBlock())
+          B.SetInsertPoint(CallerSite->getNextNode());
+        else
+          B.SetInsertPoint(&*BB.getFirstInsertionPt());
+        B.CreateStore(getUniquedLocStr(&*Op), Slot);
+      }
+      if (isa<ReturnInst>(BB.getTerminator())) {
+        if (CallInst *MustTail = BB.getTerminatingMustTailCall())
+          B.SetInsertPoint(MustTail);
+        else
+          B.SetInsertPoint(BB.getTerminator());
+        B.CreateStore(CallerSite, Slot);
+      }
+    }
+  }
+
   void todo(llvm::Instruction &I) {
     if (all_of(I.operands(),
                [&](Use &U) { return U.get()->getType() != fromType; }) &&
@@ -1020,12 +1374,15 @@ bool RaptorLogic::CreateTruncateValue(RequestContext context, Value *v,
   return true;
 }
 
-bool RaptorLogic::CountInFunc(llvm::Function *F, FloatRepresentation FR) {
+bool RaptorLogic::CountInFunc(llvm::Function *F, FloatRepresentation FR,
+                              const BlockCountPlacement *Placement) {
 
-  CountGenerator Handle(FR, F);
+  CountGenerator Handle(FR, F, Placement,
+                        RaptorCountProfile ? this : nullptr);
   for (auto &BB : *F)
     for (auto &I : BB)
       Handle.visit(&I);
+  Handle.emitBlockCounts();
 
   if (llvm::verifyFunction(*F, &llvm::errs())) {
     llvm::errs() << *F << "\n";
@@ -1128,6 +1485,65 @@ llvm::Function *RaptorLogic::CreateTruncateFunc(RequestContext Context,
   return NewF;
 }
 
+unsigned RaptorLogic::getProfileSite(llvm::Instruction &I) {
+  std::string Function = llvm::demangle(I.getFunction()->getName().str());
+  std::string Loc = "unknown:0";
+  if (DILocation *DL = I.getDebugLoc())
+    Loc = DL->getFilename().str() + ":" + std::to_string(DL->getLine());
+  auto [It, Inserted] =
+      ProfileSiteIds.try_emplace({Function, Loc}, ProfileSites.size());
+  if (Inserted)
+    ProfileSites.push_back({Function, Loc});
+  return It->second;
+}
+
+llvm::Value *RaptorLogic::createProfileSiteId(llvm::IRBuilderBase &B,
+                                              unsigned Site) {
+  // Counts made before the constructor registered the sites, e.g. from the
+  // constructors of other modules, get negative ids which the runtime ignores.
+  if (!ProfileBase)
+    ProfileBase = new GlobalVariable(
+        *B.GetInsertBlock()->getModule(), B.getInt32Ty(), /*isConstant*/ false,
+        GlobalValue::PrivateLinkage, B.getInt32(INT32_MIN),
+        "__raptor_profile_base");
+  return B.CreateAdd(B.CreateLoad(B.getInt32Ty(), ProfileBase),
+                     B.getInt32(Site));
+}
+
+void RaptorLogic::emitProfileSites(llvm::Module &M) {
+  if (ProfileSites.empty() || !ProfileBase)
+    return;
+  LLVMContext &Ctx = M.getContext();
+  IRBuilder<> B(Ctx);
+
+  // struct { const char *function; const char *loc; }
+  auto SiteTy = StructType::get(B.getPtrTy(), B.getPtrTy());
+  SmallVector<Constant *, 16> Sites;
+  for (auto &[Function, Loc] : ProfileSites)
+    Sites.push_back(ConstantStruct::get(
+        SiteTy, {createPrivateGlobalForString(M, Function, true),
+                 createPrivateGlobalForString(M, Loc, true)}));
+  auto TableTy = ArrayType::get(SiteTy, Sites.size());
+  auto Table = new GlobalVariable(M, TableTy, /*isConstant*/ true,
+                                  GlobalValue::PrivateLinkage,
+                                  ConstantArray::get(TableTy, Sites),
+                                  "__raptor_profile_sites");
+
+  auto Ctor = Function::Create(FunctionType::get(B.getVoidTy(), false),
+                               GlobalValue::InternalLinkage,
+                               "__raptor_profile_register_sites", M);
+  B.SetInsertPoint(BasicBlock::Create(Ctx, "", Ctor));
+  auto Register = M.getOrInsertFunction(
+      std::string(RaptorFPRTPrefix) + "profile_register", B.getVoidTy(),
+      B.getPtrTy(), B.getInt32Ty(), B.getPtrTy());
+  B.CreateCall(Register, {Table, B.getInt32(Sites.size()), ProfileBase});
+  B.CreateRetVoid();
+  appendToGlobalCtors(M, Ctor, 65535);
+}
+
 void RaptorLogic::clear() {
   // PPC.clear();
+  ProfileSiteIds.clear();
+  ProfileSites.clear();
+  ProfileBase = nullptr;
 }
@@ -16,6 +16,7 @@
 #include <map>
 #include <set>
 #include <utility>
+#include <vector>
 
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
@@ -32,8 +33,14 @@
 extern "C" {
 extern llvm::cl::opt<bool> RaptorPrint;
 extern llvm::cl::opt<bool> RaptorJuliaAddrLoad;
+extern llvm::cl::opt<bool> RaptorCountPerAccess;
+extern llvm::cl::opt<bool> RaptorCountProfile;
+extern llvm::cl::opt<bool> RaptorCallingContext;
+extern llvm::cl::opt<bool> RaptorSampleSites;
 }
 
+class BlockCountPlacement;
+
 constexpr char RaptorFPRTPrefix[] = "__raptor_fprt_";
 constexpr char RaptorFPRTOriginalPrefix[] = "__raptor_fprt_original_";
 
@@ -353,7 +360,26 @@ public:
                                      TruncationConfiguration TC);
   bool CreateTruncateValue(RequestContext context, llvm::Value *addr,
                            FloatTruncation Truncation, bool isTruncate);
-  bool CountInFunc(llvm::Function *F, FloatRepresentation FR);
+  /// Counts the flops of type \p FR in \p F, once per counting block of
+  /// \p Placement or, if it is null, before every flop.
+  bool CountInFunc(llvm::Function *F, FloatRepresentation FR,
+                   const BlockCountPlacement *Placement);
+
+  /// Sites of the flop profile of the current module, one per function and
+  /// source line, see -raptor-count-profile.
+  std::map<std::pair<std::string, std::string>, unsigned> ProfileSiteIds;
+  std::vector<std::pair<std::string, std::string>> ProfileSites;
+  llvm::GlobalVariable *ProfileBase = nullptr;
+
+  /// Returns the profile site of \p I, relative to the first site of the
+  /// module.
+  unsigned getProfileSite(llvm::Instruction &I);
+  /// Computes the global id of the profile site \p Site, the runtime assigns
+  /// each module a range of ids when its sites are registered.
+  llvm::Value *createProfileSiteId(llvm::IRBuilderBase &B, unsigned Site);
+  /// Emits the table of profile sites and a constructor registering it with
+  /// the runtime.
+  void emitProfileSites(llvm::Module &M);
 
   void clear();
 };
@@ -10,8 +10,13 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/IR/IRBuilder.h"
@@ -63,3 +68,58 @@ RaptorFailure::RaptorFailure(const llvm::Twine &RemarkName,
                              const llvm::DiagnosticLocation &Loc,
                              const llvm::Function *CodeRegion)
     : DiagnosticInfoUnsupported(*CodeRegion, RemarkName, Loc) {}
+
+// LoopInfo only describes natural loops, blocks in irreducible cycles would
+// look like they execute at most once.
+static bool hasIrreducibleControlFlow(llvm::Function &F,
+                                      llvm::DominatorTree &DT) {
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> RPONumber;
+  llvm::ReversePostOrderTraversal<llvm::Function *> RPOT(&F);
+  unsigned Number = 0;
+  for (llvm::BasicBlock *BB : RPOT)
+    RPONumber[BB] = Number++;
+  for (llvm::BasicBlock *BB : RPOT)
+    for (llvm::BasicBlock *Succ : llvm::successors(BB))
+      if (RPONumber.lookup(Succ) <= RPONumber.lookup(BB) &&
+          !DT.dominates(Succ, BB))
+        return true;
+  return false;
+}
+
+// Whether \p BB runs exactly once per iteration of its innermost loop.
+static bool runsEveryIteration(llvm::BasicBlock *BB, llvm::DominatorTree &DT,
+                               llvm::LoopInfo &LI) {
+  llvm::Loop *L = LI.getLoopFor(BB);
+  if (!L)
+    return true;
+  llvm::SmallVector<llvm::BasicBlock *, 4> Blocks;
+  L->getLoopLatches(Blocks);
+  L->getExitingBlocks(Blocks);
+  for (llvm::BasicBlock *Other : Blocks)
+    if (!DT.dominates(BB, Other))
+      return false;
+  return true;
+}
+
+BlockCountPlacement::BlockCountPlacement(llvm::Function &F) {
+  llvm::DominatorTree DT(F);
+  llvm::PostDominatorTree PDT(F);
+  llvm::LoopInfo LI(DT);
+  bool Irreducible = hasIrreducibleControlFlow(F, DT);
+
+  for (llvm::BasicBlock &BB : F) {
+    llvm::BasicBlock *Counting = &BB;
+    if (!Irreducible && DT.isReachableFromEntry(&BB) &&
+        runsEveryIteration(&BB, DT, LI)) {
+      llvm::Loop *L = LI.getLoopFor(&BB);
+      for (auto *Node = DT.getNode(&BB)->getIDom(); Node;
+           Node = Node->getIDom()) {
+        llvm::BasicBlock *Dom = Node->getBlock();
+        if (LI.getLoopFor(Dom) == L && PDT.dominates(&BB, Dom) &&
+            Dom->getFirstInsertionPt() != Dom->end())
+          Counting = Dom;
+      }
+    }
+    CountingBlocks[&BB] = Counting;
+  }
+}
@@ -13,6 +13,7 @@
 #ifndef RAPTOR_UTILS_H
 #define RAPTOR_UTILS_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/GlobalAlias.h"
 #include "llvm/IR/IRBuilder.h"
@@ -180,6 +181,25 @@ static inline bool isMemFreeLibMFunction(llvm::StringRef str,
   return false;
 }
 
+/// Maps every block of a function to the block in which its execution count
+/// is recorded. Blocks which always execute as often as one of their
+/// dominators share the counter of the topmost such dominator: within the same
+/// loop (or outside of all loops) a block which postdominates its dominator
+/// and, inside a loop, dominates all latches and exiting blocks of the loop
+/// runs exactly once per execution of that dominator.
+///
+/// Like edge profiling this assumes that calls return, a call which exits or
+/// unwinds past a merged block makes the merged counts too high.
+class BlockCountPlacement {
+public:
+  BlockCountPlacement(llvm::Function &F);
+
+  llvm::BasicBlock *getCountingBlock(llvm::BasicBlock *BB) const {
+    return CountingBlocks.lookup(BB);
+  }
 
+private:
+  llvm::DenseMap<llvm::BasicBlock *, llvm::BasicBlock *> CountingBlocks;
+};
 
 #endif // RAPTOR_UTILS
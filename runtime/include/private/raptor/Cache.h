@@ -0,0 +1,27 @@
+#ifndef _RAPTOR_CACHE_H_
+#define _RAPTOR_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Cache simulation of the memory accesses counted per access.
+//
+// Code compiled with -raptor-truncate-access-count -raptor-count-per-access
+// reports every load and store with the name of its function.
+//
+// With RAPTOR_FPRT_CACHE set, every access goes through a set-associative,
+// write-back, write-allocate LRU cache hierarchy shared by all threads. A
+// second hierarchy simulates the same program with the floating-point accesses
+// made while truncating shrunk to the width of the truncated type, as if the
+// data was stored in that format. Misses and DRAM traffic of both are reported
+// per function at exit.
+
+extern bool __raptor_fprt_cache_enabled;
+
+// Bytes of the type the running truncation truncates to, set by trunc_change.
+extern std::atomic<int64_t> __raptor_fprt_trunc_bytes;
+
+void __raptor_fprt_cache_access(void *ptr, int64_t size, bool is_store,
+                                bool is_fp, const char *func);
+
+#endif // _RAPTOR_CACHE_H_
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <mpfr.h>
+#include <string>
 
 #define MAX_MPFR_OPERANDS 3
 
@@ -13,7 +14,16 @@
 #define __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE GMP_RNDN
 #define __RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS 114
 
+// Buckets of the cancellation histogram. Bucket `i` counts additions and
+// subtractions which lost `i` bits, the second to last bucket everything
+// beyond, the last one results which cancelled to exactly zero.
+#define RAPTOR_FPRT_CANCEL_BUCKETS 64
+#define RAPTOR_FPRT_CANCEL_ZERO (RAPTOR_FPRT_CANCEL_BUCKETS - 1)
+
 extern std::atomic<long long> shadow_err_counter;
+
+// Replaces a `%p` in the path of an output file by the process id.
+std::string __raptor_fprt_expand_path(const char *path);
 extern std::atomic<bool> global_is_truncating;
 
 typedef struct __raptor_op {
@@ -22,8 +32,18 @@ typedef struct __raptor_op {
   long long count_thresh = 0; // Number of error violations
   long long count = 0;        // Number of samples
   long long count_ignore = 0;
+  double rel_err = 0;         // Running local relative error (op mode).
+  double max_rel_err = 0;     // Largest local relative error (op mode).
+  long long count_flip = 0;   // Number of flipped comparisons (op mode).
 } __raptor_op;
 
+// Histogram of the bits lost to cancellation at a site. Only runtimes built
+// with RAPTOR_FPRT_ENABLE_CANCELLATION record one, next to the statistics in
+// the per-thread site tables, so that __raptor_op stays small otherwise.
+typedef struct __raptor_cancel {
+  long long bits[RAPTOR_FPRT_CANCEL_BUCKETS] = {};
+} __raptor_cancel;
+
 // For internal use
 // struct __raptor_fp;
 typedef struct __raptor_fp {
@@ -44,6 +64,31 @@ static inline bool __raptor_fprt_is_full_module_op_mode(int64_t mode) {
   return mode & 0b0100;
 }
 
+// The exponent range of a format with `exponent` exponent bits and
+// `significand` significand bits, see MPFR_FP_EMULATION in ir/Mpfr.cpp.
+static inline mpfr_exp_t __raptor_fprt_emax(int64_t exponent) {
+  return (mpfr_exp_t)1 << (exponent - 1);
+}
+static inline mpfr_exp_t __raptor_fprt_emin(int64_t exponent,
+                                            int64_t significand) {
+  return -__raptor_fprt_emax(exponent) + 2 - significand + 2;
+}
+
+// Op mode sets the exponent range of MPFR for the whole truncated region.
+// Memory mode values of different truncations coexist, so MPFR keeps its
+// default range and every memory mode value is brought into the range of its
+// format when it is created, overflowing to infinity or underflowing to zero.
+static inline void __raptor_fprt_mem_range(mpfr_t x, int64_t exponent,
+                                           int64_t significand) {
+  mpfr_exp_t emin = mpfr_get_emin();
+  mpfr_exp_t emax = mpfr_get_emax();
+  mpfr_set_emax(__raptor_fprt_emax(exponent));
+  mpfr_set_emin(__raptor_fprt_emin(exponent, significand));
+  mpfr_check_range(x, 0, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);
+  mpfr_set_emin(emin);
+  mpfr_set_emax(emax);
+}
+
 __RAPTOR_MPFR_ATTRIBUTES
 void raptor_fprt_gc_dump_status();
 __RAPTOR_MPFR_ATTRIBUTES
@@ -56,6 +101,10 @@ void raptor_fprt_excl_trunc_start();
 __RAPTOR_MPFR_ATTRIBUTES
 void raptor_fprt_excl_trunc_end();
 
+// Set between raptor_fprt_excl_trunc_start and _end, the shadow residual
+// wrappers then count the truncated operations as native ones.
+extern bool excl_trunc;
+
 template <typename To, typename From> To raptor_bitcast(From from) {
   static_assert(sizeof(From) == sizeof(To));
   size_t size = sizeof(From);
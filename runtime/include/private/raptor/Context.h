@@ -0,0 +1,48 @@
+#ifndef _RAPTOR_CONTEXT_H_
+#define _RAPTOR_CONTEXT_H_
+
+#include <cstdint>
+
+// Calling contexts of truncated functions.
+//
+// With -raptor-calling-context every truncated function calls
+// __raptor_fprt_context_push with its name on entry, which returns the depth of
+// the stack before the push. Before it returns or resumes unwinding it calls
+// __raptor_fprt_context_pop with that depth, and in its landing pads with the
+// depth after the push, so that the contexts of frames unwound by an exception
+// do not stay on the stack. Every thread keeps a shadow stack of nodes of its
+// own calling-context tree, so a push is a walk of the children of the current
+// node and a pop an array access. Emulated operations and their errors are
+// attributed to the node on top of the stack. The trees are merged by path and
+// written as folded stacks for flame graph tools.
+
+typedef struct __raptor_context_node {
+  const char *name;
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t next_sibling;
+  long long calls;
+  long long flops;      // Emulated operations.
+  long long count;      // Operations compared against their native result.
+  long long violations; // Of which exceeded the error threshold.
+  double rel_err;
+} __raptor_context_node;
+
+// The node of the calling context of this thread, nullptr if it never entered
+// a truncated function compiled with -raptor-calling-context.
+extern thread_local __raptor_context_node *__raptor_fprt_tls_context;
+
+static inline void __raptor_fprt_context_flop() {
+  if (__raptor_context_node *node = __raptor_fprt_tls_context)
+    node->flops++;
+}
+
+static inline void __raptor_fprt_context_error(double rel_err, bool violation) {
+  if (__raptor_context_node *node = __raptor_fprt_tls_context) {
+    node->count++;
+    node->rel_err += rel_err;
+    node->violations += violation;
+  }
+}
+
+#endif // _RAPTOR_CONTEXT_H_
@@ -0,0 +1,41 @@
+#ifndef _RAPTOR_DIAGNOSTICS_H_
+#define _RAPTOR_DIAGNOSTICS_H_
+
+#include <atomic>
+#include <cstddef>
+
+#include "raptor/raptor.h"
+
+// Per operation diagnostics which can be turned on in production binaries.
+//
+// The dump of the inputs and results of emulated operations and the printing
+// of every traced operation are enabled by the flags in
+// __raptor_fprt_diag_flags, so when they are off an operation pays one load of
+// a global which is only written when the diagnostics are configured and one
+// predictable branch. When they are on, a site filter and a sampling period
+// select which operations are shown, and the lines go to a buffer of the
+// calling thread which is written out in large chunks, at thread exit and at
+// program exit. This header does not depend on MPFR so that the trace runtime
+// can use it.
+
+extern std::atomic<unsigned> __raptor_fprt_diag_flags;
+
+static inline bool __raptor_fprt_diag_enabled(unsigned flag) {
+  return __builtin_expect(
+      __raptor_fprt_diag_flags.load(std::memory_order_relaxed) & flag, 0);
+}
+
+// Whether the operation at `loc` is shown: its location passes the site filter
+// and it is the Nth operation of the thread which did.
+bool __raptor_fprt_diag_select(const char *loc);
+
+// Like __raptor_fprt_diag_select, for operations which dump every input and
+// then their result, so that the lines of one operation are shown together.
+bool __raptor_fprt_diag_select_dump(const char *loc, bool result);
+
+// Append to the buffer of the calling thread.
+void __raptor_fprt_diag_printf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+void __raptor_fprt_diag_write(const char *data, size_t size);
+
+#endif // _RAPTOR_DIAGNOSTICS_H_
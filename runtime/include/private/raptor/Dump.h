@@ -0,0 +1,72 @@
+#ifndef _RAPTOR_DUMP_H_
+#define _RAPTOR_DUMP_H_
+
+#include <cstdint>
+#include <cstring>
+
+// Binary dump of per-site operation statistics.
+//
+// The file consists of a header, `num_records` fixed size records, an optional
+// section of `num_cancel` cancellation histograms of the records which have one
+// and a string table holding the NUL-terminated location and operation names
+// the records refer to. Everything is stored in the native byte order of the
+// writer. This header is shared between the runtime and the raptor-report tool
+// and must not depend on MPFR.
+
+#define RAPTOR_DUMP_MAGIC "RAPTORDP"
+#define RAPTOR_DUMP_VERSION 3
+#define RAPTOR_DUMP_NO_STRING UINT64_MAX
+// Same layout as the cancellation histogram of the runtime, the last bucket
+// counts results which cancelled to exactly zero.
+#define RAPTOR_DUMP_CANCEL_BUCKETS 64
+
+typedef struct raptor_dump_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t num_records;
+  uint64_t num_cancel;
+  uint64_t cancel_offset;  // From the start of the file.
+  uint64_t strings_offset; // From the start of the file.
+  uint64_t strings_size;
+} raptor_dump_header;
+
+typedef struct raptor_dump_record {
+  uint64_t loc; // Offset into the string table.
+  uint64_t op;  // Offset into the string table or RAPTOR_DUMP_NO_STRING.
+  double l1_err;
+  double rel_err;
+  double max_rel_err;
+  int64_t count;
+  int64_t count_thresh;
+  int64_t count_ignore;
+  int64_t count_flip;
+} raptor_dump_record;
+
+typedef struct raptor_dump_cancel {
+  uint64_t record;                          // Index of the record.
+  int64_t bits[RAPTOR_DUMP_CANCEL_BUCKETS]; // Bits lost to cancellation.
+} raptor_dump_cancel;
+
+static inline bool raptor_dump_header_valid(const raptor_dump_header *header,
+                                            uint64_t file_size) {
+  if (file_size < sizeof(*header) ||
+      memcmp(header->magic, RAPTOR_DUMP_MAGIC, sizeof(header->magic)) ||
+      header->version != RAPTOR_DUMP_VERSION ||
+      header->record_size != sizeof(raptor_dump_record) ||
+      header->num_records > file_size / sizeof(raptor_dump_record))
+    return false;
+  uint64_t records_end =
+      sizeof(*header) + header->num_records * sizeof(raptor_dump_record);
+  if (header->num_cancel > file_size / sizeof(raptor_dump_cancel))
+    return false;
+  uint64_t cancel_end =
+      header->cancel_offset + header->num_cancel * sizeof(raptor_dump_cancel);
+  return records_end <= header->cancel_offset &&
+         header->cancel_offset <= cancel_end &&
+         cancel_end <= header->strings_offset &&
+         header->strings_offset <= file_size &&
+         header->strings_size <= file_size - header->strings_offset;
+}
+
+#endif // _RAPTOR_DUMP_H_
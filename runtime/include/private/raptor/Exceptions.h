@@ -0,0 +1,31 @@
+#ifndef _RAPTOR_EXCEPTIONS_H_
+#define _RAPTOR_EXCEPTIONS_H_
+
+#include <mpfr.h>
+
+// Origins of NaNs, Infs, overflows and underflows in emulated operations.
+//
+// Every emulated operation checks its result with
+// __raptor_fprt_exception_check, which only reads the exponent of the result
+// and the MPFR overflow and underflow flags. Operations which raise an
+// exception (as opposed to propagating a NaN or an Inf of their operands) are
+// counted and the first ones of each thread are recorded together with their
+// operands.
+
+// Slow path, classifies the result, records it and clears the MPFR flags.
+void __raptor_fprt_exception(const char *loc, const char *op, mpfr_t res,
+                             const double *operands, unsigned num_operands);
+
+static inline bool __raptor_fprt_exception_check(mpfr_t res) {
+  return !mpfr_number_p(res) || mpfr_overflow_p() || mpfr_underflow_p();
+}
+
+template <typename... Args>
+static inline void __raptor_fprt_exception_operands(const char *loc,
+                                                    const char *op, mpfr_t res,
+                                                    Args... args) {
+  const double operands[] = {static_cast<double>(args)...};
+  __raptor_fprt_exception(loc, op, res, operands, sizeof...(args));
+}
+
+#endif // _RAPTOR_EXCEPTIONS_H_
@@ -0,0 +1,36 @@
+#ifndef _RAPTOR_PROFILE_H_
+#define _RAPTOR_PROFILE_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "raptor/raptor.h"
+
+// Flop profile by function and source line.
+//
+// With -raptor-count-profile the pass emits a table of the sites (function and
+// file:line) of every module and registers it from a constructor. The runtime
+// assigns each module a contiguous range of site ids and the count calls pass
+// the id of their site, which is negative and ignored until the module
+// registered its sites. Every thread accumulates into its own dense table
+// indexed by site id; the tables are merged when the profile is written.
+// Truncated flops are attributed to the site with the same file:line.
+
+typedef struct __raptor_profile_site {
+  const char *function;
+  const char *loc; // file:line
+} __raptor_profile_site;
+
+extern const char *const __raptor_fprt_precision_names[RAPTOR_NUM_PRECISIONS];
+extern const char *const __raptor_fprt_op_class_names[RAPTOR_NUM_OP_CLASSES];
+
+// Set once the first module registered its sites.
+extern std::atomic<bool> __raptor_fprt_profile_enabled;
+
+void __raptor_fprt_profile_flops(int32_t site, int precision, int64_t op_class,
+                                 int64_t n, bool vector);
+void __raptor_fprt_profile_trunc_flop(const char *loc, int64_t op_class);
+void __raptor_fprt_profile_memory(int32_t site, int64_t loaded,
+                                  int64_t stored);
+
+#endif // _RAPTOR_PROFILE_H_
@@ -0,0 +1,22 @@
+#ifndef _RAPTOR_SAMPLE_H_
+#define _RAPTOR_SAMPLE_H_
+
+// Statistical profile of truncated code.
+//
+// With RAPTOR_FPRT_SAMPLE set, a timer on the CPU time of the process raises
+// SIGPROF and the handler records where the interrupted thread is: the
+// truncated region on top of its region stack and the site in its current site
+// slot. Regions are pushed and popped by the trunc_change and scratch calls the
+// pass inserts at the entry and returns of truncated functions, so they need
+// no extra instrumentation. With -raptor-sample-sites the pass also stores the
+// location of the first truncated operation of every block into the thread
+// local slot __raptor_fprt_sample_site on block entry, and restores the value
+// of the caller before returning. The handler never allocates: every thread
+// claims a preallocated table on its first sample.
+
+extern bool __raptor_fprt_sample_enabled;
+
+void __raptor_fprt_sample_enter(const char *loc);
+void __raptor_fprt_sample_exit();
+
+#endif // _RAPTOR_SAMPLE_H_
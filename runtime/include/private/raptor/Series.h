@@ -0,0 +1,80 @@
+#ifndef _RAPTOR_SERIES_H_
+#define _RAPTOR_SERIES_H_
+
+#include <cstdint>
+#include <cstring>
+
+#include "raptor/raptor.h"
+
+// Time series of the counters and per-site violations.
+//
+// With RAPTOR_FPRT_SERIES=<path> a background thread of the runtime samples
+// the counters of all threads and the per-site statistics every period and
+// appends them to the file. The hot path is unchanged: the sampler reads the
+// per-thread counter slots with relaxed loads and the site tables the same way
+// a report does.
+//
+// The file is a header followed by records, each a raptor_series_record and
+// `size` bytes of payload:
+//   RAPTOR_SERIES_SITE    uint32_t id, the NUL-terminated location of the
+//                         site, sent before the first sample that refers to it
+//   RAPTOR_SERIES_SAMPLE  a raptor_series_sample followed by `num_sites`
+//                         raptor_series_site_sample, only the sites whose
+//                         counts changed since the previous sample
+// All counts are cumulative since the start of the program. Every sample is
+// flushed, so the file can be read while the program runs; a reader should
+// ignore a truncated last record. This header is shared between the runtime
+// and the raptor-report tool and must not depend on MPFR.
+
+#define RAPTOR_SERIES_MAGIC "RAPTORTS"
+#define RAPTOR_SERIES_VERSION 1
+
+enum raptor_series_record_type {
+  RAPTOR_SERIES_SITE = 1,
+  RAPTOR_SERIES_SAMPLE = 2,
+};
+
+typedef struct raptor_series_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t counters_size; // sizeof(raptor_counters) of the writer.
+  int64_t start_ns;       // CLOCK_REALTIME at the start of the program.
+  double period;          // Seconds between samples.
+} raptor_series_header;
+
+typedef struct raptor_series_record {
+  uint32_t type;
+  uint32_t size; // Of the payload following the record.
+} raptor_series_record;
+
+typedef struct raptor_series_sample {
+  int64_t time_ns; // Since the start of the program.
+  raptor_counters counters;
+  uint32_t num_sites;
+  uint32_t reserved;
+} raptor_series_sample;
+
+typedef struct raptor_series_site_sample {
+  uint32_t id;
+  uint32_t reserved;
+  int64_t count;
+  int64_t count_thresh; // Violations.
+} raptor_series_site_sample;
+
+static inline bool raptor_series_header_valid(const raptor_series_header *h,
+                                              uint64_t file_size) {
+  return file_size >= sizeof(*h) &&
+         !memcmp(h->magic, RAPTOR_SERIES_MAGIC, sizeof(h->magic)) &&
+         h->version == RAPTOR_SERIES_VERSION &&
+         h->counters_size == sizeof(raptor_counters);
+}
+
+// The counters of all threads since the start of the program, unaffected by
+// __raptor_counters_reset. Defined in Counting.cpp.
+void __raptor_fprt_counters_total(raptor_counters *counters);
+
+// Opens the time series at `path` and starts the sampler thread, which takes
+// its last sample at exit. Called once from a constructor of Counting.cpp.
+void __raptor_fprt_series_start(const char *path);
+
+#endif // _RAPTOR_SERIES_H_
@@ -0,0 +1,89 @@
+#ifndef _RAPTOR_SHM_H_
+#define _RAPTOR_SHM_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "raptor/raptor.h"
+
+// Live counters in POSIX shared memory.
+//
+// With RAPTOR_FPRT_SHM=1 the per-thread counter slots of the runtime (see
+// obj/Counting.cpp) are allocated in a shared memory segment named
+// /raptor.<pid> instead of the heap, so that raptor-top can read them while
+// the program runs. A thread only ever writes its own slot and brackets every
+// update with a sequence lock: the sequence is odd while the slot is being
+// written. Readers retry until they saw the same even sequence before and
+// after copying a slot. Publishing costs two plain stores per count and no
+// system calls. This header is shared between the runtime and raptor-top and
+// must not depend on MPFR.
+
+#define RAPTOR_SHM_MAGIC 0x4d48535254504152ull // "RAPTRSHM"
+#define RAPTOR_SHM_VERSION 2
+#define RAPTOR_SHM_PREFIX "raptor."
+#define RAPTOR_SHM_DEFAULT_SLOTS 256
+
+enum __raptor_counter {
+  // The flop counters are indexed by precision.
+  TRUNC_FLOP_COUNTER = RAPTOR_PRECISION_TRUNC,
+  DOUBLE_FLOP_COUNTER = RAPTOR_PRECISION_DOUBLE,
+  FLOAT_FLOP_COUNTER = RAPTOR_PRECISION_FLOAT,
+  HALF_FLOP_COUNTER = RAPTOR_PRECISION_HALF,
+  TRUNC_LOAD_COUNTER,
+  TRUNC_STORE_COUNTER,
+  ORIGINAL_LOAD_COUNTER,
+  ORIGINAL_STORE_COUNTER,
+  NUM_COUNTERS,
+};
+
+#define RAPTOR_FPRT_CACHE_LINE_SIZE 64
+
+struct alignas(RAPTOR_FPRT_CACHE_LINE_SIZE) __raptor_counter_slot {
+  std::atomic<unsigned> seq; // Only maintained for shared slots.
+  bool shared;               // Allocated in the shared memory segment.
+  bool in_use;
+  unsigned index;
+  std::atomic<long long> counters[NUM_COUNTERS];
+  std::atomic<long long> classes[RAPTOR_NUM_PRECISIONS][RAPTOR_NUM_OP_CLASSES];
+  // Flops (lanes) executed by vector instructions, part of the counts above.
+  std::atomic<long long> vector_flops[RAPTOR_NUM_PRECISIONS];
+  __raptor_counter_slot *next; // Only meaningful in the writing process.
+};
+
+struct alignas(RAPTOR_FPRT_CACHE_LINE_SIZE) __raptor_shm_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t slot_size;
+  uint32_t max_slots;
+  int32_t pid;
+  int64_t start_ns; // CLOCK_REALTIME when the segment was created.
+  std::atomic<uint32_t> num_slots;
+  std::atomic<uint32_t> exited; // Set at exit, the counts are final.
+  char command[64];
+  // Followed by max_slots slots.
+};
+
+static inline __raptor_counter_slot *
+__raptor_shm_slots(__raptor_shm_header *header) {
+  return (__raptor_counter_slot *)(header + 1);
+}
+
+static inline uint64_t __raptor_shm_size(uint32_t max_slots) {
+  return sizeof(__raptor_shm_header) +
+         (uint64_t)max_slots * sizeof(__raptor_counter_slot);
+}
+
+static inline bool __raptor_shm_header_valid(const __raptor_shm_header *header,
+                                             uint64_t size) {
+  return size >= sizeof(*header) && header->magic == RAPTOR_SHM_MAGIC &&
+         header->version == RAPTOR_SHM_VERSION &&
+         header->slot_size == sizeof(__raptor_counter_slot) &&
+         __raptor_shm_size(header->max_slots) <= size;
+}
+
+// Returns a zeroed slot in the shared memory segment, creating the segment on
+// first use, or nullptr if RAPTOR_FPRT_SHM is not set or the segment is full.
+// Called with the counter slots mutex held.
+__raptor_counter_slot *__raptor_fprt_shm_new_slot();
+
+#endif // _RAPTOR_SHM_H_
@@ -0,0 +1,80 @@
+#ifndef _RAPTOR_SITES_H_
+#define _RAPTOR_SITES_H_
+
+#include <cstdint>
+#include <map>
+
+#include "raptor/Common.h"
+
+// Per-thread tables of per-site operation statistics.
+//
+// Sites are identified by the uniqued location string the pass passes to every
+// FPRT call, so a lookup is a pointer comparison. Each thread owns an open
+// addressing table which it updates without any synchronization; the tables
+// are registered in a global list and only merged when a report is requested.
+
+typedef struct __raptor_site {
+  const char *loc;
+  __raptor_op stats;
+#ifdef RAPTOR_FPRT_ENABLE_CANCELLATION
+  __raptor_cancel cancel;
+#endif
+} __raptor_site;
+
+typedef struct __raptor_site_table {
+  uint64_t mask; // Capacity - 1, capacity is a power of two.
+  uint64_t size;
+  __raptor_site *sites;
+  struct __raptor_site_table *next;
+} __raptor_site_table;
+
+extern thread_local __raptor_site_table *__raptor_fprt_tls_sites;
+
+// Slow path of __raptor_fprt_site_entry: allocates the table of this thread,
+// probes past collisions and inserts new sites.
+__raptor_site *__raptor_fprt_site_insert(const char *loc);
+
+// Adds the statistics of all threads to `into`.
+void __raptor_fprt_sites_collect(std::map<const char *, __raptor_op> &into);
+
+// Adds the cancellation histograms of all threads to `into`. Runtimes built
+// without RAPTOR_FPRT_ENABLE_CANCELLATION have none.
+void __raptor_fprt_cancel_collect(
+    std::map<const char *, __raptor_cancel> &into);
+
+// Returns the statistics of all threads merged by site.
+std::map<const char *, __raptor_op> __raptor_fprt_op_collect();
+
+// Resets the statistics of all threads.
+void __raptor_fprt_sites_clear();
+
+void __raptor_fprt_op_merge(__raptor_op &into, const __raptor_op &from);
+
+// Prints one line of raptor_fprt_op_dump_status, `cancel` may be null.
+void __raptor_fprt_op_print(const char *loc, const __raptor_op &op,
+                            const __raptor_cancel *cancel);
+
+static inline uint64_t __raptor_fprt_site_hash(const char *loc) {
+  uint64_t h = (uint64_t)(uintptr_t)loc;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline __raptor_site *__raptor_fprt_site_entry(const char *loc) {
+  __raptor_site_table *table = __raptor_fprt_tls_sites;
+  if (table) {
+    __raptor_site *site =
+        &table->sites[__raptor_fprt_site_hash(loc) & table->mask];
+    if (site->loc == loc)
+      return site;
+  }
+  return __raptor_fprt_site_insert(loc);
+}
+
+static inline __raptor_op *__raptor_fprt_site(const char *loc) {
+  return &__raptor_fprt_site_entry(loc)->stats;
+}
+
+#endif // _RAPTOR_SITES_H_
@@ -0,0 +1,151 @@
+#ifndef _RAPTOR_TAPE_H_
+#define _RAPTOR_TAPE_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Tape of the trace runtime (obj/Trace.cpp).
+//
+// Every traced value gets the next id and a row in a set of parallel arrays:
+// its kind, value, location and number of inputs. The inputs and the local
+// derivatives with respect to them are appended to two edge arrays in the
+// order of the ids, so the edges of a value need no index: a sweep in reverse
+// id order consumes them from the back. All arrays are chunked so that
+// appending never moves or copies what was recorded, and a value costs about
+// 20 bytes plus 12 per input.
+//
+// The sensitivity of a value is the first order estimate of the absolute error
+// of the outputs caused by rounding it from double to float, as in ADAPT. It is
+// the estimated rounding error of the value times the sum over outputs of the
+// products of the absolute local derivatives along all paths to the outputs,
+// which a single adjoint sweep computes for all values at once. This header
+// does not depend on MPFR and is shared with the tools.
+
+#define RAPTOR_TAPE_CHUNK_BITS 16
+
+template <typename T> class __raptor_chunked_array {
+public:
+  static constexpr size_t ChunkSize = size_t(1) << RAPTOR_TAPE_CHUNK_BITS;
+
+  __raptor_chunked_array() = default;
+  __raptor_chunked_array(const __raptor_chunked_array &) = delete;
+  __raptor_chunked_array &operator=(const __raptor_chunked_array &) = delete;
+  ~__raptor_chunked_array() { clear(); }
+
+  // Appends a value, the addresses of earlier elements stay valid.
+  T &push_back(const T &value) {
+    if (count == chunks.size() * ChunkSize) {
+      T *chunk = (T *)std::malloc(ChunkSize * sizeof(T));
+      if (!chunk)
+        abort();
+      chunks.push_back(chunk);
+    }
+    T &slot = (*this)[count++];
+    slot = value;
+    return slot;
+  }
+
+  T &operator[](size_t i) {
+    return chunks[i >> RAPTOR_TAPE_CHUNK_BITS][i & (ChunkSize - 1)];
+  }
+  const T &operator[](size_t i) const {
+    return chunks[i >> RAPTOR_TAPE_CHUNK_BITS][i & (ChunkSize - 1)];
+  }
+  T &back() { return (*this)[count - 1]; }
+  size_t size() const { return count; }
+
+  void clear() {
+    for (T *chunk : chunks)
+      std::free(chunk);
+    chunks.clear();
+    count = 0;
+  }
+
+private:
+  std::vector<T *> chunks;
+  size_t count = 0;
+};
+
+enum __raptor_tape_kind : uint8_t {
+  RAPTOR_TAPE_OP = 0,
+  RAPTOR_TAPE_INPUT = 1, // Never truncated.
+  RAPTOR_TAPE_CONST = 2, // Never truncated.
+  RAPTOR_TAPE_KIND_MASK = 3,
+  RAPTOR_TAPE_OUTPUT = 4, // Flag, the value was read by the program.
+};
+
+typedef struct __raptor_tape {
+  __raptor_chunked_array<uint8_t> kinds;
+  __raptor_chunked_array<uint8_t> num_inputs;
+  __raptor_chunked_array<double> values;
+  __raptor_chunked_array<const char *> locs;
+  __raptor_chunked_array<uint32_t> edge_inputs;
+  __raptor_chunked_array<double> edge_derivatives;
+
+  size_t size() const { return kinds.size(); }
+
+  // Records a value without inputs and returns its id.
+  uint64_t add(__raptor_tape_kind kind, double value, const char *loc) {
+    uint64_t id = kinds.size();
+    // Edges refer to their input by a 32 bit id.
+    if (id > UINT32_MAX)
+      abort();
+    kinds.push_back(kind);
+    num_inputs.push_back(0);
+    values.push_back(value);
+    locs.push_back(loc);
+    return id;
+  }
+
+  // Adds an input to the last value recorded.
+  void add_input(uint64_t input, double derivative) {
+    num_inputs.back()++;
+    edge_inputs.push_back(input);
+    edge_derivatives.push_back(derivative);
+  }
+
+  void mark_output(uint64_t id) { kinds[id] |= RAPTOR_TAPE_OUTPUT; }
+
+  void clear() {
+    kinds.clear();
+    num_inputs.clear();
+    values.clear();
+    locs.clear();
+    edge_inputs.clear();
+    edge_derivatives.clear();
+  }
+} __raptor_tape;
+
+static inline double __raptor_tape_truncation_error(double a) {
+  return std::abs(a - (double)(float)a);
+}
+
+// Computes the sensitivity of every value, indexed by id, in one reverse sweep
+// over the tape. Inputs and constants have a sensitivity of zero.
+static inline void __raptor_tape_sensitivities(const __raptor_tape &tape,
+                                               std::vector<double> &adjoints) {
+  size_t n = tape.size();
+  adjoints.assign(n, 0.0);
+  for (size_t i = 0; i < n; i++)
+    if (tape.kinds[i] & RAPTOR_TAPE_OUTPUT)
+      adjoints[i] = 1;
+  size_t edge = tape.edge_inputs.size();
+  for (size_t i = n; i-- > 0;) {
+    // All users of value i have a larger id, so its adjoint is final.
+    double adjoint = adjoints[i];
+    for (unsigned k = tape.num_inputs[i]; k > 0; k--) {
+      --edge;
+      if (adjoint != 0)
+        adjoints[tape.edge_inputs[edge]] +=
+            std::abs(tape.edge_derivatives[edge]) * adjoint;
+    }
+    adjoints[i] =
+        (tape.kinds[i] & RAPTOR_TAPE_KIND_MASK) == RAPTOR_TAPE_OP
+            ? adjoint * __raptor_tape_truncation_error(tape.values[i])
+            : 0;
+  }
+}
+
+#endif // _RAPTOR_TAPE_H_
@@ -0,0 +1,30 @@
+#ifndef _RAPTOR_TIMELINE_H_
+#define _RAPTOR_TIMELINE_H_
+
+// Timeline of truncated regions.
+//
+// With RAPTOR_FPRT_TIMELINE set, the trunc_change push and pop and the
+// get_scratch and free_scratch calls the pass inserts at the entry and returns
+// of truncated functions, as well as __raptor_phase_begin and end, append begin
+// and end events to a buffer of the calling thread. Only the thread appends to
+// its buffer, the chunks of a buffer never move and the number of events is
+// published with a release store, so recording takes no lock. The buffers are
+// written as Chrome trace JSON at exit, which chrome://tracing and the Perfetto
+// UI open. The end event of a region carries the number of operations the
+// thread emulated in it.
+
+extern bool __raptor_fprt_timeline_enabled;
+
+enum __raptor_timeline_category {
+  RAPTOR_TIMELINE_TRUNC = 0,   // trunc_change push and pop
+  RAPTOR_TIMELINE_SCRATCH = 1, // get_scratch and free_scratch
+  RAPTOR_TIMELINE_PHASE = 2,   // __raptor_phase_begin and end
+};
+
+// `name` has to outlive the program unless it is a phase, whose names are
+// copied.
+void __raptor_fprt_timeline_begin(__raptor_timeline_category category,
+                                  const char *name);
+void __raptor_fprt_timeline_end(__raptor_timeline_category category);
+
+#endif // _RAPTOR_TIMELINE_H_
@@ -0,0 +1,23 @@
+#ifndef _RAPTOR_TIMING_H_
+#define _RAPTOR_TIMING_H_
+
+// Time spent in truncated functions.
+//
+// With RAPTOR_FPRT_TIMING set, the trunc_change push and get_scratch calls the
+// pass inserts at the entry of truncated functions take a timestamp, and the
+// free_scratch and trunc_change pop calls before their returns account the
+// time since. Functions are identified by the location passed to these calls.
+// Every thread accumulates the inclusive time, the number of calls and the
+// number of emulated operations of each function; a report is printed at exit.
+
+extern bool __raptor_fprt_timing_enabled;
+
+// `scratch` tells get_scratch/free_scratch from trunc_change, a function which
+// calls both is only timed once.
+void __raptor_fprt_timing_enter(const char *loc, bool scratch);
+void __raptor_fprt_timing_exit(const char *loc, bool scratch);
+
+// Truncated flops counted by the calling thread so far.
+long long __raptor_fprt_thread_trunc_flops();
+
+#endif // _RAPTOR_TIMING_H_
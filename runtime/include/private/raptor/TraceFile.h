@@ -0,0 +1,99 @@
+#ifndef _RAPTOR_TRACE_FILE_H_
+#define _RAPTOR_TRACE_FILE_H_
+
+#include <cstdint>
+#include <cstring>
+
+// Streamed trace of the trace runtime.
+//
+// With RAPTOR_FPRT_TRACE=<path> the trace runtime (obj/Trace.cpp) does not keep
+// its tape (see raptor/Tape.h) in memory but streams it to the file, and
+// `raptor-report trace` computes the sensitivities offline. The file is a
+// header followed by blocks:
+//
+//   raptor_trace_block  payload  uint32_t payload size
+//
+// The size is repeated after the payload so that the blocks can be read from
+// the end of the file, which is the order the reverse sweep needs. Values get
+// consecutive ids, the values of a block start at `first_id`. The payload is a
+// sequence of records, the first byte tells them apart:
+//
+//   value   kind | num_inputs << 2 (below RAPTOR_TRACE_OUTPUT), varint site,
+//           8 byte value, then per input the varint
+//           (id - input id) << 2 | derivative code, followed by the 8 byte
+//           derivative for RAPTOR_TRACE_DERIVATIVE_RAW
+//   output  RAPTOR_TRACE_OUTPUT, varint (next id - id): the program read the
+//           value
+//   site    RAPTOR_TRACE_SITE, varint site, varint length, the location
+//
+// Sites are numbered in the order they first appear and defined before the
+// first value which refers to them. Inputs are usually recent values and most
+// derivatives are +-1 or 0, so a typical operation takes 12 to 20 bytes. This
+// header is shared between the runtime and the raptor-report tool and must not
+// depend on MPFR.
+
+#define RAPTOR_TRACE_MAGIC "RAPTORTR"
+#define RAPTOR_TRACE_VERSION 1
+#define RAPTOR_TRACE_BLOCK_SIZE (1 << 20)
+
+#define RAPTOR_TRACE_OUTPUT 0xf0
+#define RAPTOR_TRACE_SITE 0xf1
+
+enum raptor_trace_derivative_code {
+  RAPTOR_TRACE_DERIVATIVE_ONE = 0,
+  RAPTOR_TRACE_DERIVATIVE_MINUS_ONE = 1,
+  RAPTOR_TRACE_DERIVATIVE_ZERO = 2,
+  RAPTOR_TRACE_DERIVATIVE_RAW = 3,
+};
+
+typedef struct raptor_trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} raptor_trace_header;
+
+typedef struct raptor_trace_block {
+  uint64_t first_id;
+  uint32_t num_values;
+  uint32_t size; // Of the payload.
+} raptor_trace_block;
+
+static inline bool raptor_trace_header_valid(const raptor_trace_header *h) {
+  return !memcmp(h->magic, RAPTOR_TRACE_MAGIC, sizeof(h->magic)) &&
+         h->version == RAPTOR_TRACE_VERSION;
+}
+
+static inline uint8_t *raptor_trace_put_varint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+// Returns nullptr if the varint does not end before `end`.
+static inline const uint8_t *raptor_trace_get_varint(const uint8_t *p,
+                                                     const uint8_t *end,
+                                                     uint64_t &v) {
+  v = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = *p++;
+    v |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return p;
+  }
+  return nullptr;
+}
+
+static inline uint8_t raptor_trace_derivative_code(double d) {
+  if (d == 1)
+    return RAPTOR_TRACE_DERIVATIVE_ONE;
+  if (d == -1)
+    return RAPTOR_TRACE_DERIVATIVE_MINUS_ONE;
+  if (d == 0)
+    return RAPTOR_TRACE_DERIVATIVE_ZERO;
+  return RAPTOR_TRACE_DERIVATIVE_RAW;
+}
+
+#endif // _RAPTOR_TRACE_FILE_H_
@@ -20,6 +20,90 @@ void __raptor_fprt_delete_all();
 
 long long __raptor_get_trunc_flop_count();
 long long f_raptor_get_trunc_flop_count();
+void raptor_fprt_count_dump_status();
+
+// Flops are counted per precision and per operation class. The pass emits the
+// same numbering, only append to these.
+enum raptor_fprt_precision {
+  RAPTOR_PRECISION_TRUNC,
+  RAPTOR_PRECISION_DOUBLE,
+  RAPTOR_PRECISION_FLOAT,
+  RAPTOR_PRECISION_HALF,
+  RAPTOR_NUM_PRECISIONS,
+};
+
+enum raptor_fprt_op_class {
+  RAPTOR_OP_CLASS_ADD, // fadd, fsub, fdim
+  RAPTOR_OP_CLASS_MUL, // fmul, ldexp
+  RAPTOR_OP_CLASS_FMA, // fma, fmuladd
+  RAPTOR_OP_CLASS_DIV, // fdiv, frem, fmod, remainder
+  RAPTOR_OP_CLASS_SQRT,
+  RAPTOR_OP_CLASS_TRANSCENDENTAL, // every other math function
+  RAPTOR_OP_CLASS_COMPARE,        // fcmp, min, max
+  RAPTOR_OP_CLASS_CONVERSION,     // rounding to integral values, casts
+  RAPTOR_OP_CLASS_SIGN,           // fneg, fabs, copysign
+  RAPTOR_NUM_OP_CLASSES,
+};
+
+long long __raptor_get_flop_count_by_class(int precision, int op_class);
+// The part of the flops of a precision executed by vector instructions, counted
+// per lane.
+long long __raptor_get_vector_flop_count(int precision);
+// Sum of the flops of a precision weighted by the cost of their class, see
+// RAPTOR_FPRT_FLOP_COSTS.
+double __raptor_get_weighted_flop_count(int precision);
+void raptor_fprt_set_op_class_cost(int precision, int op_class, double cost);
+
+// All counters, read under one lock. Memory accesses are in bytes.
+typedef struct raptor_counters {
+  long long flops[RAPTOR_NUM_PRECISIONS];
+  long long flops_by_class[RAPTOR_NUM_PRECISIONS][RAPTOR_NUM_OP_CLASSES];
+  long long vector_flops[RAPTOR_NUM_PRECISIONS];
+  long long trunc_load;
+  long long trunc_store;
+  long long original_load;
+  long long original_store;
+} raptor_counters;
+
+void __raptor_counters_snapshot(raptor_counters *counters);
+void f_raptor_counters_snapshot(raptor_counters *counters);
+// Counters read after a reset only count what happened since.
+void __raptor_counters_reset();
+void f_raptor_counters_reset();
+// Phases attribute the counters (of all threads) to named phases of the
+// program, reported at exit. Phases nest and are named by their path, e.g.
+// "solve/precondition".
+void __raptor_phase_begin(const char *name);
+void f_raptor_phase_begin(const char *name, int len);
+void __raptor_phase_end();
+void f_raptor_phase_end();
+
+int raptor_fprt_op_dump_binary(const char *path);
+// Writes the flop profile of code compiled with -raptor-count-profile, also
+// written to RAPTOR_FPRT_PROFILE at exit.
+int raptor_fprt_profile_write(const char *path);
+// Writes the calling contexts of code compiled with -raptor-calling-context as
+// folded stacks valued by `metric` (flops, calls, violations or error), also
+// written to RAPTOR_FPRT_CONTEXT at exit.
+int raptor_fprt_context_write(const char *path, const char *metric);
+// Writes the statistical profile of truncated regions and sites sampled with
+// RAPTOR_FPRT_SAMPLE, also written there at exit.
+int raptor_fprt_sample_write(const char *path);
+// Per operation diagnostics, also enabled with RAPTOR_FPRT_DUMP=1 and
+// RAPTOR_FPRT_TRACE_PRINT=1. `sites` is a comma separated list of locations
+// (file:line or file:line:col) to show, nullptr for all, and of those only
+// every `every`th operation of a thread is shown.
+enum raptor_fprt_diagnostic {
+  RAPTOR_FPRT_DIAG_DUMP = 1,  // inputs and results of emulated operations
+  RAPTOR_FPRT_DIAG_TRACE = 2, // every operation of the trace runtime
+};
+void raptor_fprt_set_diagnostics(unsigned flags, const char *sites,
+                                 unsigned long every);
+void raptor_fprt_flush_diagnostics();
+void raptor_fprt_exception_dump_status();
+void raptor_fprt_exception_clear();
+// Provided by Raptor-RT-MPI, collective over MPI_COMM_WORLD.
+void raptor_fprt_op_dump_status_mpi(unsigned num);
 
 
 #ifdef __cplusplus
@@ -22,12 +22,22 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <cmath>
 #include <map>
 #include <mpfr.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "raptor/Cache.h"
 #include "raptor/Common.h"
+#include "raptor/Context.h"
+#include "raptor/Diagnostics.h"
+#include "raptor/Exceptions.h"
+#include "raptor/Sample.h"
+#include "raptor/Sites.h"
+#include "raptor/Timeline.h"
+#include "raptor/Timing.h"
+#include "raptor/raptor.h"
 
 // TODO s
 //
@@ -62,25 +72,57 @@
 // and here
 // https://stackoverflow.com/questions/38664778/subnormal-numbers-in-different-precisions-with-mpfr
 
-#ifdef RAPTOR_FPRT_ENABLE_DUMPING
-#define RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, TAG)                             \
+// See raptor/Diagnostics.h, enabled with RAPTOR_FPRT_DUMP=1.
+#ifdef RAPTOR_FPRT_DISABLE_HOOKS
+#define RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, TAG, RESULT)                     \
   do {                                                                         \
-    fprintf(stderr, #OP_TYPE " " #LLVM_OP_NAME " " TAG ": %p ", X);            \
-    fprintf(stderr, "%f\n",                                                    \
-            mpfr_get_d(X->result, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE));       \
   } while (0)
-#define RAPTOR_DUMP_INPUT(X, OP_TYPE, LLVM_OP_NAME)                            \
-  RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, "in")
-#define RAPTOR_DUMP_RESULT(X, OP_TYPE, LLVM_OP_NAME)                           \
-  RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, "res")
 #else
-#define RAPTOR_DUMP_INPUT(X, OP_TYPE, LLVM_OP_NAME)                            \
+#define RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, TAG, RESULT)                     \
   do {                                                                         \
+    if (__raptor_fprt_diag_enabled(RAPTOR_FPRT_DIAG_DUMP) &&                   \
+        __raptor_fprt_diag_select_dump(loc, RESULT))                           \
+      __raptor_fprt_diag_printf(                                               \
+          #OP_TYPE " " #LLVM_OP_NAME " " TAG ": %p %f at %s\n", (void *)(X),   \
+          mpfr_get_d((X)->result, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE),        \
+          loc ? loc : "unknown");                                              \
   } while (0)
+#endif
+#define RAPTOR_DUMP_INPUT(X, OP_TYPE, LLVM_OP_NAME)                            \
+  RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, "in", false)
 #define RAPTOR_DUMP_RESULT(X, OP_TYPE, LLVM_OP_NAME)                           \
-  do {                                                                         \
-  } while (0)
+  RAPTOR_DUMP(X, OP_TYPE, LLVM_OP_NAME, "res", true)
+
+// TODO this needs to be thread local
+std::atomic<bool> global_is_truncating = false;
+
+// Tells the timing, sampling and timeline bookkeeping that a truncated region,
+// or the use of its scratch space, begins or ends. The minimal op mode runtime
+// (Raptor-RT-Op) is built with RAPTOR_FPRT_DISABLE_HOOKS and links none of
+// them.
+static inline void __raptor_fprt_region_enter(const char *loc, bool scratch) {
+#ifndef RAPTOR_FPRT_DISABLE_HOOKS
+  if (__raptor_fprt_timing_enabled)
+    __raptor_fprt_timing_enter(loc, scratch);
+  if (__raptor_fprt_sample_enabled)
+    __raptor_fprt_sample_enter(loc);
+  if (__raptor_fprt_timeline_enabled)
+    __raptor_fprt_timeline_begin(
+        scratch ? RAPTOR_TIMELINE_SCRATCH : RAPTOR_TIMELINE_TRUNC, loc);
 #endif
+}
+
+static inline void __raptor_fprt_region_exit(const char *loc, bool scratch) {
+#ifndef RAPTOR_FPRT_DISABLE_HOOKS
+  if (__raptor_fprt_timing_enabled)
+    __raptor_fprt_timing_exit(loc, scratch);
+  if (__raptor_fprt_sample_enabled)
+    __raptor_fprt_sample_exit();
+  if (__raptor_fprt_timeline_enabled)
+    __raptor_fprt_timeline_end(scratch ? RAPTOR_TIMELINE_SCRATCH
+                                       : RAPTOR_TIMELINE_TRUNC);
+#endif
+}
 
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_trunc_change(int64_t is_push, int64_t to_e, int64_t to_m,
@@ -91,22 +133,30 @@ void __raptor_fprt_trunc_change(int64_t is_push, int64_t to_e, int64_t to_m,
     abort();
   }
   global_is_truncating.store(is_push);
+  if (is_push)
+    __raptor_fprt_region_enter(loc, /*scratch*/ false);
+  else
+    __raptor_fprt_region_exit(loc, /*scratch*/ false);
 
   // If we are starting to truncate, set the max and min exponents
-  // Can't do it for mem mode currently because we may have truncated variables
-  // with unsupported exponent lengths, and those would result in undefined
-  // behaviour.
+  // Not for mem mode, whose values may have other exponent lengths, those
+  // would result in undefined behaviour. Mem mode values are brought into
+  // their range one by one instead, see __raptor_fprt_mem_range.
   if (is_push && __raptor_fprt_is_op_mode(mode)) {
     // TODO we need a stack if we want to support nested truncations
     // see MPFR_FP_EMULATION
-    int64_t max_e = 1 << (to_e - 1);
-    int64_t min_e = -max_e + 2 - to_m + 2;
     // TODO currently in full module truncation mode we assume that all of the
     // exponents we truncate to are the same. Otherwise we need to have a stack
     // which we pop and restore previous values.
-    mpfr_set_emax(max_e);
-    mpfr_set_emin(min_e);
+    mpfr_set_emax(__raptor_fprt_emax(to_e));
+    mpfr_set_emin(__raptor_fprt_emin(to_e, to_m));
   }
+#ifndef RAPTOR_FPRT_DISABLE_HOOKS
+  // The width the cache simulation shrinks truncated accesses to.
+  if (is_push)
+    __raptor_fprt_trunc_bytes.store((1 + to_e + to_m + 7) / 8,
+                                    std::memory_order_relaxed);
+#endif
 }
 
 #define RAPTOR_FLOAT_TYPE(CPP_TY, FROM_TY)                                     \
@@ -153,6 +203,7 @@ void __raptor_fprt_trunc_change(int64_t is_push, int64_t to_e, int64_t to_m,
     mpfr_t *mem = (mpfr_t *)malloc(sizeof(mem[0]) * MAX_MPFR_OPERANDS);        \
     for (unsigned i = 0; i < MAX_MPFR_OPERANDS; i++)                           \
       mpfr_init2(mem[i], to_m + 1); /* see MPFR_FP_EMULATION */                \
+    __raptor_fprt_region_enter(loc, /*scratch*/ true);                         \
     return mem;                                                                \
   }                                                                            \
                                                                                \
@@ -160,6 +211,7 @@ void __raptor_fprt_trunc_change(int64_t is_push, int64_t to_e, int64_t to_m,
   void __raptor_fprt_##FROM_TY##_free_scratch(int64_t to_e, int64_t to_m,      \
                                               int64_t mode, const char *loc,   \
                                               void *scratch) {                 \
+    __raptor_fprt_region_exit(loc, /*scratch*/ true);                          \
     mpfr_t *mem = (mpfr_t *)scratch;                                           \
     for (unsigned i = 0; i < MAX_MPFR_OPERANDS; i++)                           \
       mpfr_clear(mem[i]);                                                      \
@@ -173,6 +225,81 @@ __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_trunc_count(int64_t exponent, int64_t significand,
                                int64_t mode, const char *loc, mpfr_t *scratch);
 
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_trunc_count_class(int64_t op_class, int64_t exponent,
+                                     int64_t significand, int64_t mode,
+                                     const char *loc, mpfr_t *scratch);
+
+// Compares the name of an operation with `base`, ignoring the llvm_ and __
+// prefixes and the type or _finite suffixes of intrinsics and libm variants.
+static constexpr bool __raptor_fprt_op_name_is(const char *name,
+                                               const char *base) {
+  if (name[0] == 'l' && name[1] == 'l' && name[2] == 'v' && name[3] == 'm' &&
+      name[4] == '_')
+    name += 5;
+  else if (name[0] == '_' && name[1] == '_')
+    name += 2;
+  while (*base && *name == *base) {
+    ++name;
+    ++base;
+  }
+  return !*base && (!*name || *name == '_');
+}
+
+static constexpr struct {
+  const char *name;
+  int op_class;
+} __raptor_fprt_op_classes[] = {
+    {"fadd", RAPTOR_OP_CLASS_ADD},
+    {"fsub", RAPTOR_OP_CLASS_ADD},
+    {"fdim", RAPTOR_OP_CLASS_ADD},
+    {"fmul", RAPTOR_OP_CLASS_MUL},
+    {"ldexp", RAPTOR_OP_CLASS_MUL},
+    {"fma", RAPTOR_OP_CLASS_FMA},
+    {"fmuladd", RAPTOR_OP_CLASS_FMA},
+    {"fdiv", RAPTOR_OP_CLASS_DIV},
+    {"frem", RAPTOR_OP_CLASS_DIV},
+    {"fmod", RAPTOR_OP_CLASS_DIV},
+    {"remainder", RAPTOR_OP_CLASS_DIV},
+    {"sqrt", RAPTOR_OP_CLASS_SQRT},
+    {"fcmp", RAPTOR_OP_CLASS_COMPARE},
+    {"maxnum", RAPTOR_OP_CLASS_COMPARE},
+    {"minnum", RAPTOR_OP_CLASS_COMPARE},
+    {"trunc", RAPTOR_OP_CLASS_CONVERSION},
+    {"round", RAPTOR_OP_CLASS_CONVERSION},
+    {"floor", RAPTOR_OP_CLASS_CONVERSION},
+    {"ceil", RAPTOR_OP_CLASS_CONVERSION},
+    {"nearbyint", RAPTOR_OP_CLASS_CONVERSION},
+    {"lround", RAPTOR_OP_CLASS_CONVERSION},
+    {"fabs", RAPTOR_OP_CLASS_SIGN},
+    {"fneg", RAPTOR_OP_CLASS_SIGN},
+    {"copysign", RAPTOR_OP_CLASS_SIGN},
+};
+
+// The class of an operation, see raptor_fprt_op_class.
+static constexpr int __raptor_fprt_op_class(const char *name) {
+  for (const auto &entry : __raptor_fprt_op_classes)
+    if (__raptor_fprt_op_name_is(name, entry.name))
+      return entry.op_class;
+  return RAPTOR_OP_CLASS_TRANSCENDENTAL;
+}
+
+// Counts a truncated flop, the class of LLVM_OP_NAME is resolved at compile
+// time. The op mode runtime without counting (Raptor-RT-Op) does not even
+// make the call.
+#ifdef RAPTOR_FPRT_DISABLE_TRUNC_FLOP_COUNT
+#define RAPTOR_TRUNC_COUNT(LLVM_OP_NAME)                                       \
+  do {                                                                         \
+  } while (0)
+#else
+#define RAPTOR_TRUNC_COUNT(LLVM_OP_NAME)                                       \
+  do {                                                                         \
+    constexpr int op_class = __raptor_fprt_op_class(#LLVM_OP_NAME);            \
+    __raptor_fprt_trunc_count_class(op_class, exponent, significand, mode,     \
+                                    loc, scratch);                             \
+  } while (0)
+#endif
+
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_ieee_64_count(int64_t exponent, int64_t significand,
                                  int64_t mode, const char *loc,
@@ -239,6 +366,56 @@ long long f_raptor_get_memory_access_original_load();
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_memory_access(void *, int64_t size, int64_t is_store);
 
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_memory_access_block(int64_t loaded, int64_t stored);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_memory_access_fn(void *ptr, int64_t size, int64_t is_store,
+                                    int64_t is_fp, const char *func);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_memory_access_profile(int64_t loaded, int64_t stored,
+                                         int32_t site);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_class(int32_t op_class);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_class(int32_t op_class);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_class(int32_t op_class);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_class_block(int32_t op_class, int64_t n);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_class_block(int32_t op_class, int64_t n);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_class_block(int32_t op_class, int64_t n);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_vector_block(int32_t op_class, int64_t n);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_vector_block(int32_t op_class, int64_t n);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_vector_block(int32_t op_class, int64_t n);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_profile(int32_t op_class, int64_t n,
+                                         int32_t is_vector, int32_t site);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_profile(int32_t op_class, int64_t n,
+                                         int32_t is_vector, int32_t site);
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_profile(int32_t op_class, int64_t n,
+                                         int32_t is_vector, int32_t site);
+
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_ieee_64_count(int64_t exponent, int64_t significand,
                                  int64_t mode, const char *loc,
@@ -260,14 +437,206 @@ long long __raptor_reset_shadow_trace();
 __RAPTOR_MPFR_ATTRIBUTES
 long long f_raptor_reset_shadow_trace();
 
-std::map<const char *, struct __raptor_op> opdata;
-
 __RAPTOR_MPFR_ATTRIBUTES
 void raptor_fprt_op_dump_status(int num);
 
 __RAPTOR_MPFR_ATTRIBUTES
 void raptor_fprt_op_clear();
 
+#ifdef RAPTOR_FPRT_ENABLE_OP_RESIDUALS
+// NOTE: OP_RESIDUALS
+// In op mode we evaluate every emulated operation a second time in native
+// precision on the same inputs using the `__raptor_fprt_original_*` functions
+// the pass emits for each truncated operation. They are declared weak as a
+// module only defines the ones for the operations it truncates. Statistics are
+// kept in the per-thread site tables, see raptor/Sites.h.
+//
+// A correctly rounded emulated operation has a local relative error of at most
+// one unit roundoff (2^-(significand + 1)), so we count everything above twice
+// that as a violation - these are the sites where rounding the inputs or the
+// reduced exponent range matter.
+static inline void __raptor_fprt_op_residual(const char *loc, const char *op,
+                                             double trunc, double ref,
+                                             int64_t significand) {
+  __raptor_op *site = __raptor_fprt_site(loc);
+  if (!site->count)
+    site->op = op;
+  ++site->count;
+  if (trunc == ref || (std::isnan(trunc) && std::isnan(ref))) {
+    __raptor_fprt_context_error(0, false);
+    return;
+  }
+  double err = std::abs(trunc - ref);
+  double rel = ref != 0 ? err / std::abs(ref) : err;
+  if (!std::isfinite(rel)) {
+    // Only one of the results is a NaN or an Inf, do not poison the sums.
+    ++site->count_thresh;
+    ++site->count_ignore;
+    __raptor_fprt_context_error(0, true);
+    return;
+  }
+  site->l1_err += err;
+  site->rel_err += rel;
+  site->max_rel_err = std::max(site->max_rel_err, rel);
+  bool violation = rel > std::ldexp(1.0, -significand);
+  if (violation)
+    ++site->count_thresh;
+  __raptor_fprt_context_error(rel, violation);
+}
+
+static inline void __raptor_fprt_op_flip(const char *loc, const char *op,
+                                         bool trunc, bool ref) {
+  __raptor_op *site = __raptor_fprt_site(loc);
+  if (!site->count)
+    site->op = op;
+  ++site->count;
+  if (trunc != ref) {
+    ++site->count_thresh;
+    ++site->count_flip;
+  }
+  __raptor_fprt_context_error(0, trunc != ref);
+}
+
+#define __RAPTOR_MPFR_OP_ORIGINAL(RET, NAME, ...)                              \
+  __RAPTOR_MPFR_ORIGINAL_ATTRIBUTES __attribute__((weak)) RET NAME(__VA_ARGS__);
+#define RAPTOR_OP_RESIDUAL(ORIGINAL, LLVM_OP_NAME, RES, ...)                   \
+  do {                                                                         \
+    if (ORIGINAL)                                                              \
+      __raptor_fprt_op_residual(loc, #LLVM_OP_NAME, RES,                       \
+                                ORIGINAL(__VA_ARGS__), significand);           \
+  } while (0)
+#define RAPTOR_OP_FLIP(ORIGINAL, LLVM_OP_NAME, RES, ...)                       \
+  do {                                                                         \
+    if (ORIGINAL)                                                              \
+      __raptor_fprt_op_flip(loc, #LLVM_OP_NAME, RES, ORIGINAL(__VA_ARGS__));   \
+  } while (0)
+#else
+#define __RAPTOR_MPFR_OP_ORIGINAL(RET, NAME, ...)
+#define RAPTOR_OP_RESIDUAL(ORIGINAL, LLVM_OP_NAME, RES, ...)                   \
+  do {                                                                         \
+  } while (0)
+#define RAPTOR_OP_FLIP(ORIGINAL, LLVM_OP_NAME, RES, ...)                       \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#ifdef RAPTOR_FPRT_ENABLE_CANCELLATION
+// NOTE: CANCELLATION
+// For additions and subtractions we record how many significant bits were
+// lost through cancellation, i.e. max(exp(a), exp(b)) - exp(a op b), in a
+// per-site histogram next to the site statistics, see raptor/Sites.h. The
+// exponents are read from the IEEE bit patterns in op mode and from the MPFR
+// values in mem mode, so this costs a site lookup and a few integer operations
+// per operation.
+static constexpr bool __raptor_fprt_streq(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    ++a;
+    ++b;
+  }
+  return *a == *b;
+}
+
+static constexpr bool __raptor_fprt_is_additive(const char *op) {
+  return __raptor_fprt_streq(op, "fadd") || __raptor_fprt_streq(op, "fsub");
+}
+
+static inline long long *__raptor_fprt_cancellation_bits(const char *loc,
+                                                         const char *op) {
+  __raptor_site *site = __raptor_fprt_site_entry(loc);
+  if (!site->stats.op)
+    site->stats.op = op;
+  return site->cancel.bits;
+}
+
+static inline void __raptor_fprt_cancellation(const char *loc, const char *op,
+                                              long bits_lost) {
+  if (bits_lost < 0)
+    bits_lost = 0;
+  else if (bits_lost > RAPTOR_FPRT_CANCEL_ZERO - 1)
+    bits_lost = RAPTOR_FPRT_CANCEL_ZERO - 1;
+  ++__raptor_fprt_cancellation_bits(loc, op)[bits_lost];
+}
+
+static inline void __raptor_fprt_cancellation_zero(const char *loc,
+                                                   const char *op) {
+  ++__raptor_fprt_cancellation_bits(loc, op)[RAPTOR_FPRT_CANCEL_ZERO];
+}
+
+static inline bool __raptor_fprt_ieee_64_is_regular(double d) {
+  return ((raptor_bitcast<uint64_t>(d) >> 52) & 0x7ff) != 0x7ff && d != 0;
+}
+
+// Unbiased exponent of a regular double.
+static inline long __raptor_fprt_ieee_64_exp(double d) {
+  long biased = (raptor_bitcast<uint64_t>(d) >> 52) & 0x7ff;
+  if (biased == 0)
+    return std::ilogb(d);
+  return biased - 1023;
+}
+
+static inline void __raptor_fprt_op_cancellation(const char *loc,
+                                                 const char *op, double a,
+                                                 double b, double c) {
+  // Zeros, Infs and NaNs do not cancel.
+  if (!__raptor_fprt_ieee_64_is_regular(a) ||
+      !__raptor_fprt_ieee_64_is_regular(b))
+    return;
+  if (c == 0)
+    __raptor_fprt_cancellation_zero(loc, op);
+  else if (__raptor_fprt_ieee_64_is_regular(c))
+    __raptor_fprt_cancellation(loc, op,
+                               std::max(__raptor_fprt_ieee_64_exp(a),
+                                        __raptor_fprt_ieee_64_exp(b)) -
+                                   __raptor_fprt_ieee_64_exp(c));
+}
+
+static inline void __raptor_fprt_mem_cancellation(const char *loc,
+                                                  const char *op, mpfr_t a,
+                                                  mpfr_t b, mpfr_t c) {
+  if (!mpfr_regular_p(a) || !mpfr_regular_p(b))
+    return;
+  if (mpfr_zero_p(c))
+    __raptor_fprt_cancellation_zero(loc, op);
+  else if (mpfr_regular_p(c))
+    __raptor_fprt_cancellation(
+        loc, op, std::max(mpfr_get_exp(a), mpfr_get_exp(b)) - mpfr_get_exp(c));
+}
+
+#define RAPTOR_OP_CANCELLATION(LLVM_OP_NAME, A, B, C)                          \
+  do {                                                                         \
+    if constexpr (__raptor_fprt_is_additive(#LLVM_OP_NAME))                    \
+      __raptor_fprt_op_cancellation(loc, #LLVM_OP_NAME, A, B, C);              \
+  } while (0)
+#define RAPTOR_MEM_CANCELLATION(LLVM_OP_NAME, A, B, C)                         \
+  do {                                                                         \
+    if constexpr (__raptor_fprt_is_additive(#LLVM_OP_NAME))                    \
+      __raptor_fprt_mem_cancellation(loc, #LLVM_OP_NAME, A, B, C);             \
+  } while (0)
+#else
+#define RAPTOR_OP_CANCELLATION(LLVM_OP_NAME, A, B, C)                          \
+  do {                                                                         \
+  } while (0)
+#define RAPTOR_MEM_CANCELLATION(LLVM_OP_NAME, A, B, C)                         \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#ifdef RAPTOR_FPRT_ENABLE_EXCEPTIONS
+// NOTE: EXCEPTIONS
+// Record the sites which produce a NaN, an Inf, an overflow or an underflow,
+// see raptor/Exceptions.h. The operands are only evaluated if the result is
+// exceptional.
+#define RAPTOR_EXCEPTION(LLVM_OP_NAME, RES, ...)                               \
+  do {                                                                         \
+    if (__raptor_fprt_exception_check(RES))                                    \
+      __raptor_fprt_exception_operands(loc, #LLVM_OP_NAME, RES, __VA_ARGS__);  \
+  } while (0)
+#else
+#define RAPTOR_EXCEPTION(LLVM_OP_NAME, RES, ...)                               \
+  do {                                                                         \
+  } while (0)
+#endif
+
 #ifdef RAPTOR_FPRT_ENABLE_SHADOW_RESIDUALS
 // #define SHADOW_ERR_REL 6.25e-1   //
 // #define SHADOW_ERR_ABS 6.25e-1   // If reference is 0.
@@ -303,9 +672,10 @@ void raptor_fprt_op_clear();
       ARG1 a, int64_t exponent, int64_t significand, int64_t mode,             \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_SET_ARG1(scratch[0], a, ROUNDING_MODE);                  \
       mpfr_##MPFR_FUNC_NAME(scratch[2], scratch[0], ROUNDING_MODE);            \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[2], a);                           \
       RET c = mpfr_get_##MPFR_GET(scratch[2], ROUNDING_MODE);                  \
       return c;                                                                \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
@@ -325,23 +695,27 @@ void raptor_fprt_op_clear();
                 ma->excl_result);                                              \
         mpfr_set_##MPFR_SET_ARG1(mc->result, mc->excl_result, ROUNDING_MODE);  \
       } else {                                                                 \
-        __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);  \
+        RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                      \
         mpfr_##MPFR_FUNC_NAME(mc->result, ma->result, ROUNDING_MODE);          \
+        __raptor_fprt_mem_range(mc->result, exponent, significand);            \
         mc->excl_result = mpfr_get_##MPFR_GET(mc->result, ROUNDING_MODE);      \
       }                                                                        \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, mc->result,                               \
+                       mpfr_get_d(ma->result, ROUNDING_MODE));                 \
       RAPTOR_DUMP_RESULT(mc, OP_TYPE, LLVM_OP_NAME);                           \
       double trunc = mpfr_get_##MPFR_GET(mc->result,                           \
                                          __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE); \
       double err = __raptor_fprt_##FROM_TYPE##_abs_err(trunc, mc->shadow);     \
-      if (!opdata[loc].count)                                                  \
-        opdata[loc].op = #LLVM_OP_NAME;                                        \
+      __raptor_op *site = __raptor_fprt_site(loc);                             \
+      if (!site->count)                                                        \
+        site->op = #LLVM_OP_NAME;                                              \
       if (trunc != 0 && err / trunc > SHADOW_ERR_REL) {                        \
-        ++opdata[loc].count_thresh;                                            \
+        ++site->count_thresh;                                                  \
       } else if (trunc == 0 && err > SHADOW_ERR_ABS) {                         \
-        ++opdata[loc].count_thresh;                                            \
+        ++site->count_thresh;                                                  \
       }                                                                        \
-      opdata[loc].l1_err += err;                                               \
-      ++opdata[loc].count;                                                     \
+      site->l1_err += err;                                                     \
+      ++site->count;                                                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(mc);                             \
     } else {                                                                   \
       abort();                                                                 \
@@ -358,20 +732,24 @@ void raptor_fprt_op_clear();
       ARG1 a, ARG2 b, int64_t exponent, int64_t significand, int64_t mode,     \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_SET_ARG1(scratch[0], a, ROUNDING_MODE);                  \
       mpfr_##MPFR_FUNC_NAME(scratch[2], scratch[0], b, ROUNDING_MODE);         \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[2], a, b);                        \
       RET c = mpfr_get_##MPFR_GET(scratch[2], ROUNDING_MODE);                  \
       return c;                                                                \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
           a, exponent, significand, mode, loc, scratch);                       \
       __raptor_fp *mc = __raptor_fprt_##FROM_TYPE##_new_intermediate(          \
           exponent, significand, mode, loc, scratch);                          \
       RAPTOR_DUMP_INPUT(ma, OP_TYPE, LLVM_OP_NAME);                            \
       mpfr_##MPFR_FUNC_NAME(mc->result, ma->result, b, ROUNDING_MODE);         \
+      __raptor_fprt_mem_range(mc->result, exponent, significand);              \
       mc->excl_result = mpfr_get_##MPFR_GET(mc->result, ROUNDING_MODE);        \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, mc->result,                               \
+                       mpfr_get_d(ma->result, ROUNDING_MODE), b);              \
       RAPTOR_DUMP_RESULT(mc, OP_TYPE, LLVM_OP_NAME);                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(mc);                             \
     } else {                                                                   \
@@ -390,11 +768,12 @@ void raptor_fprt_op_clear();
       ARG1 a, ARG2 b, int64_t exponent, int64_t significand, int64_t mode,     \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_SET_ARG1(scratch[0], a, ROUNDING_MODE);                  \
       mpfr_set_##MPFR_SET_ARG2(scratch[1], b, ROUNDING_MODE);                  \
       mpfr_##MPFR_FUNC_NAME(scratch[2], scratch[0], scratch[1],                \
                             ROUNDING_MODE);                                    \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[2], a, b);                        \
       RET c = mpfr_get_##MPFR_GET(scratch[2], ROUNDING_MODE);                  \
       return c;                                                                \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
@@ -417,24 +796,29 @@ void raptor_fprt_op_clear();
                 ma->excl_result, mb->excl_result);                             \
         mpfr_set_##MPFR_SET_ARG1(mc->result, mc->excl_result, ROUNDING_MODE);  \
       } else {                                                                 \
-        __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);  \
+        RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                      \
         mpfr_##MPFR_FUNC_NAME(mc->result, ma->result, mb->result,              \
                               ROUNDING_MODE);                                  \
+        __raptor_fprt_mem_range(mc->result, exponent, significand);            \
         mc->excl_result = mpfr_get_##MPFR_GET(mc->result, ROUNDING_MODE);      \
       }                                                                        \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, mc->result,                               \
+                       mpfr_get_d(ma->result, ROUNDING_MODE),                  \
+                       mpfr_get_d(mb->result, ROUNDING_MODE));                 \
       RAPTOR_DUMP_RESULT(mc, OP_TYPE, LLVM_OP_NAME);                           \
       double trunc = mpfr_get_##MPFR_GET(mc->result,                           \
                                          __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE); \
       double err = __raptor_fprt_##FROM_TYPE##_abs_err(trunc, mc->shadow);     \
-      if (!opdata[loc].count)                                                  \
-        opdata[loc].op = #LLVM_OP_NAME;                                        \
+      __raptor_op *site = __raptor_fprt_site(loc);                             \
+      if (!site->count)                                                        \
+        site->op = #LLVM_OP_NAME;                                              \
       if (trunc != 0 && err / trunc > SHADOW_ERR_REL) {                        \
-        ++opdata[loc].count_thresh;                                            \
+        ++site->count_thresh;                                                  \
       } else if (trunc == 0 && err > SHADOW_ERR_ABS) {                         \
-        ++opdata[loc].count_thresh;                                            \
+        ++site->count_thresh;                                                  \
       }                                                                        \
-      opdata[loc].l1_err += err;                                               \
-      ++opdata[loc].count;                                                     \
+      site->l1_err += err;                                                     \
+      ++site->count;                                                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(mc);                             \
     } else {                                                                   \
       abort();                                                                 \
@@ -451,12 +835,13 @@ void raptor_fprt_op_clear();
       TYPE a, TYPE b, TYPE c, int64_t exponent, int64_t significand,           \
       int64_t mode, const char *loc, mpfr_t *scratch) {                        \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_TYPE(scratch[0], a, ROUNDING_MODE);                      \
       mpfr_set_##MPFR_TYPE(scratch[1], b, ROUNDING_MODE);                      \
       mpfr_set_##MPFR_TYPE(scratch[2], c, ROUNDING_MODE);                      \
       mpfr_mul(scratch[0], scratch[0], scratch[1], ROUNDING_MODE);             \
       mpfr_add(scratch[0], scratch[0], scratch[2], ROUNDING_MODE);             \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[0], a, b, c);                     \
       TYPE res = mpfr_get_##MPFR_TYPE(scratch[0], ROUNDING_MODE);              \
       return res;                                                              \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
@@ -482,28 +867,33 @@ void raptor_fprt_op_clear();
                 ma->excl_result, mb->excl_result, mc->excl_result);            \
         mpfr_set_##MPFR_TYPE(madd->result, madd->excl_result, ROUNDING_MODE);  \
       } else {                                                                 \
-        __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);  \
+        RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                      \
         mpfr_t mmul;                                                           \
         mpfr_init2(mmul, significand + 1); /* see MPFR_FP_EMULATION */         \
         mpfr_mul(madd->result, ma->result, mb->result, ROUNDING_MODE);         \
         mpfr_add(madd->result, madd->result, mc->result, ROUNDING_MODE);       \
+        __raptor_fprt_mem_range(madd->result, exponent, significand);          \
         mpfr_clear(mmul);                                                      \
         madd->excl_result = mpfr_get_##MPFR_TYPE(madd->result, ROUNDING_MODE); \
       }                                                                        \
-      RAPTOR_DUMP_RESULT(__raptor_fprt_##FROM_TYPE##_to_ptr(madd), OP_TYPE,    \
-                         LLVM_OP_NAME);                                        \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, madd->result,                             \
+                       mpfr_get_d(ma->result, ROUNDING_MODE),                  \
+                       mpfr_get_d(mb->result, ROUNDING_MODE),                  \
+                       mpfr_get_d(mc->result, ROUNDING_MODE));                 \
+      RAPTOR_DUMP_RESULT(madd, OP_TYPE, LLVM_OP_NAME);                         \
       double trunc = mpfr_get_##MPFR_TYPE(                                     \
           madd->result, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);                  \
       double err = __raptor_fprt_##FROM_TYPE##_abs_err(trunc, madd->shadow);   \
-      if (!opdata[loc].count)                                                  \
-        opdata[loc].op = #LLVM_OP_NAME;                                        \
+      __raptor_op *site = __raptor_fprt_site(loc);                             \
+      if (!site->count)                                                        \
+        site->op = #LLVM_OP_NAME;                                              \
       if (trunc != 0 && err / trunc > SHADOW_ERR_REL) {                        \
-        ++opdata[loc].count_thresh;                                            \
+        ++site->count_thresh;                                                  \
       } else if (trunc == 0 && err > SHADOW_ERR_ABS) {                         \
-        ++opdata[loc].count_thresh;                                            \
+        ++site->count_thresh;                                                  \
       }                                                                        \
-      opdata[loc].l1_err += err;                                               \
-      ++opdata[loc].count;                                                     \
+      site->l1_err += err;                                                     \
+      ++site->count;                                                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(madd);                           \
     } else {                                                                   \
       abort();                                                                 \
@@ -518,13 +908,13 @@ void raptor_fprt_op_clear();
       TYPE a, TYPE b, int64_t exponent, int64_t significand, int64_t mode,     \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(fcmp);                                                \
       mpfr_set_##MPFR_GET(scratch[0], a, ROUNDING_MODE);                       \
       mpfr_set_##MPFR_GET(scratch[1], b, ROUNDING_MODE);                       \
       int ret = mpfr_cmp(scratch[0], scratch[1]);                              \
       return ret CMP;                                                          \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(fcmp);                                                \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
           a, exponent, significand, mode, loc, scratch);                       \
       __raptor_fp *mb = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
@@ -556,24 +946,34 @@ void raptor_fprt_op_clear();
 #define __RAPTOR_MPFR_SINGOP(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE, \
                              RET, MPFR_GET, ARG1, MPFR_SET_ARG1,               \
                              ROUNDING_MODE)                                    \
+  __RAPTOR_MPFR_OP_ORIGINAL(                                                   \
+      RET, __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME,    \
+      ARG1)                                                                    \
   __RAPTOR_MPFR_ATTRIBUTES                                                     \
   RET __raptor_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
       ARG1 a, int64_t exponent, int64_t significand, int64_t mode,             \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_SET_ARG1(scratch[0], a, ROUNDING_MODE);                  \
       mpfr_##MPFR_FUNC_NAME(scratch[2], scratch[0], ROUNDING_MODE);            \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[2], a);                           \
       RET c = mpfr_get_##MPFR_GET(scratch[2], ROUNDING_MODE);                  \
+      RAPTOR_OP_RESIDUAL(                                                      \
+          __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME,     \
+          LLVM_OP_NAME, c, a);                                                 \
       return c;                                                                \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
           a, exponent, significand, mode, loc, scratch);                       \
       __raptor_fp *mc = __raptor_fprt_##FROM_TYPE##_new_intermediate(          \
           exponent, significand, mode, loc, scratch);                          \
       RAPTOR_DUMP_INPUT(ma, OP_TYPE, LLVM_OP_NAME);                            \
       mpfr_##MPFR_FUNC_NAME(mc->result, ma->result, ROUNDING_MODE);            \
+      __raptor_fprt_mem_range(mc->result, exponent, significand);              \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, mc->result,                               \
+                       mpfr_get_d(ma->result, ROUNDING_MODE));                 \
       RAPTOR_DUMP_RESULT(mc, OP_TYPE, LLVM_OP_NAME);                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(mc);                             \
     } else {                                                                   \
@@ -586,24 +986,34 @@ void raptor_fprt_op_clear();
 #define __RAPTOR_MPFR_BIN_INT(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME,           \
                               FROM_TYPE, RET, MPFR_GET, ARG1, MPFR_SET_ARG1,   \
                               ARG2, ROUNDING_MODE)                             \
+  __RAPTOR_MPFR_OP_ORIGINAL(                                                   \
+      RET, __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME,    \
+      ARG1, ARG2)                                                              \
   __RAPTOR_MPFR_ATTRIBUTES                                                     \
   RET __raptor_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
       ARG1 a, ARG2 b, int64_t exponent, int64_t significand, int64_t mode,     \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_SET_ARG1(scratch[0], a, ROUNDING_MODE);                  \
       mpfr_##MPFR_FUNC_NAME(scratch[2], scratch[0], b, ROUNDING_MODE);         \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[2], a, b);                        \
       RET c = mpfr_get_##MPFR_GET(scratch[2], ROUNDING_MODE);                  \
+      RAPTOR_OP_RESIDUAL(                                                      \
+          __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME,     \
+          LLVM_OP_NAME, c, a, b);                                              \
       return c;                                                                \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
           a, exponent, significand, mode, loc, scratch);                       \
       __raptor_fp *mc = __raptor_fprt_##FROM_TYPE##_new_intermediate(          \
           exponent, significand, mode, loc, scratch);                          \
       RAPTOR_DUMP_INPUT(ma, OP_TYPE, LLVM_OP_NAME);                            \
       mpfr_##MPFR_FUNC_NAME(mc->result, ma->result, b, ROUNDING_MODE);         \
+      __raptor_fprt_mem_range(mc->result, exponent, significand);              \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, mc->result,                               \
+                       mpfr_get_d(ma->result, ROUNDING_MODE), b);              \
       RAPTOR_DUMP_RESULT(mc, OP_TYPE, LLVM_OP_NAME);                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(mc);                             \
     } else {                                                                   \
@@ -614,20 +1024,28 @@ void raptor_fprt_op_clear();
 #define __RAPTOR_MPFR_BIN(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE,    \
                           RET, MPFR_GET, ARG1, MPFR_SET_ARG1, ARG2,            \
                           MPFR_SET_ARG2, ROUNDING_MODE)                        \
+  __RAPTOR_MPFR_OP_ORIGINAL(                                                   \
+      RET, __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME,    \
+      ARG1, ARG2)                                                              \
   __RAPTOR_MPFR_ATTRIBUTES                                                     \
   RET __raptor_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
       ARG1 a, ARG2 b, int64_t exponent, int64_t significand, int64_t mode,     \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_SET_ARG1(scratch[0], a, ROUNDING_MODE);                  \
       mpfr_set_##MPFR_SET_ARG2(scratch[1], b, ROUNDING_MODE);                  \
       mpfr_##MPFR_FUNC_NAME(scratch[2], scratch[0], scratch[1],                \
                             ROUNDING_MODE);                                    \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[2], a, b);                        \
       RET c = mpfr_get_##MPFR_GET(scratch[2], ROUNDING_MODE);                  \
+      RAPTOR_OP_RESIDUAL(                                                      \
+          __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME,     \
+          LLVM_OP_NAME, c, a, b);                                              \
+      RAPTOR_OP_CANCELLATION(LLVM_OP_NAME, a, b, c);                           \
       return c;                                                                \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
           a, exponent, significand, mode, loc, scratch);                       \
       __raptor_fp *mb = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
@@ -638,6 +1056,12 @@ void raptor_fprt_op_clear();
       RAPTOR_DUMP_INPUT(mb, OP_TYPE, LLVM_OP_NAME);                            \
       mpfr_##MPFR_FUNC_NAME(mc->result, ma->result, mb->result,                \
                             ROUNDING_MODE);                                    \
+      __raptor_fprt_mem_range(mc->result, exponent, significand);              \
+      RAPTOR_MEM_CANCELLATION(LLVM_OP_NAME, ma->result, mb->result,            \
+                              mc->result);                                     \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, mc->result,                               \
+                       mpfr_get_d(ma->result, ROUNDING_MODE),                  \
+                       mpfr_get_d(mb->result, ROUNDING_MODE));                 \
       RAPTOR_DUMP_RESULT(mc, OP_TYPE, LLVM_OP_NAME);                           \
       return __raptor_fprt_ptr_to_##FROM_TYPE(mc);                             \
     } else {                                                                   \
@@ -647,18 +1071,26 @@ void raptor_fprt_op_clear();
 
 #define __RAPTOR_MPFR_FMULADD(LLVM_OP_NAME, FROM_TYPE, TYPE, MPFR_TYPE,        \
                               LLVM_TYPE, ROUNDING_MODE)                        \
+  __RAPTOR_MPFR_OP_ORIGINAL(                                                   \
+      TYPE,                                                                    \
+      __raptor_fprt_original_##FROM_TYPE##_intr_##LLVM_OP_NAME##_##LLVM_TYPE,  \
+      TYPE, TYPE, TYPE)                                                        \
   __RAPTOR_MPFR_ATTRIBUTES                                                     \
   TYPE __raptor_fprt_##FROM_TYPE##_intr_##LLVM_OP_NAME##_##LLVM_TYPE(          \
       TYPE a, TYPE b, TYPE c, int64_t exponent, int64_t significand,           \
       int64_t mode, const char *loc, mpfr_t *scratch) {                        \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(LLVM_OP_NAME);                                        \
       mpfr_set_##MPFR_TYPE(scratch[0], a, ROUNDING_MODE);                      \
       mpfr_set_##MPFR_TYPE(scratch[1], b, ROUNDING_MODE);                      \
       mpfr_set_##MPFR_TYPE(scratch[2], c, ROUNDING_MODE);                      \
       mpfr_mul(scratch[0], scratch[0], scratch[1], ROUNDING_MODE);             \
       mpfr_add(scratch[0], scratch[0], scratch[2], ROUNDING_MODE);             \
+      RAPTOR_EXCEPTION(LLVM_OP_NAME, scratch[0], a, b, c);                     \
       TYPE res = mpfr_get_##MPFR_TYPE(scratch[0], ROUNDING_MODE);              \
+      RAPTOR_OP_RESIDUAL(                                                      \
+          __raptor_fprt_original_##FROM_TYPE##_intr_##LLVM_OP_NAME##_##LLVM_TYPE, \
+          LLVM_OP_NAME, res, a, b, c);                                         \
       return res;                                                              \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
@@ -688,18 +1120,22 @@ void raptor_fprt_op_clear();
 // TODO This does not currently make distinctions between ordered/unordered.
 #define __RAPTOR_MPFR_FCMP_IMPL(NAME, ORDERED, CMP, FROM_TYPE, TYPE, MPFR_GET, \
                                 ROUNDING_MODE)                                 \
+  __RAPTOR_MPFR_OP_ORIGINAL(                                                   \
+      bool, __raptor_fprt_original_##FROM_TYPE##_fcmp_##NAME, TYPE, TYPE)      \
   __RAPTOR_MPFR_ATTRIBUTES                                                     \
   bool __raptor_fprt_##FROM_TYPE##_fcmp_##NAME(                                \
       TYPE a, TYPE b, int64_t exponent, int64_t significand, int64_t mode,     \
       const char *loc, mpfr_t *scratch) {                                      \
     if (__raptor_fprt_is_op_mode(mode)) {                                      \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(fcmp);                                                \
       mpfr_set_##MPFR_GET(scratch[0], a, ROUNDING_MODE);                       \
       mpfr_set_##MPFR_GET(scratch[1], b, ROUNDING_MODE);                       \
       int ret = mpfr_cmp(scratch[0], scratch[1]);                              \
+      RAPTOR_OP_FLIP(__raptor_fprt_original_##FROM_TYPE##_fcmp_##NAME,         \
+                     fcmp_##NAME, ret CMP, a, b);                              \
       return ret CMP;                                                          \
     } else if (__raptor_fprt_is_mem_mode(mode)) {                              \
-      __raptor_fprt_trunc_count(exponent, significand, mode, loc, scratch);    \
+      RAPTOR_TRUNC_COUNT(fcmp);                                                \
       __raptor_fp *ma = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
           a, exponent, significand, mode, loc, scratch);                       \
       __raptor_fp *mb = __raptor_fprt_##FROM_TYPE##_to_ptr_checked(            \
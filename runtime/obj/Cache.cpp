@@ -0,0 +1,330 @@
+//===- Cache.cpp - Cache simulation of counted memory accesses ------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file simulates a cache hierarchy for the memory accesses of code
+// compiled with -raptor-count-per-access, see raptor/Cache.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_CACHE=1          simulate the default hierarchy, 32 KiB 8-way
+//                                L1, 1 MiB 16-way L2 and 32 MiB 16-way L3
+//                                with 64 byte lines
+//   RAPTOR_FPRT_CACHE=<config>   comma separated levels and line size, e.g.
+//                                l1=48k:12,l2=2m:16,line=64
+//
+// The what-if hierarchy maps a floating-point access of `size` bytes made
+// while truncating to `trunc_bytes` bytes at a scaled address in a separate
+// part of the address space, so that arrays accessed with unit stride stay
+// contiguous at the narrower width. The lines touched that way are remembered
+// and later floating-point accesses to them are shrunk as well, the data is
+// stored narrow after all.
+//
+// All threads share one hierarchy and every access takes `cache_mutex`, so the
+// accesses of concurrent threads are serialized and simulated as if they ran
+// interleaved on a single core. Besides slowing multithreaded programs down
+// considerably, this overstates the misses of threads which evict each other's
+// lines. The simulation is meant for single-threaded kernels.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "raptor/Cache.h"
+#include "raptor/Common.h"
+
+#define RAPTOR_FPRT_CACHE_MAX_LEVELS 4
+// Base of the addresses of shrunk accesses in the what-if hierarchy.
+#define RAPTOR_FPRT_CACHE_SHRUNK_BASE (1ull << 62)
+
+bool __raptor_fprt_cache_enabled = false;
+std::atomic<int64_t> __raptor_fprt_trunc_bytes = 0;
+
+typedef struct __raptor_cache_line {
+  uint64_t tag = ~0ull;
+  uint64_t last_use = 0;
+  bool dirty = false;
+} __raptor_cache_line;
+
+typedef struct __raptor_cache_level {
+  uint64_t size = 0;
+  unsigned ways = 1;
+  uint64_t sets = 1;
+  std::vector<__raptor_cache_line> lines; // sets * ways
+} __raptor_cache_level;
+
+typedef struct __raptor_cache_stats {
+  long long misses[RAPTOR_FPRT_CACHE_MAX_LEVELS] = {};
+  long long dram_read = 0;  // Lines read from memory.
+  long long dram_write = 0; // Dirty lines written back to memory.
+} __raptor_cache_stats;
+
+typedef struct __raptor_cache_function {
+  long long accesses = 0;
+  long long shrunk = 0; // Accesses shrunk in the what-if.
+  __raptor_cache_stats base;
+  __raptor_cache_stats what_if;
+} __raptor_cache_function;
+
+class CacheHierarchy {
+public:
+  std::vector<__raptor_cache_level> levels;
+
+  void init() {
+    for (__raptor_cache_level &level : levels)
+      level.lines.assign(level.sets * level.ways, __raptor_cache_line());
+  }
+
+  // Accesses one line and counts misses and memory traffic into `stats`.
+  void access(uint64_t line, bool is_store, __raptor_cache_stats &stats) {
+    for (size_t l = 0; l < levels.size(); l++) {
+      __raptor_cache_line *found = lookup(levels[l], line);
+      if (found) {
+        found->dirty |= is_store;
+        return;
+      }
+      stats.misses[l]++;
+      insert(l, line, is_store, stats);
+    }
+    stats.dram_read++;
+  }
+
+private:
+  uint64_t clock = 0;
+
+  __raptor_cache_line *set_of(__raptor_cache_level &level, uint64_t line) {
+    return &level.lines[(line % level.sets) * level.ways];
+  }
+
+  __raptor_cache_line *lookup(__raptor_cache_level &level, uint64_t line) {
+    __raptor_cache_line *set = set_of(level, line);
+    for (unsigned w = 0; w < level.ways; w++)
+      if (set[w].tag == line) {
+        set[w].last_use = ++clock;
+        return &set[w];
+      }
+    return nullptr;
+  }
+
+  // Replaces the least recently used line of the set, a dirty victim is
+  // written back to the next level or to memory.
+  void insert(size_t l, uint64_t line, bool dirty,
+              __raptor_cache_stats &stats) {
+    __raptor_cache_level &level = levels[l];
+    __raptor_cache_line *set = set_of(level, line);
+    __raptor_cache_line *victim = set;
+    for (unsigned w = 1; w < level.ways; w++)
+      if (set[w].last_use < victim->last_use)
+        victim = &set[w];
+    if (victim->tag != ~0ull && victim->dirty) {
+      __raptor_cache_line *next = nullptr;
+      if (l + 1 == levels.size())
+        stats.dram_write++;
+      else if ((next = lookup(levels[l + 1], victim->tag)))
+        next->dirty = true;
+      else
+        insert(l + 1, victim->tag, /*dirty*/ true, stats);
+    }
+    victim->tag = line;
+    victim->dirty = dirty;
+    victim->last_use = ++clock;
+  }
+};
+
+static std::mutex cache_mutex;
+static unsigned line_bits = 6;
+static CacheHierarchy base_cache, what_if_cache;
+static std::unordered_map<const char *, __raptor_cache_function> *functions =
+    nullptr;
+// Lines (of the original addresses) stored narrow in the what-if.
+static std::unordered_set<uint64_t> *narrow_lines = nullptr;
+
+static void access_lines(CacheHierarchy &cache, uint64_t addr, uint64_t size,
+                         bool is_store, __raptor_cache_stats &stats) {
+  if (!size)
+    return;
+  uint64_t last = (addr + size - 1) >> line_bits;
+  for (uint64_t line = addr >> line_bits; line <= last; line++)
+    cache.access(line, is_store, stats);
+}
+
+void __raptor_fprt_cache_access(void *ptr, int64_t size, bool is_store,
+                                bool is_fp, const char *func) {
+  uint64_t addr = (uint64_t)ptr;
+  int64_t trunc_bytes =
+      __raptor_fprt_trunc_bytes.load(std::memory_order_relaxed);
+  bool shrink = is_fp && trunc_bytes > 0 && trunc_bytes < size;
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (shrink) {
+    if (global_is_truncating)
+      narrow_lines->insert(addr >> line_bits);
+    else
+      shrink = narrow_lines->count(addr >> line_bits);
+  }
+  __raptor_cache_function &function = (*functions)[func];
+  function.accesses++;
+  access_lines(base_cache, addr, size, is_store, function.base);
+  if (shrink) {
+    function.shrunk++;
+    access_lines(what_if_cache,
+                 RAPTOR_FPRT_CACHE_SHRUNK_BASE + addr / size * trunc_bytes,
+                 trunc_bytes, is_store, function.what_if);
+  } else {
+    access_lines(what_if_cache, addr, size, is_store, function.what_if);
+  }
+}
+
+static double reduction(long long base, long long what_if) {
+  return base ? 100.0 * (base - what_if) / base : 0;
+}
+
+static void cache_report() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  size_t num_levels = base_cache.levels.size();
+  fprintf(stderr, "Cache simulation of %zu functions:", functions->size());
+  for (size_t l = 0; l < num_levels; l++)
+    fprintf(stderr, " L%zu %llu KiB %u-way,", l + 1,
+            (unsigned long long)base_cache.levels[l].size >> 10,
+            base_cache.levels[l].ways);
+  fprintf(stderr,
+          " %u byte lines. The what-if shrinks truncated FP accesses.\n",
+          1u << line_bits);
+
+  std::vector<std::pair<const char *, __raptor_cache_function>> sorted(
+      functions->begin(), functions->end());
+  __raptor_cache_function total;
+  for (auto &[func, function] : sorted) {
+    total.accesses += function.accesses;
+    total.shrunk += function.shrunk;
+    for (size_t l = 0; l < num_levels; l++) {
+      total.base.misses[l] += function.base.misses[l];
+      total.what_if.misses[l] += function.what_if.misses[l];
+    }
+    total.base.dram_read += function.base.dram_read;
+    total.base.dram_write += function.base.dram_write;
+    total.what_if.dram_read += function.what_if.dram_read;
+    total.what_if.dram_write += function.what_if.dram_write;
+  }
+  auto dram = [](const __raptor_cache_stats &stats) {
+    return (stats.dram_read + stats.dram_write) << line_bits;
+  };
+  std::sort(sorted.begin(), sorted.end(), [&](const auto &a, const auto &b) {
+    return dram(a.second.base) > dram(b.second.base);
+  });
+  sorted.emplace_back("<total>", total);
+
+  fprintf(stderr, "  %12s %12s", "accesses", "shrunk");
+  for (size_t l = 0; l < num_levels; l++)
+    fprintf(stderr, "   L%zu misses (saved)", l + 1);
+  fprintf(stderr, " %14s %14s %8s  %s\n", "DRAM bytes", "what-if", "saved",
+          "function");
+  for (auto &[func, function] : sorted) {
+    fprintf(stderr, "  %12lld %12lld", function.accesses, function.shrunk);
+    for (size_t l = 0; l < num_levels; l++)
+      fprintf(stderr, " %12lld (%5.1f%%)", function.base.misses[l],
+              reduction(function.base.misses[l], function.what_if.misses[l]));
+    fprintf(stderr, " %14lld %14lld %7.1f%%  %s\n", dram(function.base),
+            dram(function.what_if),
+            reduction(dram(function.base), dram(function.what_if)),
+            func ? func : "unknown");
+  }
+}
+
+// Parses a size like 32k or 1m.
+static uint64_t parse_size(const char *s, const char **end) {
+  char *e;
+  uint64_t size = strtoull(s, &e, 10);
+  switch (*e) {
+  case 'k':
+  case 'K':
+    size <<= 10, e++;
+    break;
+  case 'm':
+  case 'M':
+    size <<= 20, e++;
+    break;
+  case 'g':
+  case 'G':
+    size <<= 30, e++;
+    break;
+  }
+  *end = e;
+  return size;
+}
+
+static bool parse_cache_config(const char *config) {
+  if (!strcmp(config, "1"))
+    config = "l1=32k:8,l2=1m:16,l3=32m:16,line=64";
+  std::vector<__raptor_cache_level> levels;
+  uint64_t line_size = 64;
+  while (*config) {
+    size_t len = strcspn(config, ",");
+    const char *end;
+    if (!strncmp(config, "line=", 5)) {
+      line_size = parse_size(config + 5, &end);
+    } else if (config[0] == 'l' && config[1] >= '1' && config[1] <= '9' &&
+               config[2] == '=') {
+      __raptor_cache_level level;
+      level.size = parse_size(config + 3, &end);
+      if (*end == ':')
+        level.ways = strtoul(end + 1, (char **)&end, 10);
+      if ((unsigned)(config[1] - '1') != levels.size() || !level.ways)
+        end = config;
+      levels.push_back(level);
+    } else {
+      end = config;
+    }
+    if (end != config + len) {
+      fprintf(stderr, "raptor: invalid cache configuration '%.*s'\n", (int)len,
+              config);
+      return false;
+    }
+    config += len;
+    if (*config == ',')
+      ++config;
+  }
+  if (levels.empty() || levels.size() > RAPTOR_FPRT_CACHE_MAX_LEVELS ||
+      !line_size || (line_size & (line_size - 1))) {
+    fprintf(stderr, "raptor: the cache needs 1 to %d levels and a power of "
+                    "two line size\n",
+            RAPTOR_FPRT_CACHE_MAX_LEVELS);
+    return false;
+  }
+  line_bits = __builtin_ctzll(line_size);
+  for (__raptor_cache_level &level : levels) {
+    level.sets = std::max<uint64_t>(1, level.size / line_size / level.ways);
+    level.size = level.sets * level.ways * line_size;
+  }
+  base_cache.levels = levels;
+  what_if_cache.levels = levels;
+  base_cache.init();
+  what_if_cache.init();
+  return true;
+}
+
+static struct CacheConfig {
+  CacheConfig() {
+    const char *config = getenv("RAPTOR_FPRT_CACHE");
+    if (!config || !*config || !strcmp(config, "0"))
+      return;
+    if (!parse_cache_config(config))
+      return;
+    functions = new std::unordered_map<const char *, __raptor_cache_function>();
+    narrow_lines = new std::unordered_set<uint64_t>();
+    __raptor_fprt_cache_enabled = true;
+    atexit(cache_report);
+  }
+} cache_config;
@@ -0,0 +1,194 @@
+//===- Context.cpp - Calling contexts of truncated functions --------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file maintains the shadow call stacks and calling-context trees
+// described in raptor/Context.h and writes them as folded stacks, one line
+// `outer;...;inner value` per context, which flamegraph.pl, speedscope and
+// inferno read directly. The value of a line is exclusive to its context.
+//
+// Environment variables:
+//   RAPTOR_FPRT_CONTEXT=<path>          where the folded stacks are written at
+//                                       exit (default raptor.folded), a `%p`
+//                                       in the path is replaced by the process
+//                                       id
+//   RAPTOR_FPRT_CONTEXT_METRIC=<name>   the value of a context: `flops`
+//                                       (default), `calls`, `violations` or
+//                                       `error` (summed relative error scaled
+//                                       by 1e6)
+//
+//===----------------------------------------------------------------------===//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Context.h"
+#include "raptor/raptor.h"
+
+#define RAPTOR_FPRT_CONTEXT_DEFAULT_PATH "raptor.folded"
+// Deeper calls are attributed to the deepest context on the stack.
+#define RAPTOR_FPRT_CONTEXT_MAX_DEPTH 128
+#define RAPTOR_FPRT_CONTEXT_ROOT 0
+#define RAPTOR_FPRT_CONTEXT_NONE 0xffffffffu
+
+typedef struct __raptor_context_thread {
+  std::vector<__raptor_context_node> nodes; // nodes[0] is the root.
+  uint32_t stack[RAPTOR_FPRT_CONTEXT_MAX_DEPTH];
+  unsigned depth = 0;   // Contexts on the stack.
+  unsigned overflow = 0; // Pushes beyond the maximum depth.
+  struct __raptor_context_thread *next;
+} __raptor_context_thread;
+
+thread_local __raptor_context_node *__raptor_fprt_tls_context = nullptr;
+
+// The node vectors only grow under the mutex so that they can be written
+// while other threads are running.
+static std::mutex context_mutex;
+static __raptor_context_thread *context_threads = nullptr;
+static thread_local __raptor_context_thread *tls_context_thread = nullptr;
+
+static void context_write_at_exit() {
+  const char *path = getenv("RAPTOR_FPRT_CONTEXT");
+  const char *metric = getenv("RAPTOR_FPRT_CONTEXT_METRIC");
+  raptor_fprt_context_write(path ? path : RAPTOR_FPRT_CONTEXT_DEFAULT_PATH,
+                            metric ? metric : "flops");
+}
+
+static __raptor_context_node new_node(const char *name, uint32_t parent) {
+  __raptor_context_node node = {};
+  node.name = name;
+  node.parent = parent;
+  node.first_child = RAPTOR_FPRT_CONTEXT_NONE;
+  node.next_sibling = RAPTOR_FPRT_CONTEXT_NONE;
+  return node;
+}
+
+static __raptor_context_thread *get_context_thread() {
+  if (__raptor_context_thread *thread = tls_context_thread)
+    return thread;
+  // Never freed so that threads which already exited are still written.
+  __raptor_context_thread *thread = new __raptor_context_thread();
+  thread->nodes.push_back(new_node("<root>", RAPTOR_FPRT_CONTEXT_NONE));
+  thread->stack[0] = RAPTOR_FPRT_CONTEXT_ROOT;
+  std::lock_guard<std::mutex> lock(context_mutex);
+  if (!context_threads)
+    atexit(context_write_at_exit);
+  thread->next = context_threads;
+  context_threads = thread;
+  tls_context_thread = thread;
+  return thread;
+}
+
+static uint32_t find_child(__raptor_context_thread *thread, uint32_t parent,
+                           const char *name) {
+  uint32_t child = thread->nodes[parent].first_child;
+  for (; child != RAPTOR_FPRT_CONTEXT_NONE;
+       child = thread->nodes[child].next_sibling)
+    // Every module has its own copy of a name, so compare the strings too.
+    if (thread->nodes[child].name == name ||
+        !strcmp(thread->nodes[child].name, name))
+      return child;
+
+  std::lock_guard<std::mutex> lock(context_mutex);
+  child = thread->nodes.size();
+  thread->nodes.push_back(new_node(name, parent));
+  thread->nodes[child].next_sibling = thread->nodes[parent].first_child;
+  thread->nodes[parent].first_child = child;
+  return child;
+}
+
+// Returns the depth of the stack before the push, counting pushes beyond the
+// maximum depth, which the matching pops restore.
+__RAPTOR_MPFR_ATTRIBUTES
+uint32_t __raptor_fprt_context_push(const char *name) {
+  __raptor_context_thread *thread = get_context_thread();
+  uint32_t depth = thread->depth + thread->overflow;
+  if (thread->depth + 1 >= RAPTOR_FPRT_CONTEXT_MAX_DEPTH) {
+    thread->overflow++;
+    return depth;
+  }
+  uint32_t node = find_child(thread, thread->stack[thread->depth], name);
+  thread->stack[++thread->depth] = node;
+  thread->nodes[node].calls++;
+  __raptor_fprt_tls_context = &thread->nodes[node];
+  return depth;
+}
+
+// Pops the contexts above `depth`. Contexts of frames which were unwound
+// without returning are popped along with them, a deeper `depth` than the
+// current one is ignored.
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_context_pop(uint32_t depth) {
+  __raptor_context_thread *thread = tls_context_thread;
+  if (!thread || depth >= thread->depth + thread->overflow)
+    return;
+  if (depth >= thread->depth) {
+    thread->overflow = depth - thread->depth;
+    return;
+  }
+  thread->overflow = 0;
+  thread->depth = depth;
+  __raptor_fprt_tls_context =
+      thread->depth ? &thread->nodes[thread->stack[thread->depth]] : nullptr;
+}
+
+static long long node_value(const __raptor_context_node &node,
+                            const char *metric) {
+  if (!strcmp(metric, "calls"))
+    return node.calls;
+  if (!strcmp(metric, "violations"))
+    return node.violations;
+  if (!strcmp(metric, "error"))
+    return (long long)(node.rel_err * 1e6);
+  return node.flops;
+}
+
+static void collect(const __raptor_context_thread *thread, uint32_t index,
+                    const std::string &path, const char *metric,
+                    std::map<std::string, long long> &folded) {
+  const __raptor_context_node &node = thread->nodes[index];
+  for (uint32_t child = node.first_child; child != RAPTOR_FPRT_CONTEXT_NONE;
+       child = thread->nodes[child].next_sibling) {
+    const __raptor_context_node &c = thread->nodes[child];
+    std::string child_path = path.empty() ? c.name : path + ";" + c.name;
+    folded[child_path] += node_value(c, metric);
+    collect(thread, child, child_path, metric, folded);
+  }
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+int raptor_fprt_context_write(const char *path, const char *metric) {
+  // Contexts of all threads are merged by their path.
+  std::map<std::string, long long> folded;
+  {
+    std::lock_guard<std::mutex> lock(context_mutex);
+    for (__raptor_context_thread *thread = context_threads; thread;
+         thread = thread->next)
+      collect(thread, RAPTOR_FPRT_CONTEXT_ROOT, "", metric, folded);
+  }
+
+  std::string expanded = __raptor_fprt_expand_path(path);
+  FILE *out = fopen(expanded.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  for (auto &[stack, value] : folded)
+    if (value)
+      fprintf(out, "%s %lld\n", stack.c_str(), value);
+  return fclose(out);
+}
@@ -1,45 +1,516 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <ostream>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include "raptor/Cache.h"
 #include "raptor/Common.h"
+#include "raptor/Context.h"
+#include "raptor/Profile.h"
+#include "raptor/Series.h"
+#include "raptor/Shm.h"
+#include "raptor/Sites.h"
+#include "raptor/Timeline.h"
+#include "raptor/Timing.h"
 #include "raptor/raptor.h"
 
-// Global variable to count truncated flops
-// TODO only implemented for op mode at the moment
-std::atomic<long long> trunc_flop_counter = 0;
-std::atomic<long long> double_flop_counter = 0;
-std::atomic<long long> float_flop_counter = 0;
-std::atomic<long long> half_flop_counter = 0;
+// Flop and memory access counters.
+// TODO truncated flops are only counted in op mode at the moment
+//
+// Every thread counts into its own cache line sized slot so that counting does
+// not bounce a shared line between cores. The slots are registered in a global
+// list and summed when a count is read. A thread only ever writes its own
+// slot, so relaxed loads and stores suffice. Slots of exited threads are
+// reused by new threads, their counts are kept. The slots can live in shared
+// memory for raptor-top, see raptor/Shm.h.
+
+static const char *counter_names[NUM_COUNTERS] = {
+    "trunc flops", "double flops", "float flops",    "half flops",
+    "trunc loads", "trunc stores", "original loads", "original stores"};
+
+const char *const __raptor_fprt_op_class_names[RAPTOR_NUM_OP_CLASSES] = {
+    "add",            "mul",     "fma",        "div", "sqrt",
+    "transcendental", "compare", "conversion", "sign"};
+
+const char *const __raptor_fprt_precision_names[RAPTOR_NUM_PRECISIONS] = {
+    "trunc", "double", "float", "half"};
+
+// Relative cost of an operation of each class, roughly the reciprocal
+// throughput of a current x86 core relative to an addition. Override them
+// with RAPTOR_FPRT_FLOP_COSTS=<class>=<cost>,<precision>.<class>=<cost>,...
+// e.g. RAPTOR_FPRT_FLOP_COSTS=div=8,half.add=0.5
+static double op_class_costs[RAPTOR_NUM_PRECISIONS][RAPTOR_NUM_OP_CLASSES];
+static const double default_op_class_costs[RAPTOR_NUM_OP_CLASSES] = {
+    1, 1, 1, 4, 6, 20, 1, 1, 1};
+
+static std::mutex counter_slots_mutex;
+static __raptor_counter_slot *counter_slots = nullptr;
+static unsigned num_counter_slots = 0;
+// Counts at the last reset, subtracted when the counters are read. Threads
+// write their slots without atomic read-modify-writes, so slots are never
+// cleared from another thread.
+static raptor_counters counters_base = {};
+static thread_local __raptor_counter_slot *tls_counter_slot = nullptr;
+
+// Returns the slot of this thread to the pool when the thread exits.
+struct CounterSlotOwner {
+  __raptor_counter_slot *slot = nullptr;
+  ~CounterSlotOwner() {
+    if (!slot)
+      return;
+    std::lock_guard<std::mutex> lock(counter_slots_mutex);
+    slot->in_use = false;
+    tls_counter_slot = nullptr;
+  }
+};
+static thread_local CounterSlotOwner counter_slot_owner;
+
+__attribute__((noinline)) static __raptor_counter_slot *
+acquire_counter_slot() {
+  std::lock_guard<std::mutex> lock(counter_slots_mutex);
+  __raptor_counter_slot *slot = counter_slots;
+  while (slot && slot->in_use)
+    slot = slot->next;
+  if (!slot) {
+    slot = __raptor_fprt_shm_new_slot();
+    if (!slot)
+      slot = new __raptor_counter_slot();
+    slot->index = num_counter_slots++;
+    // Append so that the list stays in creation order for the reports.
+    __raptor_counter_slot **tail = &counter_slots;
+    while (*tail)
+      tail = &(*tail)->next;
+    *tail = slot;
+  }
+  slot->in_use = true;
+  counter_slot_owner.slot = slot;
+  tls_counter_slot = slot;
+  return slot;
+}
+
+static inline __raptor_counter_slot *counter_slot() {
+  __raptor_counter_slot *slot = tls_counter_slot;
+  if (!slot)
+    slot = acquire_counter_slot();
+  return slot;
+}
+
+static inline void add(std::atomic<long long> &c, long long n) {
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Sequence lock around the updates of a slot which raptor-top may be reading.
+static inline void begin_update(__raptor_counter_slot *slot) {
+  if (slot->shared) {
+    slot->seq.store(slot->seq.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+}
+
+static inline void end_update(__raptor_counter_slot *slot) {
+  if (slot->shared)
+    slot->seq.store(slot->seq.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+}
+
+static inline void count(__raptor_counter counter, long long n) {
+  __raptor_counter_slot *slot = counter_slot();
+  begin_update(slot);
+  add(slot->counters[counter], n);
+  end_update(slot);
+}
+
+static inline void count_class(int precision, int64_t op_class, long long n,
+                               bool vector = false) {
+  // Flops of classes this runtime does not know yet are the expensive ones.
+  if ((uint64_t)op_class >= RAPTOR_NUM_OP_CLASSES)
+    op_class = RAPTOR_OP_CLASS_TRANSCENDENTAL;
+  __raptor_counter_slot *slot = counter_slot();
+  begin_update(slot);
+  add(slot->counters[precision], n);
+  add(slot->classes[precision][op_class], n);
+  if (vector)
+    add(slot->vector_flops[precision], n);
+  end_update(slot);
+}
+
+static inline void count_vector(int precision, int64_t op_class, long long n) {
+  count_class(precision, op_class, n, /*vector*/ true);
+}
+
+static inline void count_profile(int precision, int64_t op_class, long long n,
+                                 bool vector, int32_t site) {
+  if (vector)
+    count_vector(precision, op_class, n);
+  else
+    count_class(precision, op_class, n);
+  __raptor_fprt_profile_flops(site, precision, op_class, n, vector);
+}
+
+template <typename Counters>
+static auto &counter_field(Counters &counters, __raptor_counter counter) {
+  switch (counter) {
+  case TRUNC_LOAD_COUNTER:
+    return counters.trunc_load;
+  case TRUNC_STORE_COUNTER:
+    return counters.trunc_store;
+  case ORIGINAL_LOAD_COUNTER:
+    return counters.original_load;
+  case ORIGINAL_STORE_COUNTER:
+    return counters.original_store;
+  default:
+    return counters.flops[counter];
+  }
+}
+
+// Sums the slots of all threads since the beginning of the program.
+static void sum_counters_locked(raptor_counters &sum) {
+  sum = {};
+  for (__raptor_counter_slot *slot = counter_slots; slot; slot = slot->next) {
+    for (int i = 0; i < NUM_COUNTERS; i++)
+      counter_field(sum, (__raptor_counter)i) +=
+          slot->counters[i].load(std::memory_order_relaxed);
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++) {
+      for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+        sum.flops_by_class[p][c] +=
+            slot->classes[p][c].load(std::memory_order_relaxed);
+      sum.vector_flops[p] +=
+          slot->vector_flops[p].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+static void subtract_counters(raptor_counters &into,
+                              const raptor_counters &other) {
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    counter_field(into, (__raptor_counter)i) -=
+        counter_field(other, (__raptor_counter)i);
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++) {
+    for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+      into.flops_by_class[p][c] -= other.flops_by_class[p][c];
+    into.vector_flops[p] -= other.vector_flops[p];
+  }
+}
+
+static void add_counters(raptor_counters &into, const raptor_counters &other) {
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    counter_field(into, (__raptor_counter)i) +=
+        counter_field(other, (__raptor_counter)i);
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++) {
+    for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+      into.flops_by_class[p][c] += other.flops_by_class[p][c];
+    into.vector_flops[p] += other.vector_flops[p];
+  }
+}
+
+// Phases use the counts since the beginning so that they are not affected by
+// resets.
+static void sum_counters(raptor_counters &sum) {
+  std::lock_guard<std::mutex> lock(counter_slots_mutex);
+  sum_counters_locked(sum);
+}
+
+void __raptor_fprt_counters_total(raptor_counters *counters) {
+  sum_counters(*counters);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_counters_snapshot(raptor_counters *counters) {
+  std::lock_guard<std::mutex> lock(counter_slots_mutex);
+  sum_counters_locked(*counters);
+  subtract_counters(*counters, counters_base);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void f_raptor_counters_snapshot(raptor_counters *counters) {
+  __raptor_counters_snapshot(counters);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_counters_reset() {
+  std::lock_guard<std::mutex> lock(counter_slots_mutex);
+  sum_counters_locked(counters_base);
+}
 
-std::atomic<long long> trunc_load_counter = 0;
-std::atomic<long long> trunc_store_counter = 0;
-std::atomic<long long> original_load_counter = 0;
-std::atomic<long long> original_store_counter = 0;
+__RAPTOR_MPFR_ATTRIBUTES
+void f_raptor_counters_reset() { __raptor_counters_reset(); }
 
-extern std::map<const char *, struct __raptor_op> opdata;
+long long __raptor_fprt_thread_trunc_flops() {
+  __raptor_counter_slot *slot = tls_counter_slot;
+  if (!slot)
+    return 0;
+  return slot->counters[TRUNC_FLOP_COUNTER].load(std::memory_order_relaxed);
+}
 
-// TODO this needs to be thread local
-std::atomic<bool> global_is_truncating = false;
+static long long sum_counter(__raptor_counter counter) {
+  raptor_counters counters;
+  __raptor_counters_snapshot(&counters);
+  return counter_field(counters, counter);
+}
+
+static long long sum_class_counter(int precision, int op_class) {
+  raptor_counters counters;
+  __raptor_counters_snapshot(&counters);
+  return counters.flops_by_class[precision][op_class];
+}
+
+static bool valid_op_class(int precision, int op_class) {
+  return precision >= 0 && precision < RAPTOR_NUM_PRECISIONS && op_class >= 0 &&
+         op_class < RAPTOR_NUM_OP_CLASSES;
+}
 
+// Returns the index of `name` in `names` or -1.
+static int find_name(const char *name, size_t len, const char *const *names,
+                     int num) {
+  for (int i = 0; i < num; i++)
+    if (strlen(names[i]) == len && !strncmp(name, names[i], len))
+      return i;
+  return -1;
+}
+
+static void parse_op_class_costs(const char *costs) {
+  while (*costs) {
+    size_t len = strcspn(costs, ",");
+    const char *eq = (const char *)memchr(costs, '=', len);
+    const char *dot = (const char *)memchr(costs, '.', eq ? eq - costs : 0);
+    int precision = -1;
+    if (dot)
+      precision = find_name(costs, dot - costs, __raptor_fprt_precision_names,
+                            RAPTOR_NUM_PRECISIONS);
+    const char *name = dot ? dot + 1 : costs;
+    int op_class = eq ? find_name(name, eq - name, __raptor_fprt_op_class_names,
+                                  RAPTOR_NUM_OP_CLASSES)
+                      : -1;
+    if (op_class < 0 || (dot && precision < 0)) {
+      fprintf(stderr, "raptor: ignoring invalid flop cost '%.*s'\n", (int)len,
+              costs);
+    } else {
+      double cost = atof(eq + 1);
+      for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+        if (!dot || p == precision)
+          op_class_costs[p][op_class] = cost;
+    }
+    costs += len;
+    if (*costs == ',')
+      ++costs;
+  }
+}
+
+static struct OpClassCosts {
+  OpClassCosts() {
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+      for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+        op_class_costs[p][c] = default_op_class_costs[c];
+    if (const char *costs = getenv("RAPTOR_FPRT_FLOP_COSTS"))
+      parse_op_class_costs(costs);
+  }
+} op_class_costs_init;
+
+// Prints the counters of every thread slot.
 __RAPTOR_MPFR_ATTRIBUTES
-long long __raptor_get_trunc_flop_count() { return trunc_flop_counter; }
+void raptor_fprt_count_dump_status() {
+  std::lock_guard<std::mutex> lock(counter_slots_mutex);
+  long long total[NUM_COUNTERS] = {};
+  long long total_classes[RAPTOR_NUM_PRECISIONS][RAPTOR_NUM_OP_CLASSES] = {};
+  long long total_vector[RAPTOR_NUM_PRECISIONS] = {};
+  std::cerr << "Counters of " << num_counter_slots << " thread slots."
+            << std::endl;
+  for (__raptor_counter_slot *slot = counter_slots; slot; slot = slot->next) {
+    std::cerr << "  thread " << slot->index << ":";
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+      long long c = slot->counters[i].load(std::memory_order_relaxed);
+      total[i] += c;
+      std::cerr << " " << counter_names[i] << ": " << c;
+    }
+    std::cerr << std::endl;
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++) {
+      for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+        total_classes[p][c] +=
+            slot->classes[p][c].load(std::memory_order_relaxed);
+      total_vector[p] += slot->vector_flops[p].load(std::memory_order_relaxed);
+    }
+  }
+  std::cerr << "  total:";
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    std::cerr << " " << counter_names[i] << ": " << total[i];
+  std::cerr << std::endl;
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++) {
+    if (!total[p])
+      continue;
+    double weighted = 0;
+    std::cerr << "  " << __raptor_fprt_precision_names[p] << " flops by class:";
+    for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++) {
+      weighted += op_class_costs[p][c] * total_classes[p][c];
+      if (total_classes[p][c])
+        std::cerr << " " << __raptor_fprt_op_class_names[c] << ": "
+                  << total_classes[p][c];
+    }
+    std::cerr << " weighted: " << weighted << " vector: " << total_vector[p]
+              << std::endl;
+  }
+}
+
+// Set RAPTOR_FPRT_COUNT_REPORT to print the per-thread counters at exit. This
+// has to be defined after `counter_slots_mutex` so that it runs before the
+// mutex is destroyed. The time series is started from here too, as nothing
+// else refers to Series.cpp and a static runtime would not link it otherwise.
+static struct CounterExitHandlers {
+  CounterExitHandlers() {
+    if (getenv("RAPTOR_FPRT_COUNT_REPORT"))
+      atexit(raptor_fprt_count_dump_status);
+    if (const char *path = getenv("RAPTOR_FPRT_SERIES"))
+      __raptor_fprt_series_start(path);
+  }
+} counter_exit_handlers;
+
+__RAPTOR_MPFR_ATTRIBUTES
+long long __raptor_get_trunc_flop_count() {
+  return sum_counter(TRUNC_FLOP_COUNTER);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+long long __raptor_get_double_flop_count() {
+  return sum_counter(DOUBLE_FLOP_COUNTER);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+long long __raptor_get_float_flop_count() {
+  return sum_counter(FLOAT_FLOP_COUNTER);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+long long __raptor_get_half_flop_count() {
+  return sum_counter(HALF_FLOP_COUNTER);
+}
 
 __RAPTOR_MPFR_ATTRIBUTES
-long long __raptor_get_double_flop_count() { return double_flop_counter; }
+long long __raptor_get_flop_count_by_class(int precision, int op_class) {
+  if (!valid_op_class(precision, op_class))
+    return 0;
+  return sum_class_counter(precision, op_class);
+}
 
 __RAPTOR_MPFR_ATTRIBUTES
-long long __raptor_get_float_flop_count() { return float_flop_counter; }
+long long __raptor_get_vector_flop_count(int precision) {
+  if (!valid_op_class(precision, 0))
+    return 0;
+  raptor_counters counters;
+  __raptor_counters_snapshot(&counters);
+  return counters.vector_flops[precision];
+}
 
 __RAPTOR_MPFR_ATTRIBUTES
-long long __raptor_get_half_flop_count() { return half_flop_counter; }
+double __raptor_get_weighted_flop_count(int precision) {
+  if (!valid_op_class(precision, 0))
+    return 0;
+  // One snapshot, so that the classes are consistent with each other.
+  raptor_counters counters;
+  __raptor_counters_snapshot(&counters);
+  double weighted = 0;
+  for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+    weighted += op_class_costs[precision][c] *
+                counters.flops_by_class[precision][c];
+  return weighted;
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_set_op_class_cost(int precision, int op_class, double cost) {
+  if (valid_op_class(precision, op_class))
+    op_class_costs[precision][op_class] = cost;
+}
+
+// Phases are a process wide stack, begin and end them from one thread.
+struct __raptor_phase {
+  long long calls = 0;
+  double seconds = 0;
+  raptor_counters counters = {};
+};
+
+struct __raptor_open_phase {
+  std::string path;
+  std::chrono::steady_clock::time_point start;
+  raptor_counters counters;
+};
+
+static std::mutex phases_mutex;
+static std::vector<__raptor_open_phase> *open_phases = nullptr;
+// Ordered by path so that nested phases follow their parent in the report.
+static std::map<std::string, __raptor_phase> *phases = nullptr;
+
+static void phase_report() {
+  std::lock_guard<std::mutex> lock(phases_mutex);
+  if (!open_phases->empty())
+    std::cerr << "Warning: " << open_phases->size()
+              << " phases were not ended." << std::endl;
+  std::cerr << "Counters of " << phases->size() << " phases." << std::endl;
+  for (auto &[path, phase] : *phases) {
+    std::cerr << "  " << path << ": calls: " << phase.calls
+              << " seconds: " << phase.seconds;
+    for (int i = 0; i < NUM_COUNTERS; i++)
+      std::cerr << " " << counter_names[i] << ": "
+                << counter_field(phase.counters, (__raptor_counter)i);
+    std::cerr << std::endl;
+  }
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_phase_begin(const char *name) {
+  __raptor_open_phase open;
+  sum_counters(open.counters);
+  std::lock_guard<std::mutex> lock(phases_mutex);
+  if (!phases) {
+    open_phases = new std::vector<__raptor_open_phase>();
+    phases = new std::map<std::string, __raptor_phase>();
+    atexit(phase_report);
+  }
+  if (!open_phases->empty())
+    open.path = open_phases->back().path + "/";
+  open.path += name;
+  open.start = std::chrono::steady_clock::now();
+  open_phases->push_back(open);
+  if (__raptor_fprt_timeline_enabled)
+    __raptor_fprt_timeline_begin(RAPTOR_TIMELINE_PHASE, name);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void f_raptor_phase_begin(const char *name, int len) {
+  __raptor_phase_begin(std::string(name, len).c_str());
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_phase_end() {
+  auto end = std::chrono::steady_clock::now();
+  raptor_counters counters;
+  sum_counters(counters);
+  std::lock_guard<std::mutex> lock(phases_mutex);
+  if (!open_phases || open_phases->empty()) {
+    std::cerr << "Warning: __raptor_phase_end without a phase" << std::endl;
+    return;
+  }
+  __raptor_open_phase &open = open_phases->back();
+  __raptor_phase &phase = (*phases)[open.path];
+  subtract_counters(counters, open.counters);
+  add_counters(phase.counters, counters);
+  phase.seconds += std::chrono::duration<double>(end - open.start).count();
+  phase.calls++;
+  open_phases->pop_back();
+  if (__raptor_fprt_timeline_enabled)
+    __raptor_fprt_timeline_end(RAPTOR_TIMELINE_PHASE);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void f_raptor_phase_end() { __raptor_phase_end(); }
 
 __RAPTOR_MPFR_ATTRIBUTES
 long long f_raptor_get_trunc_flop_count() {
@@ -65,23 +536,102 @@ __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_trunc_count(int64_t exponent, int64_t significand,
                                int64_t mode, const char *loc, mpfr_t *scratch) {
 #ifndef RAPTOR_FPRT_DISABLE_TRUNC_FLOP_COUNT
-  trunc_flop_counter.fetch_add(1, std::memory_order_relaxed);
+  count(TRUNC_FLOP_COUNTER, 1);
+#endif
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_trunc_count_class(int64_t op_class, int64_t exponent,
+                                     int64_t significand, int64_t mode,
+                                     const char *loc, mpfr_t *scratch) {
+#ifndef RAPTOR_FPRT_DISABLE_TRUNC_FLOP_COUNT
+  count_class(RAPTOR_PRECISION_TRUNC, op_class, 1);
+  if (__raptor_fprt_profile_enabled.load(std::memory_order_relaxed))
+    __raptor_fprt_profile_trunc_flop(loc, op_class);
+  __raptor_fprt_context_flop();
 #endif
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_ieee_64_count() {
-  double_flop_counter.fetch_add(1, std::memory_order_relaxed);
+  count(DOUBLE_FLOP_COUNTER, 1);
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_ieee_32_count() {
-  float_flop_counter.fetch_add(1, std::memory_order_relaxed);
+  count(FLOAT_FLOP_COUNTER, 1);
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_ieee_16_count() {
-  half_flop_counter.fetch_add(1, std::memory_order_relaxed);
+  count(HALF_FLOP_COUNTER, 1);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_class(int32_t op_class) {
+  count_class(RAPTOR_PRECISION_DOUBLE, op_class, 1);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_class(int32_t op_class) {
+  count_class(RAPTOR_PRECISION_FLOAT, op_class, 1);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_class(int32_t op_class) {
+  count_class(RAPTOR_PRECISION_HALF, op_class, 1);
+}
+
+// The pass counts the flops of a block statically and calls these once per
+// block and class, see -raptor-count-per-access.
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_class_block(int32_t op_class, int64_t n) {
+  count_class(RAPTOR_PRECISION_DOUBLE, op_class, n);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_class_block(int32_t op_class, int64_t n) {
+  count_class(RAPTOR_PRECISION_FLOAT, op_class, n);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_class_block(int32_t op_class, int64_t n) {
+  count_class(RAPTOR_PRECISION_HALF, op_class, n);
+}
+
+// Flops of vector instructions, `n` is the number of (active) lanes.
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_vector_block(int32_t op_class, int64_t n) {
+  count_vector(RAPTOR_PRECISION_DOUBLE, op_class, n);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_vector_block(int32_t op_class, int64_t n) {
+  count_vector(RAPTOR_PRECISION_FLOAT, op_class, n);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_vector_block(int32_t op_class, int64_t n) {
+  count_vector(RAPTOR_PRECISION_HALF, op_class, n);
+}
+
+// Flops attributed to a site of the flop profile, see raptor/Profile.h.
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_64_count_profile(int32_t op_class, int64_t n,
+                                         int32_t is_vector, int32_t site) {
+  count_profile(RAPTOR_PRECISION_DOUBLE, op_class, n, is_vector, site);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_32_count_profile(int32_t op_class, int64_t n,
+                                         int32_t is_vector, int32_t site) {
+  count_profile(RAPTOR_PRECISION_FLOAT, op_class, n, is_vector, site);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_ieee_16_count_profile(int32_t op_class, int64_t n,
+                                         int32_t is_vector, int32_t site) {
+  count_profile(RAPTOR_PRECISION_HALF, op_class, n, is_vector, site);
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
@@ -101,138 +651,74 @@ bool __op_dump_cmp(std::pair<const char *, __raptor_op> &a,
   return a.second.count_thresh > b.second.count_thresh;
 }
 
+void __raptor_fprt_op_print(const char *loc, const __raptor_op &op,
+                            const __raptor_cancel *cancel) {
+  std::cout << loc << ": " << op.count << "x" << op.op
+            << " L1 Error Norm: " << op.l1_err
+            << " Number of violations: " << op.count_thresh << " Ignored "
+            << op.count_ignore << " times.";
+  if (op.rel_err != 0 || op.count_flip)
+    std::cout << " Mean rel. error: " << op.rel_err / op.count
+              << " Max rel. error: " << op.max_rel_err
+              << " Flipped comparisons: " << op.count_flip;
+  bool cancelled = false;
+  for (int i = 1; cancel && i < RAPTOR_FPRT_CANCEL_BUCKETS; i++) {
+    if (!cancel->bits[i])
+      continue;
+    if (!cancelled)
+      std::cout << " Bits lost to cancellation:";
+    cancelled = true;
+    if (i == RAPTOR_FPRT_CANCEL_ZERO)
+      std::cout << " all:" << cancel->bits[i];
+    else if (i == RAPTOR_FPRT_CANCEL_ZERO - 1)
+      std::cout << " " << i << "+:" << cancel->bits[i];
+    else
+      std::cout << " " << i << ":" << cancel->bits[i];
+  }
+  std::cout << std::endl;
+}
+
+// See Mpi.cpp for the version which merges the statistics of all MPI ranks.
 __RAPTOR_MPFR_ATTRIBUTES
 void raptor_fprt_op_dump_status(unsigned num) {
-  // int size, rank;
-  // MPI_Comm_size(MPI_COMM_WORLD, &size);
-  // MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  // Op mode statistics live in per-thread tables, see OP_RESIDUALS.
+  std::map<const char *, __raptor_op> merged = __raptor_fprt_op_collect();
+  std::map<const char *, __raptor_cancel> cancel;
+  __raptor_fprt_cancel_collect(cancel);
 
-  if (opdata.size() < num)
-    num = opdata.size();
+  if (merged.size() < num)
+    num = merged.size();
 
-  // if (rank == 0) {
   std::cerr << "Information about top " << num << " operations." << std::endl;
-  // }
-  // std::vector<unsigned long long> key_recvcounts(size);
-  // std::vector<unsigned long long> key_displs(size);
-  // std::vector<unsigned long long> char_recvcounts(size);
-  // std::vector<unsigned long long> char_displs(size);
-  // std::vector<char> key_chars;
-  // std::vector<char> key_sizes;
-
-  std::vector<std::pair<const char *, struct __raptor_op>> od_vec;
-  std::vector<double> l1_vec;
-  std::vector<long long> ct_vec, c_vec;
-
-  // // Synchronize keys between processes.
-  // // Build explicit char vector of keys.
-  // // Collect size of each individual key.
-  // for (auto& it : opdata) {
-  //   int sz = 0;
-  //   for (char* c = it.first, *c, ++c) {
-  //     key_chars.push_back(c);
-  //     ++sz;
-  //   }
-  //   key_sizes.push_back(sz);
-  // }
-  // assert(op_data.size() == key_sizes.size());
-
-  // key_recvcounts[rank] = op_data.size();
-  // char_counts[rank] = key_chars.size();
-
-  // MPI_Allgather(MPI_IN_PLACE, 0, NULL,
-  //               key_counts.data(), 1, MPI_UNSIGNED_LONG_LONG,
-  //               MPI_COMM_WORLD);
-  // MPI_Allgather(MPI_IN_PLACE, 0, NULL,
-  //               char_counts.data(), 1, MPI_UNSIGNED_LONG_LONG,
-  //               MPI_COMM_WORLD);
-
-  // unsigned long long key_recvcounts_sum = 0;
-  // unsigned long long char_recvcounts_sum = 0;
-  // for (unsigned long long i = 0; i < size; ++i) {
-  //   key_displs[i] = key_recvcounts_sum;
-  //   char_displs[i] = char_recvcounts_sum;
-  //   key_recvcounts_sum += key_recvcounts[i];
-  //   char_recvcounts_sum += char_recvcounts[i];
-  // }
-  // std::vector<unsigned long long> key_sizes_recv(key_recvcount_sum);
-  // std::vector<char> key_chars_recv(char_recvcounts_sum);
-
-  // MPI_Allgatherv(key_sizes.data(), key_sizes.size(), MPI_UNSIGNED_LONG_LONG,
-  //                key_sizes_recv.data(), key_recvcounts.data(),
-  //                key_displs.data(), MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
-  // MPI_Allgatherv(key_chars.data(), key_chars.size(), MPI_CHAR,
-  //                key_chars_recv.data(), char_recvcounts.data(),
-  //                char_displs.data(), MPI_CHAR, MPI_COMM_WORLD);
-
-  // // Build strings
-  // std::vector<std::string> keys;
-  // unsigned long long char_idx = 0;
-  // for (unsigned long long i = 0; i < key_recvcount_sum; ++i) {
-  //   keys.push_back(std::string(key_chars[char_idx], key_sizes[i]));
-  //   char_idx += key_sizes[i];
-  // }
-
-  // // Make sure every key is represented in local opdata map
-  // for (auto& key : keys) {
-  //   opdata.insert(key, struct __raptor_op{"FILL", 0, 0, 0});
-  // }
-
-  // The order of iteration over keys will be the same on all processes.
-  for (auto &it : opdata) {
-    od_vec.push_back(it);
-    l1_vec.push_back(it.second.l1_err);
-    ct_vec.push_back(it.second.count_thresh);
-    c_vec.push_back(it.second.count);
-  }
 
-  // Perform an allreduce over opdata elements stored in the vector.
-  // if (rank == 0) {
-  //   MPI_Reduce(MPI_IN_PLACE, l1_vec.data(), od_vec.size(), MPI_DOUBLE,
-  //   MPI_SUM, 0, MPI_COMM_WORLD); MPI_Reduce(MPI_IN_PLACE, ct_vec.data(),
-  //   od_vec.size(), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-  //   MPI_Reduce(MPI_IN_PLACE,  c_vec.data(), od_vec.size(), MPI_DOUBLE,
-  //   MPI_SUM, 0, MPI_COMM_WORLD);
-  // } else {
-  //   MPI_Reduce(l1_vec.data(), NULL, od_vec.size(), MPI_DOUBLE, MPI_SUM, 0,
-  //   MPI_COMM_WORLD); MPI_Reduce(ct_vec.data(), NULL, od_vec.size(),
-  //   MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD); MPI_Reduce( c_vec.data(), NULL,
-  //   od_vec.size(), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-  // }
-
-  // if (rank == 0) {
-  // for (int i = 0; i < od_vec.size(); ++i) {
-  //   od_vec[i].second.l1_err = l1_vec[i];
-  //   od_vec[i].second.count_thresh = ct_vec[i];
-  //   od_vec[i].second.count = c_vec[i];
-  // }
-
-  std::sort(od_vec.begin(), od_vec.end(), __op_dump_cmp);
+  std::vector<std::pair<const char *, struct __raptor_op>> od_vec(
+      merged.begin(), merged.end());
 
   auto end = od_vec.begin() + num;
+  std::partial_sort(od_vec.begin(), end, od_vec.end(), __op_dump_cmp);
+
   for (auto it = od_vec.begin(); it != end; ++it) {
-    std::cout << it->first << ": " << it->second.count << "x" << it->second.op
-              << " L1 Error Norm: " << it->second.l1_err
-              << " Number of violations: " << it->second.count_thresh
-              << " Ignored " << it->second.count_ignore << " times."
-              << std::endl;
+    auto found = cancel.find(it->first);
+    __raptor_fprt_op_print(it->first, it->second,
+                           found != cancel.end() ? &found->second : nullptr);
   }
-  // }
 }
 
 long long __raptor_get_memory_access_trunc_store() {
-  return trunc_store_counter;
+  return sum_counter(TRUNC_STORE_COUNTER);
 }
 __RAPTOR_MPFR_ATTRIBUTES
-long long __raptor_get_memory_access_trunc_load() { return trunc_load_counter; }
+long long __raptor_get_memory_access_trunc_load() {
+  return sum_counter(TRUNC_LOAD_COUNTER);
+}
 
 __RAPTOR_MPFR_ATTRIBUTES
 long long __raptor_get_memory_access_original_store() {
-  return original_store_counter;
+  return sum_counter(ORIGINAL_STORE_COUNTER);
 }
 __RAPTOR_MPFR_ATTRIBUTES
 long long __raptor_get_memory_access_original_load() {
-  return original_load_counter;
+  return sum_counter(ORIGINAL_LOAD_COUNTER);
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
@@ -255,17 +741,41 @@ long long f_raptor_get_memory_access_original_load() {
 __RAPTOR_MPFR_ATTRIBUTES
 void __raptor_fprt_memory_access(void *ptr, int64_t size, int64_t is_store) {
   if (global_is_truncating) {
-    if (is_store)
-      trunc_store_counter.fetch_add(size, std::memory_order_relaxed);
-    else
-      trunc_load_counter.fetch_add(size, std::memory_order_relaxed);
+    count(is_store ? TRUNC_STORE_COUNTER : TRUNC_LOAD_COUNTER, size);
   } else {
-    if (is_store)
-      original_store_counter.fetch_add(size, std::memory_order_relaxed);
-    else
-      original_load_counter.fetch_add(size, std::memory_order_relaxed);
+    count(is_store ? ORIGINAL_STORE_COUNTER : ORIGINAL_LOAD_COUNTER, size);
+  }
+}
+
+// Per-access counting, `func` names the accessing function for the cache
+// simulation.
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_memory_access_fn(void *ptr, int64_t size, int64_t is_store,
+                                    int64_t is_fp, const char *func) {
+  __raptor_fprt_memory_access(ptr, size, is_store);
+  if (__raptor_fprt_cache_enabled)
+    __raptor_fprt_cache_access(ptr, size, is_store, is_fp, func);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_memory_access_block(int64_t loaded, int64_t stored) {
+  if (global_is_truncating) {
+    count(TRUNC_LOAD_COUNTER, loaded);
+    count(TRUNC_STORE_COUNTER, stored);
+  } else {
+    count(ORIGINAL_LOAD_COUNTER, loaded);
+    count(ORIGINAL_STORE_COUNTER, stored);
   }
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
-void raptor_fprt_op_clear() { opdata.clear(); }
+void __raptor_fprt_memory_access_profile(int64_t loaded, int64_t stored,
+                                         int32_t site) {
+  __raptor_fprt_memory_access_block(loaded, stored);
+  __raptor_fprt_profile_memory(site, loaded, stored);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_op_clear() {
+  __raptor_fprt_sites_clear();
+}
@@ -0,0 +1,244 @@
+//===- Diagnostics.cpp - Per operation diagnostics ------------------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the diagnostics described in raptor/Diagnostics.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_DUMP=1              dump the inputs and results of emulated
+//                                   operations
+//   RAPTOR_FPRT_TRACE_PRINT=1       print every operation of the trace runtime
+//   RAPTOR_FPRT_DIAG_SITES=<locs>   only show the operations at these comma
+//                                   separated locations, file:line or
+//                                   file:line:col, the file may be given
+//                                   without its directories
+//   RAPTOR_FPRT_DIAG_EVERY=<n>      of those, only show every nth operation of
+//                                   a thread (default 1)
+//   RAPTOR_FPRT_DIAG_OUTPUT=<path>  where the diagnostics are written (default
+//                                   stderr), a `%p` in the path is replaced by
+//                                   the process id
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "raptor/Diagnostics.h"
+
+#define RAPTOR_DIAG_BUFFER_SIZE (64 * 1024)
+
+std::string __raptor_fprt_expand_path(const char *path);
+
+typedef struct __raptor_diag_config {
+  std::vector<std::string> sites; // Empty for all.
+  unsigned long every;
+  unsigned generation;
+} __raptor_diag_config;
+
+typedef struct __raptor_diag_thread {
+  std::mutex mutex; // Against flushes from other threads.
+  char buffer[RAPTOR_DIAG_BUFFER_SIZE];
+  size_t size = 0;
+  // The site filter decisions of the configuration `generation`.
+  std::unordered_map<const char *, bool> sites;
+  unsigned generation = 0;
+  unsigned long count = 0; // Operations which passed the site filter.
+  bool in_dump = false;    // Between the first input and the result.
+  bool dump_selected = false;
+  struct __raptor_diag_thread *next;
+} __raptor_diag_thread;
+
+std::atomic<unsigned> __raptor_fprt_diag_flags = 0;
+// Replaced configurations are never freed, threads may still read them.
+static std::atomic<__raptor_diag_config *> diag_config = nullptr;
+static std::atomic<unsigned> diag_generation = 0;
+static int diag_fd = STDERR_FILENO;
+
+static std::mutex diag_threads_mutex;
+// Never freed so that the buffers of threads which exited can be flushed.
+static __raptor_diag_thread *diag_threads = nullptr;
+
+static void write_all(const char *data, size_t size) {
+  while (size) {
+    ssize_t n = write(diag_fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    data += n;
+    size -= n;
+  }
+}
+
+static void flush_locked(__raptor_diag_thread *thread) {
+  write_all(thread->buffer, thread->size);
+  thread->size = 0;
+}
+
+// Flushes the buffer of its thread when the thread exits.
+static thread_local struct DiagThread {
+  __raptor_diag_thread *thread = nullptr;
+  ~DiagThread() {
+    if (thread) {
+      std::lock_guard<std::mutex> lock(thread->mutex);
+      flush_locked(thread);
+    }
+  }
+} tls_diag;
+
+static __raptor_diag_thread *get_diag_thread() {
+  if (__raptor_diag_thread *thread = tls_diag.thread)
+    return thread;
+  __raptor_diag_thread *thread = new __raptor_diag_thread();
+  std::lock_guard<std::mutex> lock(diag_threads_mutex);
+  thread->next = diag_threads;
+  diag_threads = thread;
+  tls_diag.thread = thread;
+  return thread;
+}
+
+// `site` matches a location which is the same or has more directories or a
+// column.
+static bool site_matches(const std::string &site, const char *loc) {
+  for (const char *found = strstr(loc, site.c_str()); found;
+       found = strstr(found + 1, site.c_str())) {
+    char after = found[site.size()];
+    if ((found == loc || found[-1] == '/') && (after == '\0' || after == ':'))
+      return true;
+  }
+  return false;
+}
+
+bool __raptor_fprt_diag_select(const char *loc) {
+  const __raptor_diag_config *config =
+      diag_config.load(std::memory_order_acquire);
+  if (!config)
+    return false;
+  __raptor_diag_thread *thread = get_diag_thread();
+  if (thread->generation != config->generation) {
+    thread->sites.clear();
+    thread->generation = config->generation;
+    thread->count = 0;
+  }
+  if (!config->sites.empty()) {
+    auto [it, inserted] = thread->sites.try_emplace(loc, false);
+    if (inserted)
+      it->second = std::any_of(
+          config->sites.begin(), config->sites.end(),
+          [&](const std::string &site) {
+            return site_matches(site, loc ? loc : "unknown");
+          });
+    if (!it->second)
+      return false;
+  }
+  return thread->count++ % config->every == 0;
+}
+
+bool __raptor_fprt_diag_select_dump(const char *loc, bool result) {
+  __raptor_diag_thread *thread = get_diag_thread();
+  if (!thread->in_dump)
+    thread->dump_selected = __raptor_fprt_diag_select(loc);
+  thread->in_dump = !result;
+  return thread->dump_selected;
+}
+
+void __raptor_fprt_diag_write(const char *data, size_t size) {
+  __raptor_diag_thread *thread = get_diag_thread();
+  std::lock_guard<std::mutex> lock(thread->mutex);
+  if (thread->size + size > RAPTOR_DIAG_BUFFER_SIZE)
+    flush_locked(thread);
+  if (size > RAPTOR_DIAG_BUFFER_SIZE) {
+    write_all(data, size);
+    return;
+  }
+  memcpy(thread->buffer + thread->size, data, size);
+  thread->size += size;
+}
+
+void __raptor_fprt_diag_printf(const char *fmt, ...) {
+  char line[1024];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (n > 0)
+    __raptor_fprt_diag_write(line, std::min<size_t>(n, sizeof(line) - 1));
+}
+
+extern "C" void raptor_fprt_flush_diagnostics() {
+  std::lock_guard<std::mutex> lock(diag_threads_mutex);
+  for (__raptor_diag_thread *thread = diag_threads; thread;
+       thread = thread->next) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    flush_locked(thread);
+  }
+}
+
+extern "C" void raptor_fprt_set_diagnostics(unsigned flags, const char *sites,
+                                            unsigned long every) {
+  static std::once_flag flush_at_exit;
+  std::call_once(flush_at_exit, [] { atexit(raptor_fprt_flush_diagnostics); });
+
+  __raptor_diag_config *config = new __raptor_diag_config();
+  for (const char *s = sites; s && *s;) {
+    const char *end = strchr(s, ',');
+    if (!end)
+      end = s + strlen(s);
+    std::string site(s, end);
+    site.erase(0, site.find_first_not_of(' '));
+    site.erase(site.find_last_not_of(' ') + 1);
+    if (!site.empty())
+      config->sites.push_back(site);
+    s = *end ? end + 1 : end;
+  }
+  config->every = every ? every : 1;
+  config->generation = ++diag_generation;
+  diag_config.store(config, std::memory_order_release);
+  __raptor_fprt_diag_flags.store(flags, std::memory_order_release);
+}
+
+static bool env_enabled(const char *name) {
+  const char *value = getenv(name);
+  return value && *value && strcmp(value, "0");
+}
+
+static struct DiagnosticsConfig {
+  DiagnosticsConfig() {
+    unsigned flags = 0;
+    if (env_enabled("RAPTOR_FPRT_DUMP"))
+      flags |= RAPTOR_FPRT_DIAG_DUMP;
+    if (env_enabled("RAPTOR_FPRT_TRACE_PRINT"))
+      flags |= RAPTOR_FPRT_DIAG_TRACE;
+    if (!flags)
+      return;
+    if (const char *path = getenv("RAPTOR_FPRT_DIAG_OUTPUT")) {
+      std::string expanded = __raptor_fprt_expand_path(path);
+      int fd = open(expanded.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+        fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+                strerror(errno));
+      else
+        diag_fd = fd;
+    }
+    const char *every = getenv("RAPTOR_FPRT_DIAG_EVERY");
+    raptor_fprt_set_diagnostics(flags, getenv("RAPTOR_FPRT_DIAG_SITES"),
+                                every ? strtoul(every, nullptr, 10) : 1);
+  }
+} diagnostics_config;
@@ -0,0 +1,134 @@
+//===- Dump.cpp - Binary dump of per-site operation statistics ------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file writes the per-site statistics in the format described in
+// raptor/Dump.h. The whole file is assembled in memory and written with a
+// single write so that dumping stays cheap even for a large number of sites.
+//
+// Set RAPTOR_FPRT_OP_DUMP=<path> to dump at exit, a `%p` in the path is
+// replaced by the process id.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Dump.h"
+#include "raptor/Sites.h"
+
+static_assert(RAPTOR_DUMP_CANCEL_BUCKETS == RAPTOR_FPRT_CANCEL_BUCKETS,
+              "dump and runtime cancellation histograms differ");
+
+static uint64_t add_string(std::vector<char> &strings,
+                           std::map<const char *, uint64_t> &offsets,
+                           const char *str) {
+  if (!str)
+    return RAPTOR_DUMP_NO_STRING;
+  auto found = offsets.find(str);
+  if (found != offsets.end())
+    return found->second;
+  uint64_t offset = strings.size();
+  strings.insert(strings.end(), str, str + strlen(str) + 1);
+  offsets[str] = offset;
+  return offset;
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+int raptor_fprt_op_dump_binary(const char *path) {
+  std::map<const char *, __raptor_op> merged = __raptor_fprt_op_collect();
+  std::map<const char *, __raptor_cancel> cancels;
+  __raptor_fprt_cancel_collect(cancels);
+
+  std::vector<char> strings;
+  std::map<const char *, uint64_t> offsets;
+  std::vector<raptor_dump_record> records;
+  std::vector<raptor_dump_cancel> histograms;
+  records.reserve(merged.size());
+  for (auto &it : merged) {
+    const __raptor_op &op = it.second;
+    raptor_dump_record record;
+    record.loc = add_string(strings, offsets, it.first);
+    record.op = add_string(strings, offsets, op.op);
+    record.l1_err = op.l1_err;
+    record.rel_err = op.rel_err;
+    record.max_rel_err = op.max_rel_err;
+    record.count = op.count;
+    record.count_thresh = op.count_thresh;
+    record.count_ignore = op.count_ignore;
+    record.count_flip = op.count_flip;
+    auto cancel = cancels.find(it.first);
+    if (cancel != cancels.end()) {
+      raptor_dump_cancel histogram;
+      histogram.record = records.size();
+      for (int i = 0; i < RAPTOR_DUMP_CANCEL_BUCKETS; i++)
+        histogram.bits[i] = cancel->second.bits[i];
+      histograms.push_back(histogram);
+    }
+    records.push_back(record);
+  }
+
+  raptor_dump_header header;
+  memcpy(header.magic, RAPTOR_DUMP_MAGIC, sizeof(header.magic));
+  header.version = RAPTOR_DUMP_VERSION;
+  header.record_size = sizeof(raptor_dump_record);
+  header.num_records = records.size();
+  header.num_cancel = histograms.size();
+  header.cancel_offset =
+      sizeof(header) + records.size() * sizeof(raptor_dump_record);
+  header.strings_offset =
+      header.cancel_offset + histograms.size() * sizeof(raptor_dump_cancel);
+  header.strings_size = strings.size();
+
+  std::vector<char> buffer(header.strings_offset + header.strings_size);
+  memcpy(buffer.data(), &header, sizeof(header));
+  memcpy(buffer.data() + sizeof(header), records.data(),
+         records.size() * sizeof(raptor_dump_record));
+  memcpy(buffer.data() + header.cancel_offset, histograms.data(),
+         histograms.size() * sizeof(raptor_dump_cancel));
+  memcpy(buffer.data() + header.strings_offset, strings.data(),
+         strings.size());
+
+  std::string expanded = __raptor_fprt_expand_path(path);
+  int fd = open(expanded.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  const char *data = buffer.data();
+  size_t left = buffer.size();
+  while (left) {
+    ssize_t written = write(fd, data, left);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "raptor: could not write %s: %s\n", expanded.c_str(),
+              strerror(errno));
+      close(fd);
+      return -1;
+    }
+    data += written;
+    left -= written;
+  }
+  return close(fd);
+}
+
+void __raptor_fprt_op_dump_at_exit() {
+  if (const char *path = getenv("RAPTOR_FPRT_OP_DUMP"))
+    raptor_fprt_op_dump_binary(path);
+}
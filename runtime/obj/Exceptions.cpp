@@ -0,0 +1,234 @@
+//===- Exceptions.cpp - Origins of exceptional emulated results -----------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file records where emulated operations first produced a NaN, an Inf, an
+// overflow or an underflow to zero, see raptor/Exceptions.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_EXCEPTION_LOG=<num>    number of distinct sites recorded per
+//                                      thread, at most 1000000 (default 16)
+//   RAPTOR_FPRT_EXCEPTION_TRAP=<kinds> comma separated list of nan, inf,
+//                                      overflow, underflow or all; print the
+//                                      exception and abort when one occurs
+//
+// A report is printed to stderr at exit if any exception was raised.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "raptor/Common.h"
+#include "raptor/Exceptions.h"
+
+#define RAPTOR_FPRT_EXCEPTION_LOG_DEFAULT 16
+
+enum __raptor_exception_kind {
+  RAPTOR_EXCEPTION_NAN,
+  RAPTOR_EXCEPTION_INF,
+  RAPTOR_EXCEPTION_OVERFLOW,
+  RAPTOR_EXCEPTION_UNDERFLOW,
+  RAPTOR_EXCEPTION_KINDS,
+};
+
+static const char *exception_names[RAPTOR_EXCEPTION_KINDS] = {
+    "nan", "inf", "overflow", "underflow"};
+
+typedef struct __raptor_exception_event {
+  int kind;
+  const char *loc;
+  const char *op;
+  unsigned num_operands;
+  double operands[MAX_MPFR_OPERANDS];
+  double result;
+  long long count; // Occurrences at this site in this thread.
+} __raptor_exception_event;
+
+typedef struct __raptor_exception_log {
+  long long count[RAPTOR_EXCEPTION_KINDS];
+  unsigned thread;
+  unsigned num_events;
+  __raptor_exception_event *events;
+  struct __raptor_exception_log *next;
+} __raptor_exception_log;
+
+static unsigned log_capacity = RAPTOR_FPRT_EXCEPTION_LOG_DEFAULT;
+static unsigned trap_mask = 0;
+
+static std::mutex exception_logs_mutex;
+static __raptor_exception_log *exception_logs = nullptr;
+static unsigned num_exception_logs = 0;
+static thread_local __raptor_exception_log *tls_exception_log = nullptr;
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_exception_dump_status();
+
+static bool any_exception() {
+  std::lock_guard<std::mutex> lock(exception_logs_mutex);
+  for (__raptor_exception_log *log = exception_logs; log; log = log->next)
+    for (int kind = 0; kind < RAPTOR_EXCEPTION_KINDS; kind++)
+      if (log->count[kind])
+        return true;
+  return false;
+}
+
+static void exception_dump_at_exit() {
+  if (any_exception())
+    raptor_fprt_exception_dump_status();
+}
+
+static unsigned parse_trap_mask(const char *kinds) {
+  unsigned mask = 0;
+  while (*kinds) {
+    size_t len = strcspn(kinds, ",");
+    if (len == 3 && !strncmp(kinds, "all", len))
+      mask = (1u << RAPTOR_EXCEPTION_KINDS) - 1;
+    for (int kind = 0; kind < RAPTOR_EXCEPTION_KINDS; kind++)
+      if (strlen(exception_names[kind]) == len &&
+          !strncmp(kinds, exception_names[kind], len))
+        mask |= 1u << kind;
+    kinds += len;
+    if (*kinds == ',')
+      ++kinds;
+  }
+  return mask;
+}
+
+static struct ExceptionConfig {
+  ExceptionConfig() {
+    if (const char *num = getenv("RAPTOR_FPRT_EXCEPTION_LOG")) {
+      long capacity = atol(num);
+      if (capacity < 0 || capacity > 1000000)
+        fprintf(stderr, "raptor: invalid RAPTOR_FPRT_EXCEPTION_LOG\n");
+      else
+        log_capacity = capacity;
+    }
+    if (const char *kinds = getenv("RAPTOR_FPRT_EXCEPTION_TRAP"))
+      trap_mask = parse_trap_mask(kinds);
+    atexit(exception_dump_at_exit);
+  }
+} exception_config;
+
+static __raptor_exception_log *get_exception_log() {
+  if (__raptor_exception_log *log = tls_exception_log)
+    return log;
+  // Logs are never freed so that exceptions of threads which already exited
+  // are still part of the report.
+  __raptor_exception_log *log =
+      (__raptor_exception_log *)calloc(1, sizeof(*log));
+  if (!log)
+    exit(__RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS);
+  if (log_capacity) {
+    log->events = (__raptor_exception_event *)calloc(log_capacity,
+                                                     sizeof(log->events[0]));
+    if (!log->events)
+      exit(__RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS);
+  }
+  std::lock_guard<std::mutex> lock(exception_logs_mutex);
+  log->thread = num_exception_logs++;
+  log->next = exception_logs;
+  exception_logs = log;
+  tls_exception_log = log;
+  return log;
+}
+
+static void print_event(const __raptor_exception_event &event) {
+  fprintf(stderr, "%s: %s in %s(", event.loc ? event.loc : "unknown",
+          exception_names[event.kind], event.op);
+  for (unsigned i = 0; i < event.num_operands; i++)
+    fprintf(stderr, i ? ", %.17g" : "%.17g", event.operands[i]);
+  fprintf(stderr, ") = %.17g", event.result);
+}
+
+void __raptor_fprt_exception(const char *loc, const char *op, mpfr_t res,
+                             const double *operands, unsigned num_operands) {
+  bool any_nan = false, any_inf = false;
+  for (unsigned i = 0; i < num_operands; i++) {
+    any_nan |= std::isnan(operands[i]);
+    any_inf |= std::isinf(operands[i]);
+  }
+
+  int kind;
+  if (mpfr_overflow_p())
+    kind = RAPTOR_EXCEPTION_OVERFLOW;
+  else if (mpfr_underflow_p())
+    kind = RAPTOR_EXCEPTION_UNDERFLOW;
+  else if (mpfr_nan_p(res) && !any_nan)
+    kind = RAPTOR_EXCEPTION_NAN;
+  else if (mpfr_inf_p(res) && !any_nan && !any_inf)
+    kind = RAPTOR_EXCEPTION_INF;
+  else
+    kind = RAPTOR_EXCEPTION_KINDS; // Propagated from the operands.
+  mpfr_clear_overflow();
+  mpfr_clear_underflow();
+  if (kind == RAPTOR_EXCEPTION_KINDS)
+    return;
+
+  __raptor_exception_event event;
+  event.kind = kind;
+  event.loc = loc;
+  event.op = op;
+  event.num_operands = std::min<unsigned>(num_operands, MAX_MPFR_OPERANDS);
+  for (unsigned i = 0; i < event.num_operands; i++)
+    event.operands[i] = operands[i];
+  event.result = mpfr_get_d(res, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);
+  event.count = 1;
+
+  if (trap_mask & (1u << kind)) {
+    fprintf(stderr, "raptor: trapping on ");
+    print_event(event);
+    fprintf(stderr, "\n");
+    abort();
+  }
+
+  __raptor_exception_log *log = get_exception_log();
+  ++log->count[kind];
+  for (unsigned i = 0; i < log->num_events; i++) {
+    if (log->events[i].loc == loc && log->events[i].kind == kind) {
+      ++log->events[i].count;
+      return;
+    }
+  }
+  if (log->num_events < log_capacity)
+    log->events[log->num_events++] = event;
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_exception_dump_status() {
+  std::lock_guard<std::mutex> lock(exception_logs_mutex);
+  long long total[RAPTOR_EXCEPTION_KINDS] = {};
+  for (__raptor_exception_log *log = exception_logs; log; log = log->next)
+    for (int kind = 0; kind < RAPTOR_EXCEPTION_KINDS; kind++)
+      total[kind] += log->count[kind];
+  fprintf(stderr, "Floating point exceptions of emulated operations:");
+  for (int kind = 0; kind < RAPTOR_EXCEPTION_KINDS; kind++)
+    fprintf(stderr, " %s: %lld", exception_names[kind], total[kind]);
+  fprintf(stderr, "\n");
+  for (__raptor_exception_log *log = exception_logs; log; log = log->next) {
+    for (unsigned i = 0; i < log->num_events; i++) {
+      fprintf(stderr, "  thread %u: ", log->thread);
+      print_event(log->events[i]);
+      fprintf(stderr, " (%lldx)\n", log->events[i].count);
+    }
+  }
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_exception_clear() {
+  std::lock_guard<std::mutex> lock(exception_logs_mutex);
+  for (__raptor_exception_log *log = exception_logs; log; log = log->next) {
+    memset(log->count, 0, sizeof(log->count));
+    log->num_events = 0;
+  }
+}
@@ -37,7 +37,9 @@
 #include <stdlib.h>
 
 #define RAPTOR_FPRT_ENABLE_GARBAGE_COLLECTION
+#ifndef RAPTOR_FPRT_ENABLE_SHADOW_RESIDUALS
 #define RAPTOR_FPRT_ENABLE_SHADOW_RESIDUALS
+#endif
 
 #include <raptor/Common.h>
 #include <raptor/raptor.h>
@@ -73,6 +75,7 @@ struct {
     __raptor_fp *a = &__raptor_mpfr_fps.all.back().fp;                         \
     mpfr_init2(a->result, significand + 1); /* see MPFR_FP_EMULATION */        \
     mpfr_set_d(a->result, _a, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);            \
+    __raptor_fprt_mem_range(a->result, exponent, significand);                 \
     a->excl_result = _a;                                                       \
     a->shadow = _a;                                                            \
     return __raptor_fprt_ptr_to_##FROM_TY(a);                                  \
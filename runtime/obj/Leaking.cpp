@@ -1,52 +1,111 @@
+//===- Leaking.cpp - Memory mode values without garbage collection --------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file allocates the values of memory mode individually and frees them
+// when the program deletes them. Unlike obj/GarbageCollection.cpp it keeps no
+// list of the live values, so the raptor_fprt_gc_* functions do nothing and a
+// value the program never deletes leaks. It is the allocator of the op mode
+// runtimes, which do not allocate at all, and of the leaking memory mode
+// runtime.
+//
+//===----------------------------------------------------------------------===//
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <mpfr.h>
+#include <stdint.h>
+
 #include "raptor/Common.h"
+#include "raptor/raptor.h"
 
-__RAPTOR_MPFR_ATTRIBUTES
-double __raptor_fprt_ieee_64_get(double _a, int64_t exponent,
-                                 int64_t significand, int64_t mode,
-                                 const char *loc, mpfr_t *scratch) {
-  __raptor_fp *a = __raptor_fprt_ieee_64_to_ptr(_a);
-  return mpfr_get_d(a->result, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);
-}
+bool excl_trunc = false;
 
-__RAPTOR_MPFR_ATTRIBUTES
-double __raptor_fprt_ieee_64_new(double _a, int64_t exponent,
-                                 int64_t significand, int64_t mode,
-                                 const char *loc, mpfr_t *scratch) {
+static std::atomic<long long> num_allocated = 0;
+
+static __raptor_fp *allocate(int64_t significand) {
   __raptor_fp *a = (__raptor_fp *)malloc(sizeof(__raptor_fp));
   if (!a)
     exit(__RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS);
   mpfr_init2(a->result, significand + 1); /* see MPFR_FP_EMULATION */
-  mpfr_set_d(a->result, _a, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);
-  a->excl_result = _a;
-  a->shadow = _a;
-  return __raptor_fprt_ptr_to_double(a);
+  num_allocated.fetch_add(1, std::memory_order_relaxed);
+  return a;
 }
 
+#define RAPTOR_FLOAT_TYPE(CPP_TY, FROM_TY)                                     \
+  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  CPP_TY __raptor_fprt_##FROM_TY##_get(CPP_TY _a, int64_t exponent,            \
+                                       int64_t significand, int64_t mode,      \
+                                       const char *loc, void *scratch) {       \
+    __raptor_fp *a = __raptor_fprt_##FROM_TY##_to_ptr(_a);                     \
+    return mpfr_get_d(a->result, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);         \
+  }                                                                            \
+                                                                               \
+  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  CPP_TY __raptor_fprt_##FROM_TY##_new(CPP_TY _a, int64_t exponent,            \
+                                       int64_t significand, int64_t mode,      \
+                                       const char *loc, void *scratch) {       \
+    __raptor_fp *a = allocate(significand);                                    \
+    mpfr_set_d(a->result, _a, __RAPTOR_MPFR_DEFAULT_ROUNDING_MODE);            \
+    __raptor_fprt_mem_range(a->result, exponent, significand);                 \
+    a->excl_result = _a;                                                       \
+    a->shadow = _a;                                                            \
+    return __raptor_fprt_ptr_to_##FROM_TY(a);                                  \
+  }                                                                            \
+                                                                               \
+  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  CPP_TY __raptor_fprt_##FROM_TY##_const(CPP_TY _a, int64_t exponent,          \
+                                         int64_t significand, int64_t mode,    \
+                                         const char *loc, void *scratch) {     \
+    /* TODO This should really be called only once for an appearance in the    \
+     * code, currently it is called every time a flop uses a constant. */      \
+    return __raptor_fprt_##FROM_TY##_new(_a, exponent, significand, mode, loc, \
+                                         scratch);                             \
+  }                                                                            \
+                                                                               \
+  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  __raptor_fp *__raptor_fprt_##FROM_TY##_new_intermediate(                     \
+      int64_t exponent, int64_t significand, int64_t mode, const char *loc,    \
+      void *scratch) {                                                         \
+    return allocate(significand);                                              \
+  }                                                                            \
+                                                                               \
+  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  void __raptor_fprt_##FROM_TY##_delete(CPP_TY a, int64_t exponent,            \
+                                        int64_t significand, int64_t mode,     \
+                                        const char *loc, void *scratch) {      \
+    __raptor_fp *fp = __raptor_fprt_##FROM_TY##_to_ptr(a);                     \
+    mpfr_clear(fp->result);                                                    \
+    free(fp);                                                                  \
+    num_allocated.fetch_sub(1, std::memory_order_relaxed);                     \
+  }
+#include "raptor/FloatTypes.def"
+#undef RAPTOR_FLOAT_TYPE
+
 __RAPTOR_MPFR_ATTRIBUTES
-double __raptor_fprt_ieee_64_const(double _a, int64_t exponent,
-                                   int64_t significand, int64_t mode,
-                                   const char *loc, mpfr_t *scratch) {
-  // TODO This should really be called only once for an appearance in the code,
-  // currently it is called every time a flop uses a constant.
-  return __raptor_fprt_ieee_64_new(_a, exponent, significand, mode, loc,
-                                   scratch);
+void raptor_fprt_gc_dump_status() {
+  std::cerr << "Currently " << num_allocated << " floats allocated."
+            << std::endl;
 }
 
 __RAPTOR_MPFR_ATTRIBUTES
-__raptor_fp *__raptor_fprt_ieee_64_new_intermediate(int64_t exponent,
-                                                    int64_t significand,
-                                                    int64_t mode,
-                                                    const char *loc) {
-  __raptor_fp *a = (__raptor_fp *)malloc(sizeof(__raptor_fp));
-  if (!a)
-    exit(__RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS);
-  mpfr_init2(a->result, significand + 1); /* see MPFR_FP_EMULATION */
-  return a;
-}
+void raptor_fprt_gc_clear_seen() {}
 
 __RAPTOR_MPFR_ATTRIBUTES
-void __raptor_fprt_ieee_64_delete(double a, int64_t exponent,
-                                  int64_t significand, int64_t mode,
-                                  const char *loc, mpfr_t *scratch) {
-  free(__raptor_fprt_ieee_64_to_ptr(a));
-}
+double raptor_fprt_gc_mark_seen(double a) { return a; }
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_gc_doit() {}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_excl_trunc_start() { excl_trunc = true; }
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_excl_trunc_end() { excl_trunc = false; }
@@ -0,0 +1,329 @@
+//===- Mpi.cpp - Cross-rank aggregation of operation statistics -----------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file merges the per-site statistics of all ranks of an MPI job and
+// prints a single report from rank 0. It is built as a separate library which
+// is only available if MPI was found.
+//
+// Sites are identified across ranks by a 64 bit hash of their location string,
+// so only fixed size records travel through the reduction tree. Location and
+// operation names are only fetched for the sites which end up in the report,
+// from the lowest rank which knows them.
+//
+// Set RAPTOR_FPRT_MPI_REPORT=<num> to print the report of the top <num> sites
+// from MPI_Finalize.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mpi.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Sites.h"
+
+#define RAPTOR_FPRT_MPI_TAG_RECORDS 0x5250
+#define RAPTOR_FPRT_MPI_TAG_NAMES 0x5251
+#define RAPTOR_FPRT_MPI_TAG_CANCEL 0x5252
+
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_op_dump_status(unsigned num);
+
+namespace {
+
+// The reduction sends these as raw bytes, which assumes all ranks share the
+// same data representation.
+struct SiteRecord {
+  uint64_t id;
+  double l1_err;
+  double rel_err;
+  double max_rel_err;
+  int64_t count;
+  int64_t count_thresh;
+  int64_t count_ignore;
+  int64_t count_flip;
+};
+
+// Cancellation histograms are only recorded by some runtimes and only for
+// additions and subtractions, so they travel separately.
+struct CancelRecord {
+  uint64_t id;
+  int64_t bits[RAPTOR_FPRT_CANCEL_BUCKETS];
+};
+
+struct SiteNames {
+  const char *loc;
+  const char *op;
+};
+
+uint64_t hash_loc(const char *loc) {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char *c = loc; *c; ++c) {
+    h ^= (unsigned char)*c;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+void merge(SiteRecord &into, const SiteRecord &from) {
+  into.l1_err += from.l1_err;
+  into.rel_err += from.rel_err;
+  into.max_rel_err = std::max(into.max_rel_err, from.max_rel_err);
+  into.count += from.count;
+  into.count_thresh += from.count_thresh;
+  into.count_ignore += from.count_ignore;
+  into.count_flip += from.count_flip;
+}
+
+void merge(CancelRecord &into, const CancelRecord &from) {
+  for (int i = 0; i < RAPTOR_FPRT_CANCEL_BUCKETS; i++)
+    into.bits[i] += from.bits[i];
+}
+
+// Merges two lists of records sorted by id.
+template <typename Record>
+std::vector<Record> merge_sorted(const std::vector<Record> &a,
+                                 const std::vector<Record> &b) {
+  std::vector<Record> out;
+  out.reserve(a.size() + b.size());
+  size_t i = 0, j = 0;
+  while (i < a.size() || j < b.size()) {
+    if (j == b.size() || (i < a.size() && a[i].id < b[j].id)) {
+      out.push_back(a[i++]);
+    } else if (i == a.size() || b[j].id < a[i].id) {
+      out.push_back(b[j++]);
+    } else {
+      out.push_back(a[i++]);
+      merge(out.back(), b[j++]);
+    }
+  }
+  return out;
+}
+
+// Sorts the records by id and merges the ones with the same id. Without LTO
+// the same location can have multiple uniqued strings.
+template <typename Record> void sort_and_merge(std::vector<Record> &records) {
+  std::sort(records.begin(), records.end(),
+            [](const Record &a, const Record &b) { return a.id < b.id; });
+  size_t out = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    if (out && records[out - 1].id == records[i].id)
+      merge(records[out - 1], records[i]);
+    else
+      records[out++] = records[i];
+  }
+  records.resize(out);
+}
+
+void collect_local(std::vector<SiteRecord> &records,
+                   std::vector<CancelRecord> &cancels,
+                   std::unordered_map<uint64_t, SiteNames> &names) {
+  std::map<const char *, __raptor_op> local = __raptor_fprt_op_collect();
+  records.reserve(local.size());
+  for (auto &it : local) {
+    const __raptor_op &op = it.second;
+    SiteRecord record;
+    record.id = hash_loc(it.first);
+    record.l1_err = op.l1_err;
+    record.rel_err = op.rel_err;
+    record.max_rel_err = op.max_rel_err;
+    record.count = op.count;
+    record.count_thresh = op.count_thresh;
+    record.count_ignore = op.count_ignore;
+    record.count_flip = op.count_flip;
+    records.push_back(record);
+    names.emplace(record.id, SiteNames{it.first, op.op ? op.op : ""});
+  }
+  sort_and_merge(records);
+
+  std::map<const char *, __raptor_cancel> local_cancels;
+  __raptor_fprt_cancel_collect(local_cancels);
+  cancels.reserve(local_cancels.size());
+  for (auto &it : local_cancels) {
+    CancelRecord cancel;
+    cancel.id = hash_loc(it.first);
+    for (int i = 0; i < RAPTOR_FPRT_CANCEL_BUCKETS; i++)
+      cancel.bits[i] = it.second.bits[i];
+    cancels.push_back(cancel);
+  }
+  sort_and_merge(cancels);
+}
+
+// Binomial tree reduction of the sorted record lists towards rank 0.
+template <typename Record>
+void reduce_records(std::vector<Record> &records, int rank, int size, int tag,
+                    MPI_Comm comm) {
+  for (int mask = 1; mask < size; mask <<= 1) {
+    if (rank & mask) {
+      MPI_Send(records.data(), records.size() * sizeof(Record), MPI_BYTE,
+               rank - mask, tag, comm);
+      return;
+    }
+    if (rank + mask < size) {
+      MPI_Status status;
+      int bytes;
+      MPI_Probe(rank + mask, tag, comm, &status);
+      MPI_Get_count(&status, MPI_BYTE, &bytes);
+      std::vector<Record> received(bytes / sizeof(Record));
+      MPI_Recv(received.data(), bytes, MPI_BYTE, rank + mask, tag, comm,
+               MPI_STATUS_IGNORE);
+      records = merge_sorted(records, received);
+    }
+  }
+}
+
+// Fetches the names of `ids` from the lowest rank that knows them. Only rank 0
+// receives the names.
+void fetch_names(std::vector<uint64_t> &ids,
+                 const std::unordered_map<uint64_t, SiteNames> &names,
+                 std::vector<std::pair<std::string, std::string>> &fetched,
+                 int rank, int size, MPI_Comm comm) {
+  int num = ids.size();
+  MPI_Bcast(&num, 1, MPI_INT, 0, comm);
+  ids.resize(num);
+  MPI_Bcast(ids.data(), num, MPI_UINT64_T, 0, comm);
+
+  std::vector<int> owner(num);
+  for (int i = 0; i < num; i++)
+    owner[i] = names.count(ids[i]) ? rank : INT_MAX;
+  MPI_Allreduce(MPI_IN_PLACE, owner.data(), num, MPI_INT, MPI_MIN, comm);
+
+  if (rank != 0) {
+    std::vector<char> packed;
+    for (int i = 0; i < num; i++) {
+      if (owner[i] != rank)
+        continue;
+      const SiteNames &n = names.at(ids[i]);
+      packed.insert(packed.end(), n.loc, n.loc + strlen(n.loc) + 1);
+      packed.insert(packed.end(), n.op, n.op + strlen(n.op) + 1);
+    }
+    if (!packed.empty())
+      MPI_Send(packed.data(), packed.size(), MPI_CHAR, 0,
+               RAPTOR_FPRT_MPI_TAG_NAMES, comm);
+    return;
+  }
+
+  fetched.assign(num, {"unknown", ""});
+  for (int i = 0; i < num; i++) {
+    if (owner[i] == 0) {
+      const SiteNames &n = names.at(ids[i]);
+      fetched[i] = {n.loc, n.op};
+    }
+  }
+  std::vector<int> senders(owner.begin(), owner.end());
+  std::sort(senders.begin(), senders.end());
+  senders.erase(std::unique(senders.begin(), senders.end()), senders.end());
+  for (int sender : senders) {
+    if (sender == 0 || sender == INT_MAX)
+      continue;
+    MPI_Status status;
+    int bytes;
+    MPI_Probe(sender, RAPTOR_FPRT_MPI_TAG_NAMES, comm, &status);
+    MPI_Get_count(&status, MPI_CHAR, &bytes);
+    std::vector<char> packed(bytes);
+    MPI_Recv(packed.data(), bytes, MPI_CHAR, sender, RAPTOR_FPRT_MPI_TAG_NAMES,
+             comm, MPI_STATUS_IGNORE);
+    const char *c = packed.data();
+    for (int i = 0; i < num; i++) {
+      if (owner[i] != sender)
+        continue;
+      fetched[i].first = c;
+      c += fetched[i].first.size() + 1;
+      fetched[i].second = c;
+      c += fetched[i].second.size() + 1;
+    }
+  }
+}
+
+} // namespace
+
+// Collective over MPI_COMM_WORLD, rank 0 prints the report of the top `num`
+// sites of all ranks.
+__RAPTOR_MPFR_ATTRIBUTES
+void raptor_fprt_op_dump_status_mpi(unsigned num) {
+  int initialized, finalized;
+  MPI_Initialized(&initialized);
+  MPI_Finalized(&finalized);
+  if (!initialized || finalized) {
+    raptor_fprt_op_dump_status(num);
+    return;
+  }
+
+  // Use our own communicator so that we never match messages of the user.
+  MPI_Comm comm;
+  MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  std::vector<SiteRecord> records;
+  std::vector<CancelRecord> cancels;
+  std::unordered_map<uint64_t, SiteNames> names;
+  collect_local(records, cancels, names);
+  reduce_records(records, rank, size, RAPTOR_FPRT_MPI_TAG_RECORDS, comm);
+  reduce_records(cancels, rank, size, RAPTOR_FPRT_MPI_TAG_CANCEL, comm);
+
+  std::vector<uint64_t> ids;
+  if (rank == 0) {
+    num = std::min<size_t>(num, records.size());
+    std::partial_sort(records.begin(), records.begin() + num, records.end(),
+                      [](const SiteRecord &a, const SiteRecord &b) {
+                        return a.count_thresh > b.count_thresh;
+                      });
+    for (unsigned i = 0; i < num; i++)
+      ids.push_back(records[i].id);
+  }
+  std::vector<std::pair<std::string, std::string>> fetched;
+  fetch_names(ids, names, fetched, rank, size, comm);
+
+  if (rank == 0) {
+    std::cerr << "Information about top " << num << " of " << records.size()
+              << " operations across " << size << " ranks." << std::endl;
+    for (unsigned i = 0; i < num; i++) {
+      const SiteRecord &record = records[i];
+      __raptor_op op;
+      op.op = fetched[i].second.c_str();
+      op.l1_err = record.l1_err;
+      op.count_thresh = record.count_thresh;
+      op.count = record.count;
+      op.count_ignore = record.count_ignore;
+      op.rel_err = record.rel_err;
+      op.max_rel_err = record.max_rel_err;
+      op.count_flip = record.count_flip;
+      auto cancel = std::lower_bound(
+          cancels.begin(), cancels.end(), record.id,
+          [](const CancelRecord &c, uint64_t id) { return c.id < id; });
+      __raptor_cancel bits;
+      bool has_cancel = cancel != cancels.end() && cancel->id == record.id;
+      if (has_cancel)
+        for (int b = 0; b < RAPTOR_FPRT_CANCEL_BUCKETS; b++)
+          bits.bits[b] = cancel->bits[b];
+      __raptor_fprt_op_print(fetched[i].first.c_str(), op,
+                             has_cancel ? &bits : nullptr);
+    }
+  }
+  MPI_Comm_free(&comm);
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+int MPI_Finalize() {
+  if (const char *num = getenv("RAPTOR_FPRT_MPI_REPORT"))
+    raptor_fprt_op_dump_status_mpi(atoi(num));
+  return PMPI_Finalize();
+}
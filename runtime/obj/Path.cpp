@@ -0,0 +1,31 @@
+//===- Path.cpp - Paths of the output files of the runtime ----------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file expands the paths of the files the runtime writes. It does not
+// depend on MPFR so that every runtime variant, including the trace runtime,
+// can link it.
+//
+//===----------------------------------------------------------------------===//
+
+#include <string>
+#include <unistd.h>
+
+std::string __raptor_fprt_expand_path(const char *path) {
+  std::string expanded;
+  for (const char *c = path; *c; ++c) {
+    if (c[0] == '%' && c[1] == 'p') {
+      expanded += std::to_string(getpid());
+      ++c;
+    } else {
+      expanded += *c;
+    }
+  }
+  return expanded;
+}
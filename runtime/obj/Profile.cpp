@@ -0,0 +1,269 @@
+//===- Profile.cpp - Flop profile by function and source line -------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file accumulates the flop profile described in raptor/Profile.h and
+// writes it as a tab separated table, one row per function followed by one row
+// per source line, each sorted by the number of flops.
+//
+// Environment variables:
+//   RAPTOR_FPRT_PROFILE=<path>   where the profile is written at exit (default
+//                                raptor.prof), a `%p` in the path is replaced
+//                                by the process id
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Profile.h"
+#include "raptor/raptor.h"
+
+#define RAPTOR_FPRT_PROFILE_DEFAULT_PATH "raptor.prof"
+
+typedef struct __raptor_profile_counts {
+  long long flops[RAPTOR_NUM_PRECISIONS][RAPTOR_NUM_OP_CLASSES];
+  long long vector_flops;
+  long long loaded;
+  long long stored;
+} __raptor_profile_counts;
+
+typedef struct __raptor_profile_table {
+  std::vector<__raptor_profile_counts> counts; // Indexed by site id.
+  struct __raptor_profile_table *next;
+} __raptor_profile_table;
+
+std::atomic<bool> __raptor_fprt_profile_enabled = false;
+
+// Modules register their sites from constructors which may run before the
+// ones of this file, so everything is allocated on first use.
+static std::mutex profile_mutex;
+static std::vector<__raptor_profile_site> *profile_sites = nullptr;
+// The first site of every file:line, for truncated flops.
+static std::map<std::string, int32_t> *profile_line_sites = nullptr;
+static std::atomic<int32_t> num_profile_sites = 0;
+// Tables are never freed so that threads which already exited are still part
+// of the profile.
+static __raptor_profile_table *profile_tables = nullptr;
+static thread_local __raptor_profile_table *tls_profile_table = nullptr;
+static thread_local std::unordered_map<const char *, int32_t>
+    *tls_trunc_sites = nullptr;
+
+static void profile_write_at_exit() {
+  const char *path = getenv("RAPTOR_FPRT_PROFILE");
+  raptor_fprt_profile_write(path ? path : RAPTOR_FPRT_PROFILE_DEFAULT_PATH);
+}
+
+static int32_t add_site_locked(const char *function, const char *loc) {
+  if (!profile_sites) {
+    profile_sites = new std::vector<__raptor_profile_site>();
+    profile_line_sites = new std::map<std::string, int32_t>();
+    atexit(profile_write_at_exit);
+  }
+  int32_t site = profile_sites->size();
+  profile_sites->push_back({function, loc});
+  profile_line_sites->emplace(loc, site);
+  num_profile_sites = profile_sites->size();
+  return site;
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+void __raptor_fprt_profile_register(const __raptor_profile_site *sites,
+                                    int32_t num, int32_t *base) {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  for (int32_t i = 0; i < num; i++) {
+    int32_t site = add_site_locked(sites[i].function, sites[i].loc);
+    if (i == 0)
+      *base = site;
+  }
+  __raptor_fprt_profile_enabled = true;
+}
+
+__attribute__((noinline)) static __raptor_profile_counts *
+profile_counts_slow(int32_t site) {
+  if (site < 0 || site >= num_profile_sites)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  if (!tls_profile_table) {
+    tls_profile_table = new __raptor_profile_table();
+    tls_profile_table->next = profile_tables;
+    profile_tables = tls_profile_table;
+  }
+  tls_profile_table->counts.resize(profile_sites->size(),
+                                   __raptor_profile_counts{});
+  return &tls_profile_table->counts[site];
+}
+
+static inline __raptor_profile_counts *profile_counts(int32_t site) {
+  __raptor_profile_table *table = tls_profile_table;
+  if (table && site >= 0 && (size_t)site < table->counts.size())
+    return &table->counts[site];
+  return profile_counts_slow(site);
+}
+
+void __raptor_fprt_profile_flops(int32_t site, int precision, int64_t op_class,
+                                 int64_t n, bool vector) {
+  __raptor_profile_counts *counts = profile_counts(site);
+  if (!counts)
+    return;
+  if ((uint64_t)op_class >= RAPTOR_NUM_OP_CLASSES)
+    op_class = RAPTOR_OP_CLASS_TRANSCENDENTAL;
+  counts->flops[precision][op_class] += n;
+  if (vector)
+    counts->vector_flops += n;
+}
+
+// Truncated flops carry a file:line:col location, they are attributed to the
+// first site of the same file:line or to a new site if there is none.
+static int32_t trunc_site(const char *loc) {
+  std::string line = loc ? loc : "unknown:0:0";
+  size_t colon = line.rfind(':');
+  if (colon != std::string::npos)
+    line.resize(colon);
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  auto found = profile_line_sites->find(line);
+  if (found != profile_line_sites->end())
+    return found->second;
+  return add_site_locked("<truncated>", strdup(line.c_str()));
+}
+
+void __raptor_fprt_profile_trunc_flop(const char *loc, int64_t op_class) {
+  if (!tls_trunc_sites)
+    tls_trunc_sites = new std::unordered_map<const char *, int32_t>();
+  auto found = tls_trunc_sites->find(loc);
+  int32_t site;
+  if (found != tls_trunc_sites->end()) {
+    site = found->second;
+  } else {
+    site = trunc_site(loc);
+    tls_trunc_sites->emplace(loc, site);
+  }
+  __raptor_fprt_profile_flops(site, RAPTOR_PRECISION_TRUNC, op_class, 1,
+                              false);
+}
+
+void __raptor_fprt_profile_memory(int32_t site, int64_t loaded,
+                                  int64_t stored) {
+  __raptor_profile_counts *counts = profile_counts(site);
+  if (!counts)
+    return;
+  counts->loaded += loaded;
+  counts->stored += stored;
+}
+
+static void add_counts(__raptor_profile_counts &into,
+                       const __raptor_profile_counts &from) {
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+    for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+      into.flops[p][c] += from.flops[p][c];
+  into.vector_flops += from.vector_flops;
+  into.loaded += from.loaded;
+  into.stored += from.stored;
+}
+
+static long long precision_flops(const __raptor_profile_counts &counts,
+                                 int precision) {
+  long long sum = 0;
+  for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+    sum += counts.flops[precision][c];
+  return sum;
+}
+
+static long long total_flops(const __raptor_profile_counts &counts) {
+  long long sum = 0;
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+    sum += precision_flops(counts, p);
+  return sum;
+}
+
+typedef struct __raptor_profile_row {
+  const char *function;
+  const char *loc;
+  __raptor_profile_counts counts;
+} __raptor_profile_row;
+
+static void print_rows(FILE *out, const char *kind,
+                       std::vector<__raptor_profile_row> &rows,
+                       long long all_flops) {
+  std::sort(rows.begin(), rows.end(),
+            [](const __raptor_profile_row &a, const __raptor_profile_row &b) {
+              return total_flops(a.counts) > total_flops(b.counts);
+            });
+  for (const __raptor_profile_row &row : rows) {
+    const __raptor_profile_counts &counts = row.counts;
+    long long flops = total_flops(counts);
+    if (!flops && !counts.loaded && !counts.stored)
+      continue;
+    long long trunc = precision_flops(counts, RAPTOR_PRECISION_TRUNC);
+    fprintf(out, "%s\t%lld\t%.2f\t%.2f\t%lld", kind, flops,
+            all_flops ? 100.0 * flops / all_flops : 0.0,
+            flops ? 100.0 * trunc / flops : 0.0, counts.vector_flops);
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+      fprintf(out, "\t%lld", precision_flops(counts, p));
+    for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++) {
+      long long sum = 0;
+      for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+        sum += counts.flops[p][c];
+      fprintf(out, "\t%lld", sum);
+    }
+    fprintf(out, "\t%lld\t%lld\t%s\t%s\n", counts.loaded, counts.stored,
+            row.function, row.loc);
+  }
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+int raptor_fprt_profile_write(const char *path) {
+  std::vector<__raptor_profile_row> lines;
+  {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    if (profile_sites)
+      for (const __raptor_profile_site &site : *profile_sites)
+        lines.push_back({site.function, site.loc, {}});
+    for (__raptor_profile_table *table = profile_tables; table;
+         table = table->next)
+      for (size_t i = 0; i < table->counts.size(); i++)
+        add_counts(lines[i].counts, table->counts[i]);
+  }
+
+  std::map<std::string, __raptor_profile_counts> by_function;
+  long long all_flops = 0;
+  for (const __raptor_profile_row &line : lines) {
+    add_counts(by_function[line.function], line.counts);
+    all_flops += total_flops(line.counts);
+  }
+  std::vector<__raptor_profile_row> functions;
+  for (auto &[function, counts] : by_function)
+    functions.push_back({function.c_str(), "*", counts});
+
+  std::string expanded = __raptor_fprt_expand_path(path);
+  FILE *out = fopen(expanded.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  fprintf(out, "# kind\tflops\t%%flops\t%%trunc\tvector");
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+    fprintf(out, "\t%s", __raptor_fprt_precision_names[p]);
+  for (int c = 0; c < RAPTOR_NUM_OP_CLASSES; c++)
+    fprintf(out, "\t%s", __raptor_fprt_op_class_names[c]);
+  fprintf(out, "\tloads\tstores\tfunction\tlocation\n");
+  print_rows(out, "function", functions, all_flops);
+  print_rows(out, "line", lines, all_flops);
+  return fclose(out);
+}
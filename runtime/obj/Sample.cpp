@@ -0,0 +1,267 @@
+//===- Sample.cpp - Statistical profile of truncated code -----------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the sampling profiler described in raptor/Sample.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_SAMPLE=<path>       sample and write the profile to <path> at
+//                                   exit, a `%p` in the path is replaced by
+//                                   the process id
+//   RAPTOR_FPRT_SAMPLE_RATE=<hz>    samples per second of CPU time (default
+//                                   1000), the kernel takes at most one per
+//                                   scheduler tick
+//
+// The profile is a tab separated table with one row per region, one row per
+// region and site, each sorted by the number of samples, and one row for the
+// samples outside of truncated code. Recording a sample takes a hash table
+// probe, so the overhead is dominated by the signal delivery, well below 1% at
+// the default rate.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Sample.h"
+#include "raptor/raptor.h"
+
+#define RAPTOR_SAMPLE_MAX_THREADS 256
+#define RAPTOR_SAMPLE_TABLE_SIZE 2048 // Per thread, a power of two.
+#define RAPTOR_SAMPLE_MAX_DEPTH 64
+
+typedef struct __raptor_sample {
+  const char *region;
+  const char *site;
+  std::atomic<long long> count; // Written last, zero for free entries.
+} __raptor_sample;
+
+typedef struct __raptor_sample_table {
+  __raptor_sample samples[RAPTOR_SAMPLE_TABLE_SIZE];
+  std::atomic<long long> dropped; // Samples which did not fit.
+} __raptor_sample_table;
+
+bool __raptor_fprt_sample_enabled = false;
+// Stored to by code compiled with -raptor-sample-sites.
+extern "C" {
+thread_local const char *__raptor_fprt_sample_site = nullptr;
+}
+
+static thread_local const char *tls_sample_regions[RAPTOR_SAMPLE_MAX_DEPTH];
+static thread_local unsigned tls_sample_depth = 0;
+static thread_local __raptor_sample_table *tls_sample_table = nullptr;
+
+// Claimed by the signal handler, so allocated up front. The pages of the
+// tables of threads which never run are never touched.
+static __raptor_sample_table *sample_tables = nullptr;
+static std::atomic<unsigned> num_sample_tables = 0;
+static std::atomic<long long> sample_threads_dropped = 0;
+static long sample_rate = 1000;
+static timer_t sample_timer;
+static const char *sample_path = nullptr;
+
+void __raptor_fprt_sample_enter(const char *loc) {
+  unsigned depth = tls_sample_depth;
+  if (depth < RAPTOR_SAMPLE_MAX_DEPTH)
+    tls_sample_regions[depth] = loc;
+  // The handler may interrupt us between the two stores.
+  std::atomic_signal_fence(std::memory_order_release);
+  tls_sample_depth = depth + 1;
+}
+
+void __raptor_fprt_sample_exit() {
+  // Unbalanced exits, e.g. of regions entered before a fork, are ignored.
+  if (tls_sample_depth)
+    tls_sample_depth--;
+}
+
+static inline uint64_t sample_hash(const char *region, const char *site) {
+  uint64_t h = (uint64_t)(uintptr_t)region * 0x9e3779b97f4a7c15ULL;
+  h ^= (uint64_t)(uintptr_t)site;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Runs on the thread which consumed the CPU time, must be async-signal-safe.
+static void sample_handler(int, siginfo_t *, void *) {
+  __raptor_sample_table *table = tls_sample_table;
+  if (!table) {
+    unsigned id = num_sample_tables.fetch_add(1, std::memory_order_relaxed);
+    if (id >= RAPTOR_SAMPLE_MAX_THREADS) {
+      num_sample_tables.store(RAPTOR_SAMPLE_MAX_THREADS,
+                              std::memory_order_relaxed);
+      sample_threads_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    table = tls_sample_table = &sample_tables[id];
+  }
+
+  unsigned depth =
+      std::min<unsigned>(tls_sample_depth, RAPTOR_SAMPLE_MAX_DEPTH);
+  std::atomic_signal_fence(std::memory_order_acquire);
+  const char *region = depth ? tls_sample_regions[depth - 1] : nullptr;
+  const char *site = __raptor_fprt_sample_site;
+
+  uint64_t h = sample_hash(region, site);
+  for (unsigned probe = 0; probe < RAPTOR_SAMPLE_TABLE_SIZE; probe++) {
+    __raptor_sample &sample =
+        table->samples[(h + probe) & (RAPTOR_SAMPLE_TABLE_SIZE - 1)];
+    if (!sample.count.load(std::memory_order_relaxed)) {
+      sample.region = region;
+      sample.site = site;
+      sample.count.store(1, std::memory_order_release);
+      return;
+    }
+    if (sample.region == region && sample.site == site) {
+      sample.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  table->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+typedef std::pair<const char *, const char *> __raptor_sample_key;
+
+static void print_rows(FILE *out, const char *kind,
+                       const std::map<__raptor_sample_key, long long> &rows,
+                       long long all) {
+  std::vector<std::pair<__raptor_sample_key, long long>> sorted(rows.begin(),
+                                                                rows.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a.second > b.second;
+  });
+  for (auto &[key, samples] : sorted)
+    fprintf(out, "%s\t%lld\t%.2f\t%s\t%s\n", kind, samples,
+            all ? 100.0 * samples / all : 0.0, key.first ? key.first : "-",
+            key.second ? key.second : "-");
+}
+
+__RAPTOR_MPFR_ATTRIBUTES
+int raptor_fprt_sample_write(const char *path) {
+  std::map<__raptor_sample_key, long long> regions, sites;
+  long long all = 0, native = 0;
+  long long dropped = sample_threads_dropped.load(std::memory_order_relaxed);
+  unsigned num_tables = std::min<unsigned>(
+      num_sample_tables.load(std::memory_order_acquire),
+      RAPTOR_SAMPLE_MAX_THREADS);
+  for (unsigned t = 0; t < num_tables; t++) {
+    __raptor_sample_table &table = sample_tables[t];
+    dropped += table.dropped.load(std::memory_order_relaxed);
+    for (__raptor_sample &sample : table.samples) {
+      long long count = sample.count.load(std::memory_order_acquire);
+      if (!count)
+        continue;
+      all += count;
+      if (!sample.region && !sample.site) {
+        native += count;
+        continue;
+      }
+      if (sample.region)
+        regions[{sample.region, "*"}] += count;
+      if (sample.site)
+        sites[{sample.region, sample.site}] += count;
+    }
+  }
+
+  std::string expanded = __raptor_fprt_expand_path(path);
+  FILE *out = fopen(expanded.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  // The kernel caps the rate, report the one we got.
+  struct timespec cpu;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+  double seconds = cpu.tv_sec + 1e-9 * cpu.tv_nsec;
+  fprintf(out,
+          "# %lld samples in %.3f seconds of CPU time (%.0f Hz), %.2f%% in "
+          "truncated code, %lld dropped\n",
+          all, seconds, seconds ? all / seconds : 0.0,
+          all ? 100.0 * (all - native) / all : 0.0, dropped);
+  fprintf(out, "# kind\tsamples\t%%samples\tregion\tsite\n");
+  print_rows(out, "region", regions, all);
+  print_rows(out, "site", sites, all);
+  if (native)
+    fprintf(out, "native\t%lld\t%.2f\t-\t-\n", native,
+            all ? 100.0 * native / all : 0.0);
+  return fclose(out);
+}
+
+static void sample_write_at_exit() {
+  // Stop sampling, the tables are read without synchronization.
+  timer_delete(sample_timer);
+  raptor_fprt_sample_write(sample_path);
+}
+
+static struct SampleConfig {
+  SampleConfig() {
+    const char *path = getenv("RAPTOR_FPRT_SAMPLE");
+    if (!path || !*path)
+      return;
+    if (const char *rate = getenv("RAPTOR_FPRT_SAMPLE_RATE"))
+      sample_rate = atol(rate);
+    if (sample_rate <= 0 || sample_rate > 1000000000) {
+      fprintf(stderr, "raptor: invalid RAPTOR_FPRT_SAMPLE_RATE\n");
+      return;
+    }
+
+    // Do not take over the handler of another profiler.
+    struct sigaction old;
+    if (sigaction(SIGPROF, nullptr, &old) ||
+        ((old.sa_flags & SA_SIGINFO) || (old.sa_handler != SIG_DFL &&
+                                         old.sa_handler != SIG_IGN))) {
+      fprintf(stderr, "raptor: SIGPROF is in use, not sampling\n");
+      return;
+    }
+    sample_tables = (__raptor_sample_table *)calloc(
+        RAPTOR_SAMPLE_MAX_THREADS, sizeof(__raptor_sample_table));
+    if (!sample_tables)
+      return;
+
+    struct sigaction action = {};
+    action.sa_sigaction = sample_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &sample_timer)) {
+      fprintf(stderr, "raptor: could not create the sampling timer: %s\n",
+              strerror(errno));
+      return;
+    }
+    long period = std::max(1000000000L / sample_rate, 1L);
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = period / 1000000000L;
+    spec.it_interval.tv_nsec = period % 1000000000L;
+    spec.it_value = spec.it_interval;
+    timer_settime(sample_timer, 0, &spec, nullptr);
+
+    sample_path = path;
+    __raptor_fprt_sample_enabled = true;
+    atexit(sample_write_at_exit);
+  }
+} sample_config;
@@ -0,0 +1,146 @@
+//===- Series.cpp - Time series of the counters ---------------------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file runs the sampler thread which appends the counters and per-site
+// statistics to the time series described in raptor/Series.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_SERIES=<path>            where the time series is written, a
+//                                        `%p` in the path is replaced by the
+//                                        process id
+//   RAPTOR_FPRT_SERIES_PERIOD=<seconds>  time between samples (default 1)
+//
+// A last sample is taken at exit.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Series.h"
+#include "raptor/Sites.h"
+
+typedef struct __raptor_series_site_state {
+  uint32_t id;
+  int64_t count;
+  int64_t count_thresh;
+} __raptor_series_site_state;
+
+static FILE *series_file = nullptr;
+static std::chrono::steady_clock::time_point series_start;
+static std::thread *series_thread = nullptr;
+static std::mutex series_mutex;
+// Allocated on start, which may run before the constructors of this file.
+static std::condition_variable *series_wakeup = nullptr;
+static bool series_stop = false;
+// Only used by the thread taking the sample.
+static std::unordered_map<const char *, __raptor_series_site_state>
+    *series_sites = nullptr;
+
+static void write_record(uint32_t type, const void *payload, uint32_t size,
+                         const void *extra = nullptr, uint32_t extra_size = 0) {
+  raptor_series_record record = {type, size + extra_size};
+  fwrite(&record, sizeof(record), 1, series_file);
+  fwrite(payload, size, 1, series_file);
+  if (extra_size)
+    fwrite(extra, extra_size, 1, series_file);
+}
+
+static void take_sample() {
+  raptor_series_sample sample = {};
+  sample.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - series_start)
+                       .count();
+  __raptor_fprt_counters_total(&sample.counters);
+
+  std::map<const char *, __raptor_op> sites;
+  __raptor_fprt_sites_collect(sites);
+  std::vector<raptor_series_site_sample> changed;
+  for (auto &[loc, op] : sites) {
+    auto [it, inserted] = series_sites->try_emplace(
+        loc, __raptor_series_site_state{(uint32_t)series_sites->size(), 0, 0});
+    __raptor_series_site_state &state = it->second;
+    if (inserted) {
+      std::vector<char> payload(sizeof(uint32_t));
+      memcpy(payload.data(), &state.id, sizeof(uint32_t));
+      payload.insert(payload.end(), loc, loc + strlen(loc) + 1);
+      write_record(RAPTOR_SERIES_SITE, payload.data(), payload.size());
+    }
+    if (op.count == state.count && op.count_thresh == state.count_thresh)
+      continue;
+    state.count = op.count;
+    state.count_thresh = op.count_thresh;
+    changed.push_back({state.id, 0, op.count, op.count_thresh});
+  }
+  sample.num_sites = changed.size();
+  write_record(RAPTOR_SERIES_SAMPLE, &sample, sizeof(sample), changed.data(),
+               changed.size() * sizeof(raptor_series_site_sample));
+  fflush(series_file);
+}
+
+static void series_loop(std::chrono::duration<double> period) {
+  std::unique_lock<std::mutex> lock(series_mutex);
+  while (!series_wakeup->wait_for(lock, period, [] { return series_stop; }))
+    take_sample();
+}
+
+static void series_exit() {
+  {
+    std::lock_guard<std::mutex> lock(series_mutex);
+    series_stop = true;
+  }
+  series_wakeup->notify_all();
+  series_thread->join();
+  take_sample();
+  fclose(series_file);
+}
+
+void __raptor_fprt_series_start(const char *path) {
+  double period = 1;
+  if (const char *p = getenv("RAPTOR_FPRT_SERIES_PERIOD"))
+    period = atof(p) > 0 ? atof(p) : 1;
+  std::string expanded = __raptor_fprt_expand_path(path);
+  series_file = fopen(expanded.c_str(), "wb");
+  if (!series_file) {
+    fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+            strerror(errno));
+    return;
+  }
+  raptor_series_header header = {};
+  memcpy(header.magic, RAPTOR_SERIES_MAGIC, sizeof(header.magic));
+  header.version = RAPTOR_SERIES_VERSION;
+  header.counters_size = sizeof(raptor_counters);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header.start_ns = ts.tv_sec * 1000000000ll + ts.tv_nsec;
+  header.period = period;
+  fwrite(&header, sizeof(header), 1, series_file);
+
+  series_sites =
+      new std::unordered_map<const char *, __raptor_series_site_state>();
+  series_wakeup = new std::condition_variable();
+  series_start = std::chrono::steady_clock::now();
+  // Never destroyed, it is joined at exit.
+  series_thread =
+      new std::thread(series_loop, std::chrono::duration<double>(period));
+  atexit(series_exit);
+}
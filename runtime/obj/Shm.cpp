@@ -0,0 +1,119 @@
+//===- Shm.cpp - Live counters in shared memory ---------------------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file creates the shared memory segment the counter slots are published
+// in, see raptor/Shm.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_SHM=1            publish the counters in /raptor.<pid>
+//   RAPTOR_FPRT_SHM_SLOTS=<n>    threads which get a shared slot (default 256),
+//                                later threads count into private slots which
+//                                raptor-top does not see
+//
+// The segment is unlinked at exit. Segments of processes which were killed
+// are left behind in /dev/shm and skipped by raptor-top.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "raptor/Shm.h"
+
+static __raptor_shm_header *shm_header = nullptr;
+static std::string shm_name;
+static bool shm_initialized = false;
+
+static void shm_exit() {
+  shm_header->exited.store(1, std::memory_order_release);
+  shm_unlink(shm_name.c_str());
+}
+
+static void shm_command(char *command, size_t size) {
+  FILE *f = fopen("/proc/self/comm", "r");
+  if (!f || !fgets(command, size, f))
+    snprintf(command, size, "?");
+  if (f)
+    fclose(f);
+  command[strcspn(command, "\n")] = '\0';
+}
+
+static __raptor_shm_header *shm_create() {
+  const char *enabled = getenv("RAPTOR_FPRT_SHM");
+  if (!enabled || !strcmp(enabled, "0"))
+    return nullptr;
+  uint32_t max_slots = RAPTOR_SHM_DEFAULT_SLOTS;
+  if (const char *slots = getenv("RAPTOR_FPRT_SHM_SLOTS"))
+    max_slots = atoi(slots) > 0 ? atoi(slots) : 1;
+
+  shm_name = "/" RAPTOR_SHM_PREFIX + std::to_string(getpid());
+  uint64_t size = __raptor_shm_size(max_slots);
+  int fd = shm_open(shm_name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0 || ftruncate(fd, size)) {
+    fprintf(stderr, "raptor: could not create shared memory %s: %s\n",
+            shm_name.c_str(), strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+      shm_unlink(shm_name.c_str());
+    }
+    return nullptr;
+  }
+  void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "raptor: could not map shared memory %s: %s\n",
+            shm_name.c_str(), strerror(errno));
+    shm_unlink(shm_name.c_str());
+    return nullptr;
+  }
+
+  // The segment is zero filled, the magic is written last so that readers
+  // never see a partial header.
+  __raptor_shm_header *header = new (mem) __raptor_shm_header();
+  header->version = RAPTOR_SHM_VERSION;
+  header->slot_size = sizeof(__raptor_counter_slot);
+  header->max_slots = max_slots;
+  header->pid = getpid();
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header->start_ns = ts.tv_sec * 1000000000ll + ts.tv_nsec;
+  shm_command(header->command, sizeof(header->command));
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = RAPTOR_SHM_MAGIC;
+  shm_header = header;
+  atexit(shm_exit);
+  return header;
+}
+
+__raptor_counter_slot *__raptor_fprt_shm_new_slot() {
+  if (!shm_initialized) {
+    shm_initialized = true;
+    shm_create();
+  }
+  if (!shm_header)
+    return nullptr;
+  uint32_t index = shm_header->num_slots.load(std::memory_order_relaxed);
+  if (index >= shm_header->max_slots)
+    return nullptr;
+  __raptor_counter_slot *slot =
+      new (&__raptor_shm_slots(shm_header)[index]) __raptor_counter_slot();
+  slot->shared = true;
+  // Publish the slot after it was initialized.
+  shm_header->num_slots.store(index + 1, std::memory_order_release);
+  return slot;
+}
@@ -0,0 +1,155 @@
+//===- Sites.cpp - Per-thread per-site operation statistics ---------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains the per-thread site tables used to attribute statistics
+// to the location of the truncated operation.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <mutex>
+
+#include "raptor/Common.h"
+#include "raptor/Sites.h"
+
+#define RAPTOR_FPRT_SITE_TABLE_INITIAL_CAPACITY 1024
+
+void __raptor_fprt_op_dump_at_exit();
+
+// Exit handlers which report the site statistics.
+static struct SiteExitHandlers {
+  SiteExitHandlers() {
+    if (getenv("RAPTOR_FPRT_OP_DUMP"))
+      atexit(__raptor_fprt_op_dump_at_exit);
+  }
+} site_exit_handlers;
+
+thread_local __raptor_site_table *__raptor_fprt_tls_sites = nullptr;
+
+// Protects the list of tables and the growth of any table, so that a report
+// never observes a table that is being reallocated.
+static std::mutex site_tables_mutex;
+static __raptor_site_table *site_tables = nullptr;
+
+static __raptor_site *allocate_sites(uint64_t capacity) {
+  __raptor_site *sites = (__raptor_site *)calloc(capacity, sizeof(sites[0]));
+  if (!sites)
+    exit(__RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS);
+  for (uint64_t i = 0; i < capacity; i++)
+    sites[i] = __raptor_site{};
+  return sites;
+}
+
+static __raptor_site *probe(__raptor_site *sites, uint64_t mask,
+                            const char *loc) {
+  uint64_t i = __raptor_fprt_site_hash(loc) & mask;
+  while (sites[i].loc && sites[i].loc != loc)
+    i = (i + 1) & mask;
+  return &sites[i];
+}
+
+static void grow(__raptor_site_table *table) {
+  uint64_t capacity = (table->mask + 1) * 2;
+  __raptor_site *sites = allocate_sites(capacity);
+  for (uint64_t i = 0; i <= table->mask; i++)
+    if (table->sites[i].loc)
+      *probe(sites, capacity - 1, table->sites[i].loc) = table->sites[i];
+  free(table->sites);
+  table->sites = sites;
+  table->mask = capacity - 1;
+}
+
+__raptor_site *__raptor_fprt_site_insert(const char *loc) {
+  __raptor_site_table *table = __raptor_fprt_tls_sites;
+  if (!table) {
+    // Tables are intentionally never freed so that the statistics of threads
+    // which already exited are still part of the report.
+    table = (__raptor_site_table *)malloc(sizeof(*table));
+    if (!table)
+      exit(__RAPTOR_MPFR_MALLOC_FAILURE_EXIT_STATUS);
+    table->mask = RAPTOR_FPRT_SITE_TABLE_INITIAL_CAPACITY - 1;
+    table->size = 0;
+    table->sites = allocate_sites(RAPTOR_FPRT_SITE_TABLE_INITIAL_CAPACITY);
+    std::lock_guard<std::mutex> lock(site_tables_mutex);
+    table->next = site_tables;
+    site_tables = table;
+    __raptor_fprt_tls_sites = table;
+  }
+
+  __raptor_site *site = probe(table->sites, table->mask, loc);
+  if (site->loc)
+    return site;
+
+  // Keep the load factor below one half so that probe sequences stay short.
+  if (2 * (table->size + 1) > table->mask + 1) {
+    std::lock_guard<std::mutex> lock(site_tables_mutex);
+    grow(table);
+    site = probe(table->sites, table->mask, loc);
+  }
+  site->loc = loc;
+  ++table->size;
+  return site;
+}
+
+void __raptor_fprt_op_merge(__raptor_op &into, const __raptor_op &from) {
+  if (!into.op)
+    into.op = from.op;
+  into.l1_err += from.l1_err;
+  into.count_thresh += from.count_thresh;
+  into.count += from.count;
+  into.count_ignore += from.count_ignore;
+  into.rel_err += from.rel_err;
+  into.max_rel_err = std::max(into.max_rel_err, from.max_rel_err);
+  into.count_flip += from.count_flip;
+}
+
+void __raptor_fprt_sites_collect(std::map<const char *, __raptor_op> &into) {
+  std::lock_guard<std::mutex> lock(site_tables_mutex);
+  for (__raptor_site_table *table = site_tables; table; table = table->next)
+    for (uint64_t i = 0; i <= table->mask; i++)
+      if (table->sites[i].loc)
+        __raptor_fprt_op_merge(into[table->sites[i].loc],
+                               table->sites[i].stats);
+}
+
+void __raptor_fprt_cancel_collect(
+    std::map<const char *, __raptor_cancel> &into) {
+#ifdef RAPTOR_FPRT_ENABLE_CANCELLATION
+  std::lock_guard<std::mutex> lock(site_tables_mutex);
+  for (__raptor_site_table *table = site_tables; table; table = table->next) {
+    for (uint64_t i = 0; i <= table->mask; i++) {
+      const __raptor_site &site = table->sites[i];
+      if (!site.loc || std::none_of(std::begin(site.cancel.bits),
+                                    std::end(site.cancel.bits),
+                                    [](long long n) { return n != 0; }))
+        continue;
+      __raptor_cancel &cancel = into[site.loc];
+      for (int b = 0; b < RAPTOR_FPRT_CANCEL_BUCKETS; b++)
+        cancel.bits[b] += site.cancel.bits[b];
+    }
+  }
+#endif
+}
+
+std::map<const char *, __raptor_op> __raptor_fprt_op_collect() {
+  std::map<const char *, __raptor_op> merged;
+  __raptor_fprt_sites_collect(merged);
+  return merged;
+}
+
+void __raptor_fprt_sites_clear() {
+  std::lock_guard<std::mutex> lock(site_tables_mutex);
+  for (__raptor_site_table *table = site_tables; table; table = table->next)
+    for (uint64_t i = 0; i <= table->mask; i++)
+      if (table->sites[i].loc)
+        table->sites[i] = __raptor_site{table->sites[i].loc};
+}
@@ -0,0 +1,213 @@
+//===- Timeline.cpp - Timeline of truncated regions -----------------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file records the timeline described in raptor/Timeline.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_TIMELINE=<path>   record the timeline and write it as Chrome
+//                                 trace JSON to <path> at exit, a `%p` in the
+//                                 path is replaced by the process id
+//
+// Every thread records at most RAPTOR_TIMELINE_MAX_EVENTS events, later ones
+// are dropped and counted. Regions which are still open at exit end at the
+// last event of their thread so that viewers show them.
+//
+//===----------------------------------------------------------------------===//
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "raptor/Common.h"
+#include "raptor/Timeline.h"
+#include "raptor/Timing.h"
+
+#define RAPTOR_TIMELINE_CHUNK_BITS 16
+#define RAPTOR_TIMELINE_CHUNK_SIZE (1 << RAPTOR_TIMELINE_CHUNK_BITS)
+#define RAPTOR_TIMELINE_MAX_CHUNKS 256
+#define RAPTOR_TIMELINE_MAX_EVENTS                                             \
+  (RAPTOR_TIMELINE_CHUNK_SIZE * RAPTOR_TIMELINE_MAX_CHUNKS)
+
+typedef struct __raptor_timeline_event {
+  uint64_t ns; // Since the start of the run.
+  const char *name;
+  long long ops; // Emulated by the thread so far.
+  uint8_t category;
+  bool begin;
+} __raptor_timeline_event;
+
+typedef struct __raptor_timeline_thread {
+  __raptor_timeline_event *chunks[RAPTOR_TIMELINE_MAX_CHUNKS] = {};
+  std::atomic<uint64_t> num_events = 0;
+  long long dropped = 0;
+  long tid;
+  struct __raptor_timeline_thread *next;
+} __raptor_timeline_thread;
+
+static const char *const timeline_category_names[] = {"trunc", "scratch",
+                                                      "phase"};
+
+bool __raptor_fprt_timeline_enabled = false;
+static std::chrono::steady_clock::time_point timeline_start;
+static const char *timeline_path = nullptr;
+
+static std::mutex timeline_mutex;
+// Never freed so that threads which already exited are still written.
+static __raptor_timeline_thread *timeline_threads = nullptr;
+static thread_local __raptor_timeline_thread *tls_timeline_thread = nullptr;
+// Copies of the phase names, which are built on the fly.
+static std::set<std::string> *timeline_names = nullptr;
+
+static __raptor_timeline_thread *get_timeline_thread() {
+  if (__raptor_timeline_thread *thread = tls_timeline_thread)
+    return thread;
+  __raptor_timeline_thread *thread = new __raptor_timeline_thread();
+  thread->tid = syscall(SYS_gettid);
+  std::lock_guard<std::mutex> lock(timeline_mutex);
+  thread->next = timeline_threads;
+  timeline_threads = thread;
+  tls_timeline_thread = thread;
+  return thread;
+}
+
+static void timeline_record(__raptor_timeline_category category,
+                            const char *name, bool begin) {
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - timeline_start)
+                    .count();
+  __raptor_timeline_thread *thread = get_timeline_thread();
+  uint64_t i = thread->num_events.load(std::memory_order_relaxed);
+  if (i >= RAPTOR_TIMELINE_MAX_EVENTS) {
+    thread->dropped++;
+    return;
+  }
+  __raptor_timeline_event *&chunk =
+      thread->chunks[i >> RAPTOR_TIMELINE_CHUNK_BITS];
+  if (!chunk) {
+    chunk = (__raptor_timeline_event *)malloc(
+        RAPTOR_TIMELINE_CHUNK_SIZE * sizeof(__raptor_timeline_event));
+    if (!chunk) {
+      thread->dropped++;
+      return;
+    }
+  }
+  chunk[i & (RAPTOR_TIMELINE_CHUNK_SIZE - 1)] = {
+      ns, name, __raptor_fprt_thread_trunc_flops(), (uint8_t)category, begin};
+  thread->num_events.store(i + 1, std::memory_order_release);
+}
+
+void __raptor_fprt_timeline_begin(__raptor_timeline_category category,
+                                  const char *name) {
+  if (category == RAPTOR_TIMELINE_PHASE) {
+    std::lock_guard<std::mutex> lock(timeline_mutex);
+    if (!timeline_names)
+      timeline_names = new std::set<std::string>();
+    name = timeline_names->insert(name).first->c_str();
+  }
+  timeline_record(category, name, /*begin*/ true);
+}
+
+void __raptor_fprt_timeline_end(__raptor_timeline_category category) {
+  timeline_record(category, nullptr, /*begin*/ false);
+}
+
+static void write_json_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(out, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(out, "\\u%04x", *s);
+    else
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+// Regions and phases of different categories need not nest, so every region
+// is written as a complete event once its end is known.
+static void write_event(FILE *out, bool &first, long tid,
+                        const __raptor_timeline_event &begin, uint64_t end_ns,
+                        long long ops) {
+  fprintf(out, "%s\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,"
+          "\"dur\":%.3f,\"cat\":\"%s\",\"name\":",
+          first ? "" : ",", (int)getpid(), tid, begin.ns * 1e-3,
+          (end_ns - begin.ns) * 1e-3, timeline_category_names[begin.category]);
+  first = false;
+  write_json_string(out, begin.name);
+  fprintf(out, ",\"args\":{\"ops\":%lld}}", ops);
+}
+
+static void timeline_write() {
+  std::string expanded = __raptor_fprt_expand_path(timeline_path);
+  FILE *out = fopen(expanded.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+            strerror(errno));
+    return;
+  }
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  bool first = true;
+  long long dropped = 0;
+  std::lock_guard<std::mutex> lock(timeline_mutex);
+  for (__raptor_timeline_thread *thread = timeline_threads; thread;
+       thread = thread->next) {
+    dropped += thread->dropped;
+    uint64_t n = thread->num_events.load(std::memory_order_acquire);
+    // The begin events of the open regions of every category.
+    std::vector<const __raptor_timeline_event *> open[3];
+    const __raptor_timeline_event *last = nullptr;
+    for (uint64_t i = 0; i < n; i++) {
+      const __raptor_timeline_event &event =
+          thread->chunks[i >> RAPTOR_TIMELINE_CHUNK_BITS]
+                        [i & (RAPTOR_TIMELINE_CHUNK_SIZE - 1)];
+      std::vector<const __raptor_timeline_event *> &stack =
+          open[event.category];
+      last = &event;
+      if (event.begin) {
+        stack.push_back(&event);
+      } else if (!stack.empty()) {
+        write_event(out, first, thread->tid, *stack.back(), event.ns,
+                    event.ops - stack.back()->ops);
+        stack.pop_back();
+      }
+    }
+    for (auto &stack : open)
+      for (const __raptor_timeline_event *begin : stack)
+        write_event(out, first, thread->tid, *begin, last->ns,
+                    last->ops - begin->ops);
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  if (dropped)
+    fprintf(stderr, "raptor: dropped %lld timeline events\n", dropped);
+}
+
+static struct TimelineConfig {
+  TimelineConfig() {
+    const char *path = getenv("RAPTOR_FPRT_TIMELINE");
+    if (!path || !*path)
+      return;
+    timeline_path = path;
+    timeline_start = std::chrono::steady_clock::now();
+    __raptor_fprt_timeline_enabled = true;
+    atexit(timeline_write);
+  }
+} timeline_config;
@@ -0,0 +1,222 @@
+//===- Timing.cpp - Time spent in truncated functions ---------------------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file accounts the time spent in truncated functions, see
+// raptor/Timing.h.
+//
+// Environment variables:
+//   RAPTOR_FPRT_TIMING=1     time truncated functions with clock_gettime
+//   RAPTOR_FPRT_TIMING=tsc   time them with the time stamp counter (x86 only),
+//                            converted to seconds over the whole run
+//
+// The report printed to stderr at exit lists, per truncated function, the
+// inclusive time summed over all threads, its share of the run, the number of
+// calls and emulated operations, and the time per emulated operation relative
+// to a native floating point operation measured at exit. The latter is an upper
+// bound of the emulation slowdown since it includes all work of the function.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define RAPTOR_FPRT_HAS_TSC 1
+#endif
+
+#include "raptor/Common.h"
+#include "raptor/Timing.h"
+
+typedef struct __raptor_timing_stats {
+  long long calls = 0;
+  unsigned long long ticks = 0;
+  long long ops = 0;
+  unsigned active = 0; // Activations on the stack, for recursion.
+} __raptor_timing_stats;
+
+typedef struct __raptor_timing_frame {
+  const char *loc;
+  unsigned long long start;
+  long long ops;
+  bool scratch;
+  bool nested_scratch; // get_scratch of the same function after trunc_change.
+} __raptor_timing_frame;
+
+typedef struct __raptor_timing_thread {
+  std::vector<__raptor_timing_frame> stack;
+  std::unordered_map<const char *, __raptor_timing_stats> stats;
+  unsigned long long outer_ticks = 0; // Time in outermost truncated functions.
+  struct __raptor_timing_thread *next;
+} __raptor_timing_thread;
+
+bool __raptor_fprt_timing_enabled = false;
+static bool timing_tsc = false;
+static unsigned long long run_start_ticks;
+static std::chrono::steady_clock::time_point run_start;
+
+static std::mutex timing_threads_mutex;
+static __raptor_timing_thread *timing_threads = nullptr;
+static thread_local __raptor_timing_thread *tls_timing_thread = nullptr;
+
+static inline unsigned long long timing_now() {
+#ifdef RAPTOR_FPRT_HAS_TSC
+  if (timing_tsc)
+    return __rdtsc();
+#endif
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static __raptor_timing_thread *get_timing_thread() {
+  if (__raptor_timing_thread *thread = tls_timing_thread)
+    return thread;
+  // Never freed so that threads which already exited are still reported.
+  __raptor_timing_thread *thread = new __raptor_timing_thread();
+  std::lock_guard<std::mutex> lock(timing_threads_mutex);
+  thread->next = timing_threads;
+  timing_threads = thread;
+  tls_timing_thread = thread;
+  return thread;
+}
+
+void __raptor_fprt_timing_enter(const char *loc, bool scratch) {
+  __raptor_timing_thread *thread = get_timing_thread();
+  if (scratch && !thread->stack.empty()) {
+    __raptor_timing_frame &top = thread->stack.back();
+    if (top.loc == loc && !top.scratch && !top.nested_scratch) {
+      top.nested_scratch = true;
+      return;
+    }
+  }
+  thread->stats[loc].active++;
+  thread->stack.push_back({loc, timing_now(),
+                           __raptor_fprt_thread_trunc_flops(), scratch,
+                           false});
+}
+
+void __raptor_fprt_timing_exit(const char *loc, bool scratch) {
+  unsigned long long now = timing_now();
+  __raptor_timing_thread *thread = get_timing_thread();
+  // Unbalanced exits, e.g. when timing was enabled mid-call, are ignored.
+  auto match = std::find_if(
+      thread->stack.rbegin(), thread->stack.rend(),
+      [loc](const __raptor_timing_frame &frame) { return frame.loc == loc; });
+  if (match == thread->stack.rend())
+    return;
+  // Frames above the match were left by an exception unwinding through their
+  // region and are dropped without being timed.
+  while (thread->stack.back().loc != loc) {
+    thread->stats[thread->stack.back().loc].active--;
+    thread->stack.pop_back();
+  }
+  __raptor_timing_frame &top = thread->stack.back();
+  if (scratch && top.nested_scratch) {
+    top.nested_scratch = false;
+    return;
+  }
+  __raptor_timing_stats &stats = thread->stats[loc];
+  stats.calls++;
+  // Only the outermost activation of a recursive function is timed.
+  if (--stats.active == 0) {
+    stats.ticks += now - top.start;
+    stats.ops += __raptor_fprt_thread_trunc_flops() - top.ops;
+  }
+  if (thread->stack.size() == 1)
+    thread->outer_ticks += now - top.start;
+  thread->stack.pop_back();
+}
+
+// Nanoseconds per dependent native multiply-add.
+static double native_op_ns() {
+  volatile double seed = 1.0;
+  double x = seed;
+  const int n = 1 << 22;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++)
+    x = x * 0.999999 + 1e-9;
+  double ns = std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  seed = x;
+  return ns / (2.0 * n);
+}
+
+static void timing_report() {
+  double run_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    run_start)
+          .count();
+  double seconds_per_tick = 1e-9;
+  if (timing_tsc && timing_now() > run_start_ticks)
+    seconds_per_tick = run_seconds / (timing_now() - run_start_ticks);
+
+  std::unordered_map<const char *, __raptor_timing_stats> merged;
+  unsigned long long outer_ticks = 0;
+  {
+    std::lock_guard<std::mutex> lock(timing_threads_mutex);
+    for (__raptor_timing_thread *thread = timing_threads; thread;
+         thread = thread->next) {
+      outer_ticks += thread->outer_ticks;
+      for (auto &[loc, stats] : thread->stats) {
+        __raptor_timing_stats &m = merged[loc];
+        m.calls += stats.calls;
+        m.ticks += stats.ticks;
+        m.ops += stats.ops;
+      }
+    }
+  }
+  std::vector<std::pair<const char *, __raptor_timing_stats>> sorted(
+      merged.begin(), merged.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a.second.ticks > b.second.ticks;
+  });
+
+  double truncated = outer_ticks * seconds_per_tick;
+  double native_ns = native_op_ns();
+  fprintf(stderr,
+          "Time in %zu truncated functions: %.6f of %.6f seconds (%.2f%%), "
+          "native op %.3f ns.\n",
+          sorted.size(), truncated, run_seconds,
+          run_seconds ? 100 * truncated / run_seconds : 0.0, native_ns);
+  fprintf(stderr, "  %12s %8s %10s %14s %10s %10s  %s\n", "seconds", "run",
+          "calls", "emulated ops", "ns/op", "slowdown", "location");
+  for (auto &[loc, stats] : sorted) {
+    double seconds = stats.ticks * seconds_per_tick;
+    double ns_per_op = stats.ops ? 1e9 * seconds / stats.ops : 0;
+    fprintf(stderr, "  %12.6f %7.2f%% %10lld %14lld %10.2f %9.1fx  %s\n",
+            seconds, run_seconds ? 100 * seconds / run_seconds : 0.0,
+            stats.calls, stats.ops, ns_per_op,
+            native_ns ? ns_per_op / native_ns : 0.0, loc ? loc : "unknown");
+  }
+}
+
+static struct TimingConfig {
+  TimingConfig() {
+    const char *timing = getenv("RAPTOR_FPRT_TIMING");
+    if (!timing || !*timing || !strcmp(timing, "0"))
+      return;
+#ifdef RAPTOR_FPRT_HAS_TSC
+    timing_tsc = !strcmp(timing, "tsc");
+#endif
+    run_start = std::chrono::steady_clock::now();
+    run_start_ticks = timing_now();
+    __raptor_fprt_timing_enabled = true;
+    atexit(timing_report);
+  }
+} timing_config;
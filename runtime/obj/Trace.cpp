@@ -18,7 +18,18 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file contains infrastructure for flop tracing
+// This file contains infrastructure for flop tracing. It is built as the
+// Raptor-RT-Trace runtime (raptor-clang --raptor-runtime=trace), which takes
+// the place of the MPFR runtime and traces the values of memory mode
+// truncations in double precision.
+//
+// Environment variables:
+//   RAPTOR_FPRT_TRACE=<path>   stream the tape to a file instead of keeping it
+//                              in memory (see raptor/TraceFile.h), a `%p` in
+//                              the path is replaced by the process id
+//   RAPTOR_FPRT_TRACE_PRINT=1  print every traced operation and the
+//                              sensitivity of the printed values, see
+//                              obj/Diagnostics.cpp for the filters
 //
 // It is implemented as a .cpp file and not as a header becaues we want to use
 // C++ features and still be able to use it in C code.
@@ -27,197 +38,341 @@
 
 #include <algorithm>
 #include <array>
+#include <cerrno>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-#include "raptor/Common.h"
+#include "raptor/Diagnostics.h"
+#include "raptor/Tape.h"
+#include "raptor/TraceFile.h"
 #include "raptor/raptor.h"
 
-#ifndef RAPTOR_FPRT_TRACE_PRINT
-#define RAPTOR_FPRT_TRACE_PRINT 1
-#endif
+// raptor/Common.h describes the values of the MPFR runtime, this runtime has
+// its own. The pass only defines the originals of the operations it truncated.
+#define __RAPTOR_MPFR_ATTRIBUTES extern "C"
+#define __RAPTOR_MPFR_ORIGINAL_ATTRIBUTES extern "C" __attribute__((weak))
+
+std::string __raptor_fprt_expand_path(const char *path);
 
 static constexpr unsigned fp_max_inputs = 3;
 static constexpr std::array<const char *, 3> arg_names = {"x", "y", "z"};
 static_assert(arg_names.size() == fp_max_inputs);
 
+// The traced values the program passes around point to these, everything else
+// about a value is on the tape, see raptor/Tape.h.
 extern "C" {
 typedef struct __raptor_fp {
 private:
   double result;
-  unsigned char input_num;
-  const char *loc;
-  __raptor_fp *inputs[fp_max_inputs];
-  double derivatives[fp_max_inputs];
-#if RAPTOR_FPRT_TRACE_PRINT
-  const char *name;
-#endif
 
 public:
-  size_t id;
-
-  double getDerivative(unsigned no) const { return derivatives[no]; }
-  void setDerivative(unsigned no, double d) { derivatives[no] = d; }
-
-  __raptor_fp *getInput(unsigned no) const { return inputs[no]; }
-  void setInput(unsigned no, __raptor_fp *i) { inputs[no] = i; }
-
-  unsigned char getInputNum() const { return input_num; }
-  void setInputNum(unsigned char i) { input_num = i; }
+  uint64_t id;
 
   double getResult() const { return result; }
   void setResult(double r) { result = r; }
+} __raptor_fp;
+}
 
-  const char *getLoc() const { return loc; }
-  void setLoc(const char *l) { loc = l; }
+static_assert(sizeof(__raptor_fp *) == sizeof(double));
 
-#if RAPTOR_FPRT_TRACE_PRINT
-  const char *getName() const { return name; }
-  void setName(const char *l) { name = l; }
-#endif
+static inline double __raptor_fprt_ptr_to_double(__raptor_fp *p) {
+  double d;
+  memcpy(&d, &p, sizeof(d));
+  return d;
+}
 
-} __raptor_fp;
+static inline __raptor_fp *__raptor_fprt_ieee_64_to_ptr(double d) {
+  __raptor_fp *p;
+  memcpy(&p, &d, sizeof(p));
+  return p;
 }
 
-static void print_raptor_fp_derivatives(std::ostream &out,
-                                        const __raptor_fp *fp) {
-  auto seen = false;
-  for (unsigned i = 0; i < fp->getInputNum(); i++) {
-    if (seen)
-      out << ", ";
-    seen = true;
-    out << "d" << arg_names[i] << " = " << fp->getDerivative(i);
+// Writes the tape to a file in blocks, see raptor/TraceFile.h.
+class TraceWriter {
+public:
+  bool open(const char *path) {
+    std::string expanded = __raptor_fprt_expand_path(path);
+    file = fopen(expanded.c_str(), "wb");
+    if (!file) {
+      fprintf(stderr, "raptor: could not open %s: %s\n", expanded.c_str(),
+              strerror(errno));
+      return false;
+    }
+    raptor_trace_header header = {};
+    memcpy(header.magic, RAPTOR_TRACE_MAGIC, sizeof(header.magic));
+    header.version = RAPTOR_TRACE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+    buffer.reserve(RAPTOR_TRACE_BLOCK_SIZE + 256);
+    return true;
   }
-}
-static void print_raptor_fp_value(std::ostream &out, const __raptor_fp *fp) {
-  out << "[" << fp << ": " << fp->getResult() << "]";
-}
-static void print_raptor_fp_function(std::ostream &out, const __raptor_fp *fp) {
-  std::cerr << fp->getName() << "(";
-  bool seen = false;
-  for (unsigned i = 0; i < fp->getInputNum(); i++) {
-    if (seen)
-      std::cerr << ", ";
-    seen = true;
-    __raptor_fp *fpinput = fp->getInput(i);
-    print_raptor_fp_value(std::cerr, fpinput);
+
+  void value(__raptor_tape_kind kind, const char *loc, double result,
+             unsigned num_inputs, const uint64_t *inputs,
+             const double *derivatives) {
+    uint64_t site = get_site(loc);
+    start_record();
+    uint8_t record[1 + 10 + 8 + fp_max_inputs * (10 + 8)];
+    uint8_t *p = record;
+    *p++ = kind | num_inputs << 2;
+    p = raptor_trace_put_varint(p, site);
+    memcpy(p, &result, sizeof(result));
+    p += sizeof(result);
+    for (unsigned i = 0; i < num_inputs; i++) {
+      uint8_t code = raptor_trace_derivative_code(derivatives[i]);
+      p = raptor_trace_put_varint(p, (next_id - inputs[i]) << 2 | code);
+      if (code == RAPTOR_TRACE_DERIVATIVE_RAW) {
+        memcpy(p, &derivatives[i], sizeof(double));
+        p += sizeof(double);
+      }
+    }
+    append(record, p - record);
+    next_id++;
+    block_values++;
   }
-  std::cerr << ")";
-}
-static void print_raptor_fp(std::ostream &out, const __raptor_fp *fp) {
-  print_raptor_fp_function(out, fp);
-  out << " -> ";
-  print_raptor_fp_value(out, fp);
-  out << " ";
-  print_raptor_fp_derivatives(out, fp);
-  out << " at " << fp->getLoc();
-  out << std::endl;
-}
 
-template <typename T, unsigned NumInputs>
-static void __raptor_fprt_trace_no_res_flop(std::array<T, NumInputs> inputs,
-                                            const char *name, const char *loc) {
-  __raptor_fp fp;
-  fp.setInputNum(NumInputs);
-  fp.setLoc(loc);
-  for (unsigned i = 0; i < inputs.size(); i++) {
-    __raptor_fp *inputfp = __raptor_fprt_ieee_64_to_ptr(inputs[i]);
-    fp.setInput(i, inputfp);
+  void output(uint64_t id) {
+    start_record();
+    uint8_t record[1 + 10];
+    record[0] = RAPTOR_TRACE_OUTPUT;
+    uint8_t *p = raptor_trace_put_varint(record + 1, next_id - id);
+    append(record, p - record);
   }
 
-#if RAPTOR_FPRT_TRACE_PRINT
-  fp.setName(name);
-  print_raptor_fp_function(std::cerr, &fp);
-  std::cerr << " at " << loc << std::endl;
-#endif
-}
+  void flush() {
+    if (buffer.empty())
+      return;
+    raptor_trace_block block = {next_id - block_values, block_values,
+                                (uint32_t)buffer.size()};
+    fwrite(&block, sizeof(block), 1, file);
+    fwrite(buffer.data(), buffer.size(), 1, file);
+    fwrite(&block.size, sizeof(block.size), 1, file);
+    fflush(file);
+    buffer.clear();
+    block_values = 0;
+  }
 
-namespace {
-template <typename T, unsigned NumInputs, unsigned Input> class Derivative {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, NumInputs> inputs) {
-    return 0;
+private:
+  // Records never span blocks.
+  void start_record() {
+    if (buffer.size() >= RAPTOR_TRACE_BLOCK_SIZE)
+      flush();
   }
-};
-template <typename T> class Derivative<T, 1, 0> {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, 1> inputs) {
-    typedef double (*fty)(double);
-    return __raptor_fwddiff<T>((fty)fn, raptor_dup, inputs[0], 1.0);
+
+  void append(const uint8_t *record, size_t size) {
+    buffer.insert(buffer.end(), record, record + size);
   }
-};
-template <typename T> class Derivative<T, 2, 0> {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, 2> inputs) {
-    typedef double (*fty)(double);
-    return __raptor_fwddiff<T>((fty)fn, raptor_dup, inputs[0], 1.0,
-                               raptor_const, inputs[1]);
+
+  uint64_t get_site(const char *loc) {
+    auto [it, inserted] = sites.try_emplace(loc, sites.size());
+    if (inserted) {
+      start_record();
+      const char *name = loc ? loc : "unknown";
+      size_t len = strlen(name);
+      uint8_t record[1 + 10 + 10];
+      record[0] = RAPTOR_TRACE_SITE;
+      uint8_t *p = raptor_trace_put_varint(record + 1, it->second);
+      p = raptor_trace_put_varint(p, len);
+      append(record, p - record);
+      append((const uint8_t *)name, len);
+    }
+    return it->second;
   }
+
+  FILE *file = nullptr;
+  std::vector<uint8_t> buffer;
+  std::unordered_map<const char *, uint64_t> sites;
+  uint64_t next_id = 0; // Of the next value written.
+  uint32_t block_values = 0;
 };
-template <typename T> class Derivative<T, 2, 1> {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, 2> inputs) {
-    typedef double (*fty)(double);
-    return __raptor_fwddiff<T>((fty)fn, raptor_const, inputs[0], raptor_dup,
-                               inputs[1], 1.0);
+
+static struct {
+  __raptor_chunked_array<__raptor_fp> all; // Indexed by id unless streaming.
+  __raptor_tape tape;
+  // Of the values printed with RAPTOR_FPRT_TRACE_PRINT, indexed by id.
+  __raptor_chunked_array<const char *> names;
+  // Set with RAPTOR_FPRT_TRACE, values are then written instead of taped, and
+  // deleted values are reused.
+  TraceWriter *writer = nullptr;
+  std::vector<__raptor_fp *> free_values;
+  uint64_t next_id = 0;
+  __raptor_tape_kind pending_kind = RAPTOR_TAPE_OP; // Of the last new value.
+
+  void clear() {
+    all.clear();
+    tape.clear();
+    names.clear();
+    next_id = 0;
   }
-};
-template <typename T> class Derivative<T, 3, 0> {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, 3> inputs) {
-    typedef double (*fty)(double);
-    // clang-format off
-    return __raptor_fwddiff<T>((fty)fn,
-                               raptor_dup, inputs[0], 1.0,
-                               raptor_const, inputs[1],
-                               raptor_const, inputs[2]
-                               );
-    // clang-format on
+} FPs;
+
+static struct TraceConfig {
+  TraceConfig() {
+    const char *path = getenv("RAPTOR_FPRT_TRACE");
+    if (!path)
+      return;
+    TraceWriter *writer = new TraceWriter();
+    if (writer->open(path)) {
+      FPs.writer = writer;
+      atexit([] { FPs.writer->flush(); });
+    }
   }
-};
-template <typename T> class Derivative<T, 3, 1> {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, 3> inputs) {
-    typedef double (*fty)(double);
-    // clang-format off
-    return __raptor_fwddiff<T>((fty)fn,
-                               raptor_const, inputs[0],
-                               raptor_dup, inputs[1], 1.0,
-                               raptor_const, inputs[2]
-                               );
-    // clang-format on
+} trace_config;
+
+static void print_raptor_fp_value(std::ostream &out, const __raptor_fp *fp) {
+  out << "[" << fp << ": " << fp->getResult() << "]";
+}
+template <typename T, unsigned NumInputs>
+static void
+print_raptor_fp_function(std::ostream &out, const char *name,
+                         const std::array<__raptor_fp *, NumInputs> &inputs) {
+  out << name << "(";
+  for (unsigned i = 0; i < NumInputs; i++) {
+    if (i)
+      out << ", ";
+    print_raptor_fp_value(out, inputs[i]);
   }
+  out << ")";
+}
+
+static void print_trace_line(std::ostringstream &line, const char *loc) {
+  line << " at " << (loc ? loc : "unknown") << "\n";
+  std::string str = line.str();
+  __raptor_fprt_diag_write(str.data(), str.size());
+}
+
+template <typename T, unsigned NumInputs>
+static void __raptor_fprt_trace_no_res_flop(std::array<T, NumInputs> _inputs,
+                                            const char *name, const char *loc) {
+  if (!__raptor_fprt_diag_enabled(RAPTOR_FPRT_DIAG_TRACE) ||
+      !__raptor_fprt_diag_select(loc))
+    return;
+  std::array<__raptor_fp *, NumInputs> inputs;
+  for (unsigned i = 0; i < NumInputs; i++)
+    inputs[i] = __raptor_fprt_ieee_64_to_ptr(_inputs[i]);
+  std::ostringstream line;
+  print_raptor_fp_function<T, NumInputs>(line, name, inputs);
+  print_trace_line(line, loc);
+}
+
+namespace {
+template <typename T>
+static T call(void *fn, const std::array<T, 1> &inputs) {
+  return ((T(*)(T))fn)(inputs[0]);
+}
+template <typename T>
+static T call(void *fn, const std::array<T, 2> &inputs) {
+  return ((T(*)(T, T))fn)(inputs[0], inputs[1]);
+}
+template <typename T>
+static T call(void *fn, const std::array<T, 3> &inputs) {
+  return ((T(*)(T, T, T))fn)(inputs[0], inputs[1], inputs[2]);
+}
+
+// Central difference of the original function `fn` with respect to input `i`,
+// for the operations without a closed form derivative.
+template <typename T, unsigned NumInputs>
+static double numeric_derivative(void *fn, std::array<T, NumInputs> inputs,
+                                 unsigned i) {
+  T x = inputs[i];
+  T h = std::cbrt(std::numeric_limits<T>::epsilon()) *
+        std::max<T>(1, std::abs(x));
+  inputs[i] = x + h;
+  double above = call<T>(fn, inputs);
+  inputs[i] = x - h;
+  double below = call<T>(fn, inputs);
+  return (above - below) / (2 * (double)h);
+}
+
+// The closed form derivatives of raptor/Derivatives.def, one kernel per entry.
+enum DerivativeKernel {
+#define RAPTOR_DERIVATIVE(NAME, DX, DY, DZ) DERIVATIVE_##NAME,
+#include "raptor/Derivatives.def"
+#undef RAPTOR_DERIVATIVE
+  DERIVATIVE_NUMERIC, // No closed form, use a central difference.
 };
-template <typename T> class Derivative<T, 3, 2> {
-public:
-  __attribute__((always_inline)) static T get(void *fn,
-                                              std::array<T, 3> inputs) {
-    typedef double (*fty)(double);
-    // clang-format off
-    return __raptor_fwddiff<T>((fty)fn,
-                               raptor_const, inputs[0],
-                               raptor_const, inputs[1],
-                               raptor_dup, inputs[2], 1.0
-                               );
-    // clang-format on
+
+constexpr bool starts_with(const char *s, const char *prefix) {
+  for (; *prefix; s++, prefix++)
+    if (*s != *prefix)
+      return false;
+  return true;
+}
+
+constexpr bool equals(const char *a, const char *b) {
+  return starts_with(a, b) && starts_with(b, a);
+}
+
+// Whether `name` is one of the variants Flops.def instantiates for `op`, e.g.
+// sqrt, llvm_sqrt_f64, llvm_sqrt_f32 or __sqrt_finite.
+constexpr bool is_variant_of(const char *name, const char *op) {
+  if (starts_with(name, "llvm_"))
+    name += 5;
+  else if (starts_with(name, "__"))
+    name += 2;
+  for (; *op; name++, op++)
+    if (*name != *op)
+      return false;
+  return !*name || equals(name, "_f64") || equals(name, "_f32") ||
+         equals(name, "_f64_i32") || equals(name, "_finite");
+}
+
+// Evaluated at compile time by the wrappers, which pass the kernel of their
+// operation to __raptor_fprt_trace_flop.
+constexpr DerivativeKernel derivative_kernel(const char *name) {
+#define RAPTOR_DERIVATIVE(NAME, DX, DY, DZ)                                    \
+  if (is_variant_of(name, #NAME))                                              \
+    return DERIVATIVE_##NAME;
+#include "raptor/Derivatives.def"
+#undef RAPTOR_DERIVATIVE
+  return DERIVATIVE_NUMERIC;
+}
+
+template <DerivativeKernel Kernel, typename T, unsigned NumInputs>
+__attribute__((always_inline)) static inline void
+closed_form_derivatives(const std::array<T, NumInputs> &inputs, double r,
+                        int64_t n, std::array<double, NumInputs> &derivatives) {
+  std::array<double, fp_max_inputs> in = {};
+  for (unsigned i = 0; i < NumInputs; i++)
+    in[i] = inputs[i];
+  double x = in[0], y = in[1], z = in[2];
+  std::array<double, fp_max_inputs> d = {};
+  switch (Kernel) {
+#define RAPTOR_DERIVATIVE(NAME, DX, DY, DZ)                                    \
+  case DERIVATIVE_##NAME:                                                      \
+    d = {(double)(DX), (double)(DY), (double)(DZ)};                            \
+    break;
+#include "raptor/Derivatives.def"
+#undef RAPTOR_DERIVATIVE
+  case DERIVATIVE_NUMERIC:
+    break;
   }
-};
+  (void)z;
+  for (unsigned i = 0; i < NumInputs; i++)
+    derivatives[i] = d[i];
+}
 } // namespace
 
-template <typename T, unsigned NumInputs>
-__attribute__((always_inline)) static void
+// Records the inputs of `outfp`, the value recorded last, and their local
+// derivatives on the tape. The derivatives come from the closed form `Kernel`
+// if the operation has one and from a central difference of `fn` otherwise,
+// `n` is the integer argument of powi and ldexp.
+template <typename T, unsigned NumInputs,
+          DerivativeKernel Kernel = DERIVATIVE_NUMERIC>
+__attribute__((always_inline)) static inline void
 __raptor_fprt_trace_flop(std::array<T, NumInputs> _inputs, T output_val,
                          __raptor_fp *outfp, void *fn, const char *name,
-                         const char *loc) {
+                         const char *loc, int64_t n = 0) {
   std::array<__raptor_fp *, NumInputs> inputs;
   std::array<T, NumInputs> input_vals;
   for (unsigned i = 0; i < _inputs.size(); i++) {
@@ -227,42 +382,64 @@ __raptor_fprt_trace_flop(std::array<T, NumInputs> _inputs, T output_val,
   }
 
   outfp->setResult(output_val);
-  outfp->setInputNum(inputs.size());
-  outfp->setLoc(loc);
-  for (unsigned i = 0; i < inputs.size(); i++) {
-    outfp->setInput(i, inputs[i]);
-    T d;
-    static_assert(inputs.size() <= fp_max_inputs);
-    if (i == 0)
-      d = Derivative<T, NumInputs, 0>::get(fn, input_vals);
-    else if (i == 1)
-      d = Derivative<T, NumInputs, 1>::get(fn, input_vals);
-    else if (i == 2)
-      d = Derivative<T, NumInputs, 2>::get(fn, input_vals);
-    else
-      llvm_unreachable("impossible");
-    outfp->setDerivative(i, d);
+  std::array<uint64_t, NumInputs> input_ids;
+  std::array<double, NumInputs> derivatives;
+  static_assert(NumInputs <= fp_max_inputs);
+  for (unsigned i = 0; i < inputs.size(); i++)
+    input_ids[i] = inputs[i]->id;
+  if constexpr (Kernel != DERIVATIVE_NUMERIC) {
+    closed_form_derivatives<Kernel, T, NumInputs>(input_vals, output_val, n,
+                                                  derivatives);
+  } else if constexpr (NumInputs > 0) {
+    for (unsigned i = 0; i < NumInputs; i++)
+      derivatives[i] = numeric_derivative<T, NumInputs>(fn, input_vals, i);
+  }
+  if (FPs.writer) {
+    FPs.writer->value(FPs.pending_kind, loc, output_val, NumInputs,
+                      input_ids.data(), derivatives.data());
+  } else {
+    FPs.tape.values.back() = output_val;
+    for (unsigned i = 0; i < NumInputs; i++)
+      FPs.tape.add_input(input_ids[i], derivatives[i]);
   }
 
-#if RAPTOR_FPRT_TRACE_PRINT
-  outfp->setName(name);
-  print_raptor_fp(std::cerr, outfp);
-#endif
+  if (__raptor_fprt_diag_enabled(RAPTOR_FPRT_DIAG_TRACE) &&
+      __raptor_fprt_diag_select(loc)) {
+    if (!FPs.writer) {
+      while (FPs.names.size() <= outfp->id)
+        FPs.names.push_back(nullptr);
+      FPs.names[outfp->id] = name;
+    }
+    std::ostringstream line;
+    print_raptor_fp_function<T, NumInputs>(line, name, inputs);
+    line << " -> ";
+    print_raptor_fp_value(line, outfp);
+    for (unsigned i = 0; i < NumInputs; i++)
+      line << (i ? ", " : " ") << "d" << arg_names[i] << " = "
+           << derivatives[i];
+    print_trace_line(line, loc);
+  }
 }
 
-// TODO ultimately we probably want a linked list of arrays or something like
-// that for this (std::list probably is that but we may want our own impl)
-struct {
-  std::list<__raptor_fp> all;
-  std::list<__raptor_fp *> outputs;
-  std::list<__raptor_fp *> inputs;
-  std::list<__raptor_fp *> consts;
-  void clear() {
-    all.clear();
-    outputs.clear();
-    inputs.clear();
+static __raptor_fp *new_value(__raptor_tape_kind kind, const char *loc) {
+  if (FPs.writer) {
+    __raptor_fp *a;
+    if (FPs.free_values.empty()) {
+      a = &FPs.all.push_back({});
+    } else {
+      a = FPs.free_values.back();
+      FPs.free_values.pop_back();
+    }
+    a->id = FPs.next_id++;
+    FPs.pending_kind = kind;
+    return a;
   }
-} FPs;
+  uint64_t id = FPs.tape.add(kind, 0, loc);
+  __raptor_fp *a = &FPs.all.push_back({});
+  a->id = id;
+  FPs.next_id++;
+  return a;
+}
 
 extern "C" {
 
@@ -270,18 +447,17 @@ __raptor_fp *__raptor_fprt_ieee_64_new_intermediate(int64_t exponent,
                                                     int64_t significand,
                                                     int64_t mode,
                                                     const char *loc) {
-  size_t id = FPs.all.size();
-  FPs.all.push_back({});
-  __raptor_fp *a = &FPs.all.back();
-  a->id = id;
-  return a;
+  return new_value(RAPTOR_TAPE_OP, loc);
 }
 
 double __raptor_fprt_ieee_64_get(double _a, int64_t exponent,
                                  int64_t significand, int64_t mode,
                                  const char *loc) {
   __raptor_fp *a = __raptor_fprt_ieee_64_to_ptr(_a);
-  FPs.outputs.push_back(a);
+  if (FPs.writer)
+    FPs.writer->output(a->id);
+  else
+    FPs.tape.mark_output(a->id);
   __raptor_fprt_trace_no_res_flop<double, 1>({_a}, "get", loc);
   return a->getResult();
 }
@@ -289,9 +465,7 @@ double __raptor_fprt_ieee_64_get(double _a, int64_t exponent,
 double __raptor_fprt_ieee_64_new(double _a, int64_t exponent,
                                  int64_t significand, int64_t mode,
                                  const char *loc) {
-  __raptor_fp *a =
-      __raptor_fprt_ieee_64_new_intermediate(exponent, significand, mode, loc);
-  FPs.inputs.push_back(a);
+  __raptor_fp *a = new_value(RAPTOR_TAPE_INPUT, loc);
   __raptor_fprt_trace_flop<double, 0>({}, _a, a, nullptr, "new", loc);
   auto ret = __raptor_fprt_ptr_to_double(a);
   return ret;
@@ -302,9 +476,7 @@ double __raptor_fprt_ieee_64_const(double _a, int64_t exponent,
                                    const char *loc) {
   // TODO This should really be called only once for an appearance in the code,
   // currently it is called every time a flop uses a constant.
-  __raptor_fp *a =
-      __raptor_fprt_ieee_64_new_intermediate(exponent, significand, mode, loc);
-  FPs.consts.push_back(a);
+  __raptor_fp *a = new_value(RAPTOR_TAPE_CONST, loc);
   __raptor_fprt_trace_flop<double, 0>({}, _a, a, nullptr, "const", loc);
   auto ret = __raptor_fprt_ptr_to_double(a);
   return ret;
@@ -313,62 +485,76 @@ double __raptor_fprt_ieee_64_const(double _a, int64_t exponent,
 void __raptor_fprt_ieee_64_delete(double a, int64_t exponent,
                                   int64_t significand, int64_t mode,
                                   const char *loc) {
-  // TODO
   __raptor_fprt_trace_no_res_flop<double, 1>({a}, "delete", loc);
+  // The tape refers to values by id, so a streamed value can be reused.
+  if (FPs.writer)
+    FPs.free_values.push_back(__raptor_fprt_ieee_64_to_ptr(a));
 }
 
-// Below sensitivity computation is taken frmo ADAPT
-static double __raptor_estimate_truncation_error(double a) {
-  return abs(a - (float)a);
+// Every value is traced in double precision, truncated regions need neither
+// scratch space nor a change of precision.
+void *__raptor_fprt_ieee_64_get_scratch(int64_t to_e, int64_t to_m,
+                                        int64_t mode, const char *loc,
+                                        void *scratch) {
+  return nullptr;
 }
 
+void __raptor_fprt_ieee_64_free_scratch(int64_t to_e, int64_t to_m,
+                                        int64_t mode, const char *loc,
+                                        void *scratch) {}
+
+void __raptor_fprt_ieee_64_trunc_change(int64_t is_push, int64_t to_e,
+                                        int64_t to_m, int64_t mode,
+                                        const char *loc, void *scratch) {}
+
+// The sensitivity computation follows ADAPT, see raptor/Tape.h. It is a single
+// reverse sweep, linear in the length of the trace. A streamed trace is
+// analyzed offline with `raptor-report trace`.
 void __raptor_fprt_delete_all() {
-  size_t size = FPs.all.size();
-  size_t i = 0;
-  for (auto it = FPs.all.begin(); it != FPs.all.end(); i++, it++) {
-    // Do not truncate inputs
-    if (std::find(FPs.inputs.begin(), FPs.inputs.end(), &*it) !=
-        FPs.inputs.end())
-      continue;
-    // Or consts
-    if (std::find(FPs.consts.begin(), FPs.consts.end(), &*it) !=
-        FPs.consts.end())
-      continue;
+  if (FPs.writer) {
+    FPs.writer->flush();
+    return;
+  }
+  std::vector<double> sensitivities;
+  __raptor_tape_sensitivities(FPs.tape, sensitivities);
 
-    // Zero out all errors
-    // TODO is it faster to calloc each time or should we pre-allocate and
-    // memset?
-    double *errors = (double *)std::calloc(size, sizeof(*errors));
-    // Introduce truncation error into the current op
-    // TODO we can probably re-run the original operation in the truncated
-    // precision thus get the real error and not an estimation
-    errors[i] = __raptor_estimate_truncation_error(it->getResult());
-
-    size_t j = i;
-    for (auto jt = it; jt != FPs.all.end(); j++, jt++)
-      for (unsigned char k = 0; k < jt->getInputNum(); k++)
-        errors[j] += abs(jt->getDerivative(k) * errors[jt->getInput(k)->id]);
-
-#if RAPTOR_FPRT_TRACE_PRINT
-    std::cerr << "For instance ";
-    print_raptor_fp_value(std::cerr, &*it);
-    std::cerr << " when truncated from double to float:" << std::endl;
-
-    for (__raptor_fp *output : FPs.outputs) {
-      std::cerr << "    wrt output ";
-      print_raptor_fp_value(std::cerr, output);
-      std::cerr << " at " << output->getLoc()
-                << ", sensitivity = " << errors[output->id] << std::endl;
+  std::map<const char *, std::pair<double, size_t>> sites;
+  for (size_t i = 0; i < sensitivities.size(); i++) {
+    if ((FPs.tape.kinds[i] & RAPTOR_TAPE_KIND_MASK) != RAPTOR_TAPE_OP)
+      continue;
+    auto &site = sites[FPs.tape.locs[i]];
+    site.first += sensitivities[i];
+    site.second++;
+    // Only the values whose operation was printed have a name.
+    if (i < FPs.names.size() && FPs.names[i]) {
+      std::ostringstream line;
+      line << "For instance ";
+      print_raptor_fp_value(line, &FPs.all[i]);
+      line << " of " << FPs.names[i]
+           << " when truncated from double to float: sensitivity = "
+           << sensitivities[i];
+      print_trace_line(line, FPs.tape.locs[i]);
     }
-#endif
   }
+
+  std::vector<std::pair<const char *, std::pair<double, size_t>>> sorted(
+      sites.begin(), sites.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a.second.first > b.second.first;
+  });
+  std::cerr << "Sensitivity of the outputs to truncating each site from "
+               "double to float, over "
+            << FPs.tape.size() << " traced values:" << std::endl;
+  for (auto &[loc, site] : sorted)
+    std::cerr << "  " << site.first << " (" << site.second
+              << " values) at " << (loc ? loc : "unknown") << std::endl;
   FPs.clear();
 }
 
 #define __RAPTOR_MPFR_SINGOP(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE, \
                              RET, MPFR_GET, ARG1, MPFR_SET_ARG1,               \
                              ROUNDING_MODE)                                    \
-  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  __RAPTOR_MPFR_ORIGINAL_ATTRIBUTES                                            \
   RET __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(ARG1 a); \
   __RAPTOR_MPFR_ATTRIBUTES                                                     \
   RET __raptor_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
@@ -381,8 +567,8 @@ void __raptor_fprt_delete_all() {
         exponent, significand, mode, loc);                                     \
     intermediate->setResult(res);                                              \
     double ret = __raptor_fprt_ptr_to_double(intermediate);                    \
-    __raptor_fprt_trace_flop<RET, 1>({a}, res, intermediate,                   \
-                                     (void *)originalfn, #LLVM_OP_NAME, loc);  \
+    __raptor_fprt_trace_flop<RET, 1, derivative_kernel(#LLVM_OP_NAME)>(        \
+        {a}, res, intermediate, (void *)originalfn, #LLVM_OP_NAME, loc);       \
     return ret;                                                                \
   }
 
@@ -400,14 +586,13 @@ void __raptor_fprt_delete_all() {
           const char *loc) {                                                   \
     auto originalfn =                                                          \
         __raptor_fprt_original_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME;       \
-    RET res = originalfn(__raptor_fprt_ieee_64_to_ptr(a)->getResult(),         \
-                         __raptor_fprt_ieee_64_to_ptr(b)->getResult());        \
+    RET res = originalfn(__raptor_fprt_ieee_64_to_ptr(a)->getResult(), b);     \
     __raptor_fp *intermediate = __raptor_fprt_ieee_64_new_intermediate(        \
         exponent, significand, mode, loc);                                     \
     intermediate->setResult(res);                                              \
     double ret = __raptor_fprt_ptr_to_double(intermediate);                    \
-    __raptor_fprt_trace_flop<RET, 1>({a}, res, intermediate,                   \
-                                     (void *)originalfn, #LLVM_OP_NAME, loc);  \
+    __raptor_fprt_trace_flop<RET, 1, derivative_kernel(#LLVM_OP_NAME)>(        \
+        {a}, res, intermediate, (void *)originalfn, #LLVM_OP_NAME, loc, b);    \
     return ret;                                                                \
   }
 
@@ -429,8 +614,8 @@ void __raptor_fprt_delete_all() {
         exponent, significand, mode, loc);                                     \
     intermediate->setResult(res);                                              \
     double ret = __raptor_fprt_ptr_to_double(intermediate);                    \
-    __raptor_fprt_trace_flop<RET, 2>({a, b}, res, intermediate,                \
-                                     (void *)originalfn, #LLVM_OP_NAME, loc);  \
+    __raptor_fprt_trace_flop<RET, 2, derivative_kernel(#LLVM_OP_NAME)>(        \
+        {a, b}, res, intermediate, (void *)originalfn, #LLVM_OP_NAME, loc);    \
     return ret;                                                                \
   }
 
@@ -452,11 +637,23 @@ void __raptor_fprt_delete_all() {
         exponent, significand, mode, loc);                                      \
     intermediate->setResult(res);                                               \
     double ret = __raptor_fprt_ptr_to_double(intermediate);                     \
-    __raptor_fprt_trace_flop<TYPE, 3>({a, b, c}, res, intermediate,             \
-                                      (void *)originalfn, #LLVM_OP_NAME, loc);  \
+    __raptor_fprt_trace_flop<TYPE, 3, derivative_kernel(#LLVM_OP_NAME)>(        \
+        {a, b, c}, res, intermediate, (void *)originalfn, #LLVM_OP_NAME, loc);  \
     return ret;                                                                 \
   }
 
+// The result is an integer, the value is not traced.
+#define __RAPTOR_MPFR_LROUND(OP_TYPE, LLVM_OP_NAME, FROM_TYPE, RET, ARG1,      \
+                             MPFR_SET_ARG1, ROUNDING_MODE)                     \
+  __RAPTOR_MPFR_ATTRIBUTES                                                     \
+  RET __raptor_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
+      ARG1 a, int64_t exponent, int64_t significand, int64_t mode,             \
+      const char *loc) {                                                       \
+    RET res = std::lround(__raptor_fprt_ieee_64_to_ptr(a)->getResult());       \
+    __raptor_fprt_trace_no_res_flop<ARG1, 1>({a}, #LLVM_OP_NAME, loc);         \
+    return res;                                                                \
+  }
+
 #define __RAPTOR_MPFR_FCMP_IMPL(NAME, ORDERED, CMP, FROM_TYPE, TYPE, MPFR_GET, \
                                 ROUNDING_MODE)                                 \
   __RAPTOR_MPFR_ORIGINAL_ATTRIBUTES                                            \
@@ -483,6 +680,6 @@ __RAPTOR_MPFR_ATTRIBUTES bool __raptor_fprt_ieee_64_intr_llvm_is_fpclass_f64(
       __raptor_fprt_ieee_64_to_ptr(a)->getResult(), tests);
 }
 
-#include <raptor/fprt/flops.def>
+#include "../ir/Flops.def"
 
 } // extern "C"
@@ -0,0 +1,43 @@
+// clang-format off
+// RUN: if [ "%hasMPI" == "1" ]; then %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorRTMPI %linkRaptorChecksRT %mpiFlags -lm -lmpfr && RAPTOR_FPRT_MPI_REPORT=10 %mpirun -n 4 %t.a.out 2>&1 | %FileCheck %s; fi
+
+// Rank r compares and adds r + 1 times, 1 + 2 + 3 + 4 = 10 operations per site
+// across the ranks. The comparison of 1 + 2^-30 and 1 always flips with 23
+// significand bits, the addition stays below the violation threshold.
+// CHECK: Information about top 2 of 2 operations across 4 ranks.
+// CHECK-NEXT: mpi-report.cpp:[[@LINE+19]]:{{[0-9]+}}: 10xfcmp_ogt L1 Error Norm: 0 Number of violations: 10 Ignored 0 times.
+// CHECK-NEXT: mpi-report.cpp:[[@LINE+14]]:{{[0-9]+}}: 10xfadd L1 Error Norm: {{[0-9.e+-]+}} Number of violations: 0 Ignored 0 times.
+// CHECK-NOT: Information about top
+// clang-format on
+
+#include <mpi.h>
+
+#include "../../test_utils.h"
+
+#define FROM 64
+#define TO 1, 8, 23
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline)) double add(double a, double b) {
+  return a + b;
+}
+
+__attribute__((noinline)) double greater(double a, double b) {
+  return a > b;
+}
+
+int main(int argc, char **argv) {
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  volatile double tiny = 0x1p-30;
+  for (int i = 0; i <= rank; i++) {
+    TEST_EQ(__raptor_truncate_op_func(add, FROM, TO)(1, tiny), 1);
+    TEST_EQ(__raptor_truncate_op_func(greater, FROM, TO)(1 + tiny, 1), 0);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -4,6 +4,10 @@
 // RUN: %clang                           -O1 -g             %s -o %t.a.out %loadClangRaptor %linkRaptorRT -lm -lmpfr && %t.a.out
 // RUN: %clang    -DTRUNC_MEM -DTRUNC_OP -O2                %s -o %t.a.out %loadClangRaptor %linkRaptorRT -lm -lmpfr && %t.a.out
 // RUN: %clang -g -DTRUNC_MEM -DTRUNC_OP -O2                %s -o %t.a.out %loadClangRaptor %linkRaptorRT -lm -lmpfr && %t.a.out
+// RUN: %clang                -DTRUNC_OP -O2                %s -o %t.a.out %loadClangRaptor %linkRaptorOpRT -lm -lmpfr && %t.a.out
+// RUN: %clang    -DTRUNC_MEM -DTRUNC_OP -O2                %s -o %t.a.out %loadClangRaptor %linkRaptorLeakRT -lm -lmpfr && %t.a.out
+// RUN: %clang    -DTRUNC_MEM -DTRUNC_OP -O2                %s -o %t.a.out %loadClangRaptor %linkRaptorShadowRT -lm -lmpfr && %t.a.out
+// RUN: %clang    -DTRUNC_MEM            -O2                %s -o %t.a.out %loadClangRaptor %linkRaptorTraceRT -lm && %t.a.out
 
 #include <math.h>
 
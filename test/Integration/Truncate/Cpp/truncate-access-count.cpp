@@ -0,0 +1,47 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-access-count -lm && %t.a.out
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-access-count -mllvm --raptor-count-per-access -lm && %t.a.out
+
+#include <cstdio>
+
+#include "../../test_utils.h"
+
+extern "C" long long __raptor_get_memory_access_original_load();
+extern "C" long long __raptor_get_memory_access_original_store();
+
+#define N 100
+
+__attribute__((noinline))
+double sum(double *A, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++)
+        if (A[i] > 0)
+            s += A[i];
+    return s;
+}
+
+__attribute__((noinline))
+void scale(double *A, int n) {
+    for (int i = 0; i < n; i++)
+        A[i] = A[i] * 2;
+}
+
+int main() {
+    double A[N];
+    for (int i = 0; i < N; i++)
+        A[i] = i % 3 - 1;
+
+    long long load = __raptor_get_memory_access_original_load();
+    long long store = __raptor_get_memory_access_original_store();
+    sum(A, N);
+    long long load_sum = __raptor_get_memory_access_original_load();
+    long long store_sum = __raptor_get_memory_access_original_store();
+    scale(A, N);
+    long long load_scale = __raptor_get_memory_access_original_load();
+    long long store_scale = __raptor_get_memory_access_original_store();
+
+    TEST_EQ(load_sum - load, N * sizeof(double));
+    TEST_EQ(store_sum - store, 0);
+    TEST_EQ(load_scale - load_sum, N * sizeof(double));
+    TEST_EQ(store_scale - store_sum, N * sizeof(double));
+}
@@ -0,0 +1,39 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %loadClangRaptor %linkRaptorRT -mllvm --raptor-truncate-access-count -mllvm --raptor-count-per-access -lm -lmpfr && env RAPTOR_FPRT_CACHE=l1=4k:4,l2=64k:8,line=64 %t.a.out 2>&1 | FileCheck %s
+
+// CHECK: Cache simulation of {{[0-9]+}} functions: L1 4 KiB 4-way, L2 64 KiB 8-way, 64 byte lines.
+// The truncated accesses of scale and the later ones of sum are shrunk. Read
+// and written back as floats, scale moves about half of its DRAM traffic.
+// CHECK-DAG: {{ +[0-9]+ +[1-9][0-9]* .* +[1-9][0-9]* +[1-9][0-9]* +(4[5-9]|5[0-5])\.[0-9]%}}  scale(double*, int)
+// CHECK-DAG: {{ +[0-9]+ +[1-9][0-9]* .*}}  sum(double*, int)
+
+#include <cstdio>
+
+#include "../../test_utils.h"
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+#define N 100000
+
+__attribute__((noinline))
+double sum(double *A, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++)
+        s += A[i];
+    return s;
+}
+
+__attribute__((noinline))
+void scale(double *A, int n) {
+    for (int i = 0; i < n; i++)
+        A[i] = A[i] * 2;
+}
+
+static double A[N];
+
+int main() {
+    for (int i = 0; i < N; i++)
+        A[i] = i % 7;
+    __raptor_truncate_op_func(scale, 64, 1, 8, 23)(A, N);
+    APPROX_EQ(sum(A, N), 2 * 299995.0, 1e-3);
+}
@@ -0,0 +1,37 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorChecksRT -lm -lmpfr && env RAPTOR_FPRT_OP_DUMP=%t.dump %t.a.out | FileCheck %s
+// RUN: %raptor-report csv %t.dump | FileCheck %s --check-prefix=CSV
+
+// (1 + 2^-20) - 1 = 2^-20 loses 20 bits, x - x cancels to exactly zero.
+// CHECK-DAG: truncate-cancellation.cpp:[[@LINE+16]]:{{[0-9]+}}: 4xfsub L1 Error Norm: 0 Number of violations: 0 Ignored 0 times. Bits lost to cancellation: 20:4{{$}}
+// CHECK-DAG: truncate-cancellation.cpp:[[@LINE+20]]:{{[0-9]+}}: 4xfsub L1 Error Norm: 0 Number of violations: 0 Ignored 0 times. Bits lost to cancellation: all:4{{$}}
+
+// CSV-DAG: "{{.*}}truncate-cancellation.cpp:[[@LINE+13]]:{{[0-9]+}}","fsub",4,0,0,0,0,0,0,20:4{{$}}
+// CSV-DAG: "{{.*}}truncate-cancellation.cpp:[[@LINE+17]]:{{[0-9]+}}","fsub",4,0,0,0,0,0,0,all:4{{$}}
+
+#include "../../test_utils.h"
+
+#define FROM 64
+#define TO 1, 8, 23
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+extern "C" void raptor_fprt_op_dump_status(int num);
+
+__attribute__((noinline))
+double sub(double a, double b) {
+  return a - b;
+}
+
+__attribute__((noinline))
+double sub_self(double a) {
+  return a - a;
+}
+
+int main() {
+  volatile double a = 1 + 0x1p-20;
+  for (int i = 0; i < 4; i++) {
+    TEST_EQ(__raptor_truncate_op_func(sub, FROM, TO)(a, 1) == 0x1p-20, 1);
+    TEST_EQ(__raptor_truncate_op_func(sub_self, FROM, TO)(a), 0);
+  }
+  raptor_fprt_op_dump_status(10);
+}
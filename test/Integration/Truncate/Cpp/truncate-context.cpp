@@ -0,0 +1,68 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %loadClangRaptor %linkRaptorRT -mllvm --raptor-calling-context -lm -lmpfr && env RAPTOR_FPRT_CONTEXT=%t.folded %t.a.out && FileCheck %s --implicit-check-not="thrower(double*, int);" < %t.folded
+
+// CHECK-DAG: {{^}}run(double*, int);first(double*, int);kernel(double*, int, double) {{[1-9][0-9]*$}}
+// CHECK-DAG: {{^}}run(double*, int);second(double*, int);kernel(double*, int, double) {{[1-9][0-9]*$}}
+// The context of thrower is popped when its exception is caught in recover.
+// CHECK-DAG: {{^}}run(double*, int);recover(double*, int);thrower(double*, int) {{[1-9][0-9]*$}}
+// CHECK-DAG: {{^}}run(double*, int);recover(double*, int);kernel(double*, int, double) {{[1-9][0-9]*$}}
+
+#include "../../test_utils.h"
+
+#define N 10
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline))
+void kernel(double *A, int n, double scale) {
+    for (int i = 0; i < n; i++)
+        A[i] = A[i] * scale + 1;
+}
+
+__attribute__((noinline))
+void first(double *A, int n) {
+    kernel(A, n, 2);
+}
+
+__attribute__((noinline))
+void second(double *A, int n) {
+    kernel(A, n, 0.5);
+    kernel(A, n, 3);
+}
+
+__attribute__((noinline))
+void thrower(double *A, int n) {
+    for (int i = 0; i < n; i++)
+        A[i] = A[i] * 0.5;
+    if (A[0] >= 0)
+        throw n;
+}
+
+__attribute__((noinline))
+void recover(double *A, int n) {
+    try {
+        thrower(A, n);
+    } catch (int) {
+    }
+    kernel(A, n, 2);
+}
+
+__attribute__((noinline))
+void run(double *A, int n) {
+    first(A, n);
+    second(A, n);
+    recover(A, n);
+}
+
+int main() {
+    double A[N];
+    double B[N];
+    for (int i = 0; i < N; i++)
+        A[i] = B[i] = i;
+
+    run(A, N);
+    __raptor_truncate_op_func(run, 64, 1, 11, 52)(B, N);
+
+    for (int i = 0; i < N; i++)
+        APPROX_EQ(A[i], B[i], 1e-10);
+}
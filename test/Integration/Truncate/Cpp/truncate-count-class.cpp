@@ -0,0 +1,81 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -lm && %t.a.out
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-count-per-access -lm && %t.a.out
+
+#include <cstdio>
+#include <cmath>
+
+#include "../../test_utils.h"
+
+// See raptor_fprt_precision and raptor_fprt_op_class in raptor/raptor.h.
+#define DOUBLE 1
+#define ADD 0
+#define MUL 1
+#define FMA 2
+#define DIV 3
+#define SQRT 4
+#define TRANSCENDENTAL 5
+#define COMPARE 6
+#define CONVERSION 7
+#define SIGN 8
+#define NUM_OP_CLASSES 9
+
+extern "C" long long __raptor_get_double_flop_count();
+extern "C" long long __raptor_get_flop_count_by_class(int, int);
+extern "C" double __raptor_get_weighted_flop_count(int);
+extern "C" void raptor_fprt_set_op_class_cost(int, int, double);
+extern "C" void __raptor_counters_reset();
+
+#define N 10
+
+__attribute__((noinline))
+double classes(double a, double b) {
+    double d = sqrt(a) / b;
+    double m = fma(a, b, a);
+    double p = m * floor(b);
+    double e = exp(a);
+    double c = a < b ? e : b;
+    return d + p + fmax(c, fabs(b));
+}
+
+__attribute__((noinline))
+double compute(double *A, double *B, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++)
+        s += classes(A[i], B[i]);
+    return s;
+}
+
+int main() {
+    double A[N];
+    double B[N];
+
+    for (int i = 0; i < N; i++) {
+        A[i] = 1 + i % 5;
+        B[i] = 1 + i % 3;
+    }
+    // Converting the indices counts as well.
+    __raptor_counters_reset();
+
+    compute(A, B, N);
+
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, ADD), 3 * N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, MUL), N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, FMA), N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, DIV), N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, SQRT), N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, TRANSCENDENTAL), N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, COMPARE), 2 * N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, CONVERSION), N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, SIGN), N);
+    TEST_EQ(__raptor_get_double_flop_count(), 12 * N);
+
+    // The comparisons of the checks below are counted as well, they cost
+    // nothing.
+    for (int c = 0; c < NUM_OP_CLASSES; c++)
+        raptor_fprt_set_op_class_cost(DOUBLE, c, 1);
+    raptor_fprt_set_op_class_cost(DOUBLE, COMPARE, 0);
+    TEST_EQ(__raptor_get_weighted_flop_count(DOUBLE), 10 * N);
+    raptor_fprt_set_op_class_cost(DOUBLE, TRANSCENDENTAL, 20);
+    TEST_EQ(__raptor_get_weighted_flop_count(DOUBLE), 29 * N);
+}
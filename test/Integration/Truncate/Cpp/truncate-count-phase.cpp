@@ -0,0 +1,64 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-truncate-access-count -lm && %t.a.out
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-truncate-access-count -mllvm --raptor-count-per-access -lm && %t.a.out
+
+#include <cstdio>
+
+#include "../../test_utils.h"
+
+// See raptor_counters in raptor/raptor.h.
+#define NUM_PRECISIONS 4
+#define NUM_OP_CLASSES 9
+#define DOUBLE 1
+#define MUL 1
+
+typedef struct raptor_counters {
+  long long flops[NUM_PRECISIONS];
+  long long flops_by_class[NUM_PRECISIONS][NUM_OP_CLASSES];
+  long long vector_flops[NUM_PRECISIONS];
+  long long trunc_load;
+  long long trunc_store;
+  long long original_load;
+  long long original_store;
+} raptor_counters;
+
+extern "C" void __raptor_counters_snapshot(raptor_counters *);
+extern "C" void __raptor_counters_reset();
+extern "C" void __raptor_phase_begin(const char *);
+extern "C" void __raptor_phase_end();
+extern "C" long long __raptor_get_double_flop_count();
+
+#define N 100
+
+__attribute__((noinline))
+void scale(double *A, int n) {
+    for (int i = 0; i < n; i++)
+        A[i] = A[i] * 2;
+}
+
+int main() {
+    double A[N];
+    for (int i = 0; i < N; i++)
+        A[i] = i;
+
+    raptor_counters before, after;
+    __raptor_phase_begin("scale");
+    __raptor_counters_snapshot(&before);
+    scale(A, N);
+    __raptor_counters_snapshot(&after);
+    __raptor_phase_end();
+
+    TEST_EQ(after.flops[DOUBLE] - before.flops[DOUBLE], N);
+    TEST_EQ(after.flops_by_class[DOUBLE][MUL] -
+                before.flops_by_class[DOUBLE][MUL], N);
+    TEST_EQ(after.original_load - before.original_load, N * sizeof(double));
+    TEST_EQ(after.original_store - before.original_store, N * sizeof(double));
+
+    __raptor_counters_reset();
+    TEST_EQ(__raptor_get_double_flop_count(), 0);
+    __raptor_counters_snapshot(&after);
+    TEST_EQ(after.original_load, 0);
+
+    scale(A, N);
+    TEST_EQ(__raptor_get_double_flop_count(), N);
+}
@@ -0,0 +1,78 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-count-profile -lm && %t.a.out %t.prof
+// RUN: %clang -O2 -g %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-count-profile -mllvm --raptor-count-per-access -lm && %t.a.out %t.prof
+// RUN: %clang -O2 -g %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-count-profile -mllvm --raptor-truncate-access-count -lm && %t.a.out %t.prof
+// RUN: printf 'peak.double = 1G\npeak.float = 2G\nbandwidth = 10G # bytes/s\n' > %t.machine
+// RUN: %raptor-report roofline -m %t.machine %t.prof | FileCheck %s
+
+// sum loads 8 bytes per addition and is compute bound on this machine, scale
+// loads and stores 16 bytes per multiplication and main only stores A.
+// CHECK: Roofline projection of the top 3 of 3 functions, truncated flops are double in the original program.
+// CHECK-NEXT: double peak 1e+09 FLOP/s, ridge point 0.100 flop/byte
+// CHECK-NEXT: float peak 2e+09 FLOP/s, ridge point 0.200 flop/byte
+// CHECK-NEXT: flops bytes flop/byte bound time [s] trunc xfloat function
+// CHECK-NEXT: 200 3200 0.06{{[23]}} memory 3.2000e-07 0.00% 1.000 scale
+// CHECK-NEXT: 100 800 0.125 compute 1.0000e-07 0.00% 1.000 sum
+// CHECK-NEXT: 0 800 0.000 memory 8.0000e-08 0.00% 1.000 main
+// CHECK-NEXT: 300 4800 0.06{{[23]}} memory 5.0000e-07 0.00% 1.000 <total>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../../test_utils.h"
+
+extern "C" int raptor_fprt_profile_write(const char *);
+
+#define N 100
+
+extern "C" __attribute__((noinline))
+double sum(double *A, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++)
+        s += A[i];
+    return s;
+}
+
+extern "C" __attribute__((noinline))
+void scale(double *A, int n) {
+    for (int i = 0; i < n; i++)
+        A[i] = A[i] * 2;
+}
+
+// Returns the flops of the function row of `function` in the profile.
+static long long function_flops(const char *path, const char *function) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char line[4096];
+    long long flops = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "function\t", 9))
+            continue;
+        line[strcspn(line, "\n")] = 0;
+        char *fields[32];
+        int num = 0;
+        for (char *field = strtok(line, "\t"); field && num < 32;
+             field = strtok(nullptr, "\t"))
+            fields[num++] = field;
+        if (num >= 4 && !strcmp(fields[num - 2], function))
+            flops = atoll(fields[1]);
+    }
+    fclose(f);
+    return flops;
+}
+
+int main(int argc, char **argv) {
+    double A[N];
+    for (int i = 0; i < N; i++)
+        A[i] = 1;
+
+    scale(A, N);
+    scale(A, N);
+    printf("%f\n", sum(A, N));
+
+    TEST_EQ(raptor_fprt_profile_write(argv[1]), 0);
+    TEST_EQ(function_flops(argv[1], "sum"), N);
+    TEST_EQ(function_flops(argv[1], "scale"), 2 * N);
+}
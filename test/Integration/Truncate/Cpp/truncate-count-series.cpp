@@ -0,0 +1,93 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -lm && env RAPTOR_FPRT_SERIES=%t.series RAPTOR_FPRT_SERIES_PERIOD=0.01 %t.a.out %t.series
+// RUN: %raptor-report series %t.series | FileCheck %s --check-prefix=SERIES
+// RUN: %clang -O2 -g %s -o %t.checks.out %loadClangRaptor %linkRaptorChecksRT -mllvm --raptor-truncate-count -lm -lmpfr && env RAPTOR_FPRT_SERIES=%t.checks.series RAPTOR_FPRT_SERIES_PERIOD=0.01 %t.checks.out %t.checks.series
+// RUN: %raptor-report series %t.checks.series | FileCheck %s --check-prefix=CHECKS
+// RUN: %raptor-report series-sites %t.checks.series | FileCheck %s --check-prefix=SITES
+
+// Both sums have run before the last samples, only the checks runtime records
+// the residuals of the truncated one at its site.
+// SERIES: time,trunc,double,float,half,vector,trunc_load,trunc_store,original_load,original_store,count,violations
+// SERIES: {{^[0-9]+\.[0-9]+}},100,100,0,0,0,{{[0-9]+,[0-9]+,[0-9]+,[0-9]+}},0,0{{$}}
+// CHECKS: time,trunc,double,float,half,vector,trunc_load,trunc_store,original_load,original_store,count,violations
+// CHECKS: {{^[0-9]+\.[0-9]+}},100,100,0,0,0,{{[0-9]+,[0-9]+,[0-9]+,[0-9]+}},100,0{{$}}
+// SITES: time,location,count,violations
+// SITES: {{^[0-9]+\.[0-9]+}},"{{.*}}truncate-count-series.cpp:[[@LINE+19]]:{{[0-9]+}}",100,0{{$}}
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "../../test_utils.h"
+
+#define N 100
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline))
+double sum(double *A, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++)
+        s += A[i];
+    return s;
+}
+
+// See raptor_series_header, raptor_series_record and raptor_series_sample in
+// raptor/Series.h and raptor_fprt_precision in raptor/raptor.h.
+#define HEADER_SIZE 32
+#define SAMPLE 2
+#define TRUNC 0
+#define DOUBLE 1
+
+// Returns the flops of `precision` in the last complete sample of the series.
+static long long last_sample_flops(const char *path, int precision) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    std::vector<char> data;
+    char buf[4096];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), f));)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    if (data.size() < HEADER_SIZE || memcmp(data.data(), "RAPTORTS", 8))
+        return -1;
+
+    long long flops = -1;
+    size_t offset = HEADER_SIZE;
+    uint32_t record[2]; // Type and size of the payload.
+    // The sampler may still be writing the last record.
+    while (offset + sizeof(record) <= data.size()) {
+        memcpy(record, data.data() + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record[1] > data.size() - offset)
+            break;
+        if (record[0] == SAMPLE) {
+            // The counters follow the time of the sample.
+            int64_t counts[DOUBLE + 1];
+            memcpy(counts, data.data() + offset + sizeof(int64_t),
+                   sizeof(counts));
+            flops = counts[precision];
+        }
+        offset += record[1];
+    }
+    return flops;
+}
+
+int main(int argc, char **argv) {
+    // Only the sums count, neither the initialization nor comparisons.
+    double A[N];
+    for (int i = 0; i < N; i++)
+        A[i] = 1;
+    double s = sum(A, N);
+    double t = __raptor_truncate_op_func(sum, 64, 1, 8, 23)(A, N);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Samples are appended and flushed while the program runs.
+    TEST_EQ(last_sample_flops(argv[1], DOUBLE), N);
+    TEST_EQ(last_sample_flops(argv[1], TRUNC), N);
+    TEST_EQ(s, N);
+    TEST_EQ(t, N);
+}
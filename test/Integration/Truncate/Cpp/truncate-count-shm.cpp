@@ -0,0 +1,94 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -lm && env RAPTOR_FPRT_SHM=1 RAPTOR_FPRT_SHM_SLOTS=4 %t.a.out
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../../test_utils.h"
+
+extern "C" long long __raptor_get_double_flop_count();
+
+#define N 100
+
+__attribute__((noinline))
+double sum(double *A, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++)
+        s += A[i];
+    return s;
+}
+
+// See __raptor_shm_header and __raptor_counter_slot in raptor/Shm.h.
+#define MAGIC 0x4d48535254504152ull
+#define VERSION 2
+#define HEADER_SIZE 128
+#define SLOT_SIZE 448
+#define HEADER_VERSION 8
+#define HEADER_SLOT_SIZE 12
+#define HEADER_MAX_SLOTS 16
+#define HEADER_PID 20
+#define HEADER_NUM_SLOTS 32
+#define HEADER_EXITED 36
+#define HEADER_COMMAND 40
+#define SLOT_SEQ 0
+#define SLOT_COUNTERS 16
+#define DOUBLE 1
+
+template <typename T> static T field(const char *data, size_t offset) {
+    T value;
+    memcpy(&value, data + offset, sizeof(value));
+    return value;
+}
+
+int main() {
+    double A[N];
+    for (int i = 0; i < N; i++)
+        A[i] = i;
+
+    long long before = __raptor_get_double_flop_count();
+    sum(A, N);
+    std::thread t([&] { sum(A, N); });
+    t.join();
+    long long after = __raptor_get_double_flop_count();
+    TEST_EQ(after - before, 2 * N);
+
+    // The counters of both threads are published while the program runs.
+    std::string segment = "/dev/shm/raptor." + std::to_string(getpid());
+    int fd = open(segment.c_str(), O_RDONLY);
+    TEST_EQ(fd >= 0, true);
+    struct stat st;
+    TEST_EQ(fstat(fd, &st), 0);
+    TEST_EQ(st.st_size, HEADER_SIZE + 4 * SLOT_SIZE);
+    const char *data = (const char *)mmap(nullptr, st.st_size, PROT_READ,
+                                          MAP_SHARED, fd, 0);
+    close(fd);
+    TEST_EQ(data != MAP_FAILED, true);
+
+    TEST_EQ(field<uint64_t>(data, 0), MAGIC);
+    TEST_EQ(field<uint32_t>(data, HEADER_VERSION), VERSION);
+    TEST_EQ(field<uint32_t>(data, HEADER_SLOT_SIZE), SLOT_SIZE);
+    TEST_EQ(field<uint32_t>(data, HEADER_MAX_SLOTS), 4);
+    TEST_EQ(field<int32_t>(data, HEADER_PID), getpid());
+    TEST_EQ(field<uint32_t>(data, HEADER_EXITED), 0);
+    // /proc/self/comm keeps the first 15 characters of the executable name.
+    TEST_EQ(strncmp(data + HEADER_COMMAND, "truncate-count-", 15), 0);
+
+    // The main thread counted first, the other thread got the second slot.
+    // Neither writes its slot while it is read here, so every sequence is even.
+    TEST_EQ(field<uint32_t>(data, HEADER_NUM_SLOTS), 2);
+    long long flops[2];
+    for (int i = 0; i < 2; i++) {
+        const char *slot = data + HEADER_SIZE + i * SLOT_SIZE;
+        TEST_EQ(field<uint32_t>(slot, SLOT_SEQ) % 2, 0);
+        flops[i] = field<int64_t>(slot, SLOT_COUNTERS + DOUBLE * 8);
+    }
+    TEST_EQ(flops[0], after - N);
+    TEST_EQ(flops[1], N);
+    munmap((void *)data, st.st_size);
+}
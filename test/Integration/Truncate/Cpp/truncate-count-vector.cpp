@@ -0,0 +1,63 @@
+// clang-format off
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -lm && %t.a.out
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-count-per-access -lm && %t.a.out
+
+#include <cstdio>
+
+#include "../../test_utils.h"
+
+// See raptor_fprt_precision and raptor_fprt_op_class in raptor/raptor.h.
+#define DOUBLE 1
+#define ADD 0
+#define MUL 1
+
+extern "C" long long __raptor_get_double_flop_count();
+extern "C" long long __raptor_get_vector_flop_count(int);
+extern "C" long long __raptor_get_flop_count_by_class(int, int);
+
+typedef double double4 __attribute__((ext_vector_type(4)));
+
+#define N 10
+#define M 1001
+
+__attribute__((noinline))
+double4 axpy(double a, double4 x, double4 y) {
+    double4 ax = a * x;
+    return ax + y;
+}
+
+// Vectorized at -O2, with a scalar remainder.
+__attribute__((noinline))
+void add(double *A, double *B, double *C, int n) {
+    for (int i = 0; i < n; i++)
+        C[i] = A[i] + B[i];
+}
+
+int main() {
+    double4 X[N];
+    double4 Y[N];
+    for (int i = 0; i < N; i++) {
+        X[i] = (double4){1, 2, 3, 4};
+        Y[i] = (double4){5, 6, 7, 8};
+    }
+
+    for (int i = 0; i < N; i++)
+        Y[i] = axpy(2, X[i], Y[i]);
+
+    TEST_EQ(__raptor_get_double_flop_count(), 8 * N);
+    TEST_EQ(__raptor_get_vector_flop_count(DOUBLE), 8 * N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, ADD), 4 * N);
+    TEST_EQ(__raptor_get_flop_count_by_class(DOUBLE, MUL), 4 * N);
+
+    double A[M];
+    double B[M];
+    double C[M];
+    for (int i = 0; i < M; i++) {
+        A[i] = i;
+        B[i] = 2 * i;
+    }
+
+    long long flops = __raptor_get_double_flop_count();
+    add(A, B, C, M);
+    TEST_EQ(__raptor_get_double_flop_count() - flops, M);
+}
@@ -1,5 +1,6 @@
 // clang-format off
 // RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -lm && %t.a.out
+// RUN: %clang -O2 %s -o %t.a.out %linkRaptorRT %loadClangPluginRaptor -mllvm --raptor-truncate-count -mllvm --raptor-count-per-access -lm && %t.a.out
 
 #include <cstdio>
 #include <cmath>
@@ -14,6 +15,7 @@ template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int
 
 extern "C" long long __raptor_get_double_flop_count();
 extern "C" long long __raptor_get_trunc_flop_count();
+extern "C" void __raptor_counters_reset();
 
 #define N 10
 
@@ -53,6 +55,8 @@ int main() {
         A[i] = 1 + i % 5;
         B[i] = 1 + i % 3;
     }
+    // Converting the indices counts as well.
+    __raptor_counters_reset();
 
     TEST_EQ(__raptor_get_double_flop_count(), 0);
     TEST_EQ(__raptor_get_trunc_flop_count(), 0);
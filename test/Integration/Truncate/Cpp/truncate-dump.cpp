@@ -0,0 +1,37 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorRT -lm -lmpfr && env RAPTOR_FPRT_DUMP=1 RAPTOR_FPRT_DIAG_SITES=truncate-dump.cpp RAPTOR_FPRT_DIAG_EVERY=4 RAPTOR_FPRT_DIAG_OUTPUT=%t.log %t.a.out && FileCheck %s < %t.log
+// RUN: env RAPTOR_FPRT_DUMP=1 RAPTOR_FPRT_DIAG_SITES=other.cpp:1 RAPTOR_FPRT_DIAG_OUTPUT=%t.none.log %t.a.out && FileCheck %s --check-prefix=NONE --allow-empty < %t.none.log
+// RUN: %t.a.out 2>&1 | FileCheck %s --check-prefix=NONE --allow-empty
+
+// Every fourth addition is shown, with its inputs and its result together.
+// CHECK: binop fadd in: 0x{{[0-9a-f]+}} 0.000000 at {{.*}}truncate-dump.cpp:{{[0-9]+}}:{{[0-9]+}}
+// CHECK-NEXT: binop fadd in: 0x{{[0-9a-f]+}} 1.000000 at {{.*}}truncate-dump.cpp:{{[0-9]+}}:{{[0-9]+}}
+// CHECK-NEXT: binop fadd res: 0x{{[0-9a-f]+}} 1.000000 at {{.*}}truncate-dump.cpp:{{[0-9]+}}:{{[0-9]+}}
+// CHECK-NEXT: binop fadd in: 0x{{[0-9a-f]+}} 4.000000 at {{.*}}truncate-dump.cpp:{{[0-9]+}}:{{[0-9]+}}
+// CHECK-NEXT: binop fadd in: 0x{{[0-9a-f]+}} 1.000000 at {{.*}}truncate-dump.cpp:{{[0-9]+}}:{{[0-9]+}}
+// CHECK-NEXT: binop fadd res: 0x{{[0-9a-f]+}} 5.000000 at {{.*}}truncate-dump.cpp:{{[0-9]+}}:{{[0-9]+}}
+
+// NONE-NOT: binop
+
+#include "../../test_utils.h"
+
+#define N 8
+
+template <typename fty> fty *__raptor_truncate_mem_func(fty *, int, int, int, int);
+extern double __raptor_truncate_mem_value(...);
+extern double __raptor_expand_mem_value(...);
+
+__attribute__((noinline))
+double count(double a, int n) {
+  double sum = a;
+  for (int i = 0; i < n; i++)
+    sum = sum + 1;
+  return sum;
+}
+
+int main() {
+    double a = __raptor_truncate_mem_value(0.0, 64, 1, 8, 23);
+    double trunc = __raptor_expand_mem_value(
+        __raptor_truncate_mem_func(count, 64, 1, 8, 23)(a, N), 64, 1, 8, 23);
+    APPROX_EQ(trunc, N, 1e-5);
+}
@@ -0,0 +1,24 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorChecksRT -lm -lmpfr && %t.a.out 2>&1 | FileCheck %s
+
+// 1e30 * 1e30 is beyond the largest value with 8 exponent bits.
+// CHECK: Floating point exceptions of emulated operations: nan: 0 inf: 0 overflow: 2 underflow: 0
+// CHECK-NEXT: thread 0: {{.*}}truncate-exceptions.cpp:[[@LINE+11]]:{{[0-9]+}}: overflow in fmul(1e+30, 1e+30) = inf (2x)
+
+#include "../../test_utils.h"
+
+#define FROM 64
+#define TO 1, 8, 23
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline))
+double mul(double a, double b) {
+  return a * b;
+}
+
+int main() {
+  volatile double big = 1e30;
+  for (int i = 0; i < 2; i++)
+    TEST_EQ(__builtin_isinf(__raptor_truncate_op_func(mul, FROM, TO)(big, big)), 1);
+}
@@ -0,0 +1,42 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorChecksRT -lm -lmpfr && env RAPTOR_FPRT_OP_DUMP=%t.base %t.a.out 4 && env RAPTOR_FPRT_OP_DUMP=%t.new %t.a.out 8
+// RUN: %raptor-report csv %t.base | FileCheck %s --check-prefix=CSV
+// RUN: %raptor-report diff -s count %t.base %t.new | FileCheck %s --check-prefix=DIFF
+
+// Sites are sorted by location, 1 + 2^-30 rounds to 1 and the comparison of
+// 1 + 2^-30 and 1 flips with 23 significand bits.
+// CSV: location,op,count,violations,ignored,flips,l1_err,rel_err,max_rel_err,cancellation
+// CSV-NEXT: "{{.*}}truncate-op-dump.cpp:[[@LINE+19]]:{{[0-9]+}}","fadd",4,0,0,0,3.7252902984619141e-09,3.7252902949924671e-09,9.3132257374811678e-10,
+// CSV-NEXT: "{{.*}}truncate-op-dump.cpp:[[@LINE+23]]:{{[0-9]+}}","fcmp_ogt",4,4,0,4,0,0,0,
+// CSV-NOT: truncate-op-dump.cpp
+
+// DIFF: Top 2 of 2 sites by change in count.
+// DIFF-DAG: {{^ +}}4 {{ +}}8 {{ +}}+4 {{ +}}0.000% {{ +}}0.000%  fadd {{ +}}{{.*}}truncate-op-dump.cpp:[[@LINE+14]]:{{[0-9]+}}
+// DIFF-DAG: {{^ +}}4 {{ +}}8 {{ +}}+4 {{ +}}100.000% {{ +}}100.000%  fcmp_ogt {{ +}}{{.*}}truncate-op-dump.cpp:[[@LINE+18]]:{{[0-9]+}}
+
+#include <cstdlib>
+
+#include "../../test_utils.h"
+
+#define FROM 64
+#define TO 1, 8, 23
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline))
+double add(double a, double b) {
+  return a + b;
+}
+
+__attribute__((noinline))
+double greater(double a, double b) {
+  return a > b;
+}
+
+int main(int argc, char **argv) {
+  volatile double tiny = 0x1p-30;
+  for (int i = 0; i < atoi(argv[1]); i++) {
+    TEST_EQ(__raptor_truncate_op_func(add, FROM, TO)(1, tiny), 1);
+    TEST_EQ(__raptor_truncate_op_func(greater, FROM, TO)(1 + tiny, 1), 0);
+  }
+}
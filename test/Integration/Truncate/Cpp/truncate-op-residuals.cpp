@@ -0,0 +1,35 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorChecksRT -lm -lmpfr && %t.a.out | FileCheck %s
+
+// 1 + 2^-30 rounds to 1 with 23 significand bits, a local relative error of
+// 2^-30 / (1 + 2^-30) which is below the violation threshold of 2^-23.
+// CHECK-DAG: truncate-op-residuals.cpp:[[@LINE+14]]:{{[0-9]+}}: 4xfadd L1 Error Norm: 3.72529e-09 Number of violations: 0 Ignored 0 times. Mean rel. error: 9.31323e-10 Max rel. error: 9.31323e-10 Flipped comparisons: 0
+// The comparison of 1 + 2^-30 and 1 flips, both round to 1.
+// CHECK-DAG: truncate-op-residuals.cpp:[[@LINE+17]]:{{[0-9]+}}: 4xfcmp_ogt L1 Error Norm: 0 Number of violations: 4 Ignored 0 times. Mean rel. error: 0 Max rel. error: 0 Flipped comparisons: 4
+
+#include "../../test_utils.h"
+
+#define FROM 64
+#define TO 1, 8, 23
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+extern "C" void raptor_fprt_op_dump_status(int num);
+
+__attribute__((noinline))
+double add(double a, double b) {
+  return a + b;
+}
+
+__attribute__((noinline))
+double greater(double a, double b) {
+  return a > b;
+}
+
+int main() {
+  volatile double tiny = 0x1p-30;
+  for (int i = 0; i < 4; i++) {
+    TEST_EQ(__raptor_truncate_op_func(add, FROM, TO)(1, tiny), 1);
+    TEST_EQ(__raptor_truncate_op_func(greater, FROM, TO)(1 + tiny, 1), 0);
+  }
+  raptor_fprt_op_dump_status(10);
+}
@@ -0,0 +1,35 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorRT -mllvm --raptor-sample-sites -lm -lmpfr && env RAPTOR_FPRT_SAMPLE=%t.samples %t.a.out && FileCheck %s < %t.samples
+
+// CHECK: # {{[1-9][0-9]*}} samples in {{[0-9.]+}} seconds of CPU time
+// CHECK: # kind	samples	%samples	region	site
+// CHECK: region	{{[1-9][0-9]*}}	{{[0-9.]+}}	{{.*}}truncate-sample.cpp:{{[0-9]+}}:{{[0-9]+}}	*
+// CHECK: site	{{[1-9][0-9]*}}	{{[0-9.]+}}	{{.*}}truncate-sample.cpp:{{[0-9]+}}:{{[0-9]+}}	{{.*}}truncate-sample.cpp:{{[0-9]+}}:{{[0-9]+}}
+
+#include <math.h>
+
+#include "../../test_utils.h"
+
+#define N 1000
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline))
+double compute(double *A, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += A[i] * sqrt(A[i]) + 1;
+  return sum;
+}
+
+int main() {
+    double A[N];
+    for (int i = 0; i < N; i++)
+        A[i] = 1 + i % 5;
+
+    double truth = compute(A, N);
+    // Long enough for a few dozen samples of the emulation.
+    for (int t = 0; t < 2000; t++)
+        APPROX_EQ(__raptor_truncate_op_func(compute, 64, 1, 8, 23)(A, N),
+                  truth, 1e-3 * truth);
+}
@@ -0,0 +1,46 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorRT -lm -lmpfr && env RAPTOR_FPRT_TIMELINE=%t.json %t.a.out && FileCheck %s < %t.json
+
+// CHECK: {"displayTimeUnit":"ns","traceEvents":[
+// CHECK-DAG: "cat":"trunc","name":"{{.*}}truncate-timeline.cpp:{{[0-9]+}}:{{[0-9]+}}","args":{"ops":{{[1-9][0-9]*}}}}
+// CHECK-DAG: "cat":"phase","name":"solve","args":{"ops":{{[1-9][0-9]*}}}}
+// CHECK: ]}
+
+#include <math.h>
+
+#include "../../test_utils.h"
+
+#define N 10
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+extern "C" void __raptor_phase_begin(const char *name);
+extern "C" void __raptor_phase_end();
+
+__attribute__((noinline))
+double compute(double *A, double *B, double *C, int n) {
+  for (int i = 0; i < n; i++) {
+    C[i] = A[i] * 2 + B[i] * sqrt(A[i]);
+  }
+  return C[0];
+}
+
+int main() {
+    double A[N];
+    double B[N];
+    double C[N];
+    double D[N];
+
+    for (int i = 0; i < N; i++) {
+        A[i] = 1 + i % 5;
+        B[i] = 1 + i % 3;
+    }
+
+    compute(A, B, D, N);
+    __raptor_phase_begin("solve");
+    for (int t = 0; t < 3; t++)
+        __raptor_truncate_op_func(compute, 64, 1, 8, 23)(A, B, C, N);
+    __raptor_phase_end();
+
+    for (int i = 0; i < N; i++)
+        APPROX_EQ(D[i], C[i], 1e-5);
+}
@@ -0,0 +1,56 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorRT -lm -lmpfr && env RAPTOR_FPRT_TIMING=1 %t.a.out 2>&1 | FileCheck %s
+
+// The exception thrown out of the truncated `fail` leaves its region without an
+// exit, the calls of `compute` after it are still timed. Each of them emulates
+// a division, a square root and an addition per element.
+// CHECK: Time in 2 truncated functions
+// CHECK: {{^ +[0-9.]+ +[0-9.]+% +3 +90 +[0-9.]+ +([1-9][0-9]*\.[0-9]|0\.[1-9])x }}
+
+#include <math.h>
+
+#include "../../test_utils.h"
+
+#define N 10
+
+template <typename fty> fty *__raptor_truncate_op_func(fty *, int, int, int, int);
+
+__attribute__((noinline))
+double compute(double *A, double *B, double *C, int n) {
+  for (int i = 0; i < n; i++) {
+    C[i] = A[i] / 2 + sqrt(B[i]);
+  }
+  return C[0];
+}
+
+__attribute__((noinline))
+double fail(double a) {
+  double r = a * 3;
+  if (r > 2)
+    throw r;
+  return r;
+}
+
+int main() {
+    double A[N];
+    double B[N];
+    double C[N];
+    double D[N];
+
+    for (int i = 0; i < N; i++) {
+        A[i] = 1 + i % 5;
+        B[i] = 1 + i % 3;
+    }
+
+    try {
+        __raptor_truncate_op_func(fail, 64, 1, 8, 23)(1);
+    } catch (double) {
+    }
+
+    compute(A, B, D, N);
+    for (int t = 0; t < 3; t++)
+        __raptor_truncate_op_func(compute, 64, 1, 8, 23)(A, B, C, N);
+
+    for (int i = 0; i < N; i++)
+        APPROX_EQ(D[i], C[i], 1e-5);
+}
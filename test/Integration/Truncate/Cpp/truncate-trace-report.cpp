@@ -0,0 +1,55 @@
+// clang-format off
+// RUN: %clang -O2 -g %s -o %t.a.out %loadClangRaptor %linkRaptorTraceRT -lm && env RAPTOR_FPRT_TRACE=%t.trace %t.a.out
+// RUN: %raptor-report trace %t.trace | FileCheck %s
+// RUN: %t.a.out 2>&1 | FileCheck %s --check-prefix=MEMORY
+// RUN: head -c -4 %t.trace > %t.cut
+// RUN: not %raptor-report trace %t.cut 2>&1 | FileCheck %s --check-prefix=CUT
+
+// Every call traces its two inputs, two constants and three operations. The
+// output depends on every operation with a derivative of one, so the
+// sensitivity of a site is the summed float rounding error of its values.
+// CHECK: Sensitivity of the outputs to truncating each site from double to float, over 70 traced values:
+// CHECK-NEXT: sensitivity values location
+// CHECK-NEXT: 4.006813e-04 10 {{.*}}truncate-trace-report.cpp:[[@LINE+30]]:{{[0-9]+}}
+// CHECK-NEXT: 3.560384e-04 10 {{.*}}truncate-trace-report.cpp:[[@LINE+27]]:{{[0-9]+}}
+// CHECK-NEXT: 1.516060e-10 10 {{.*}}truncate-trace-report.cpp:[[@LINE+27]]:{{[0-9]+}}
+// CHECK-NOT: truncate-trace-report.cpp
+
+// Without RAPTOR_FPRT_TRACE the sweep over the tape in memory ranks the sites
+// the same.
+// MEMORY: Sensitivity of the outputs to truncating each site from double to float, over 70 traced values:
+// MEMORY-NEXT: 0.000400681 (10 values) at {{.*}}truncate-trace-report.cpp:[[@LINE+22]]:{{[0-9]+}}
+// MEMORY-NEXT: 0.000356038 (10 values) at {{.*}}truncate-trace-report.cpp:[[@LINE+19]]:{{[0-9]+}}
+// MEMORY-NEXT: 1.51606e-10 (10 values) at {{.*}}truncate-trace-report.cpp:[[@LINE+19]]:{{[0-9]+}}
+// MEMORY-NOT: truncate-trace-report.cpp
+
+// Without the size after its payload, the last block cannot be found.
+// CUT: {{.*}}.cut: malformed block before offset {{[0-9]+}}
+
+#include "../../test_utils.h"
+
+#define FROM 64
+#define TO 1, 8, 23
+
+template <typename fty> fty *__raptor_truncate_mem_func(fty *, int, int, int, int);
+extern double __raptor_truncate_mem_value(...);
+extern double __raptor_expand_mem_value(...);
+extern "C" void __raptor_fprt_delete_all();
+
+__attribute__((noinline))
+double kernel(double a, double b) {
+    double big = a * 1000;
+    double small = b * 0.001;
+    return big + small;
+}
+
+int main() {
+    for (int i = 1; i <= 10; i++) {
+        double a = __raptor_truncate_mem_value(i / 3.0, FROM, TO);
+        double b = __raptor_truncate_mem_value(i / 7.0, FROM, TO);
+        double c = __raptor_expand_mem_value(
+            __raptor_truncate_mem_func(kernel, FROM, TO)(a, b), FROM, TO);
+        APPROX_EQ(c, i / 3.0 * 1000 + i / 7.0 * 0.001, 1e-10);
+    }
+    __raptor_fprt_delete_all();
+}
@@ -0,0 +1,35 @@
+; RUN: %opt %s %newLoadRaptor -passes="raptor" -raptor-calling-context -S | FileCheck %s --check-prefix=CONTEXT
+; RUN: %opt %s %newLoadRaptor -passes="raptor" -raptor-sample-sites -S | FileCheck %s --check-prefix=SITES
+
+; Nothing may come between a musttail call and its return, the instrumentation
+; of a return goes before the call.
+
+define double @g(double %x) {
+  %m = fmul double %x, %x
+  ret double %m
+}
+
+define double @f(double %x) {
+  %a = fadd double %x, %x
+  %r = musttail call double @g(double %a)
+  ret double %r
+}
+
+declare double (double)* @__raptor_truncate_mem_func(...)
+
+define double @tester(double %x) {
+entry:
+  %ptr = call double (double)* (...) @__raptor_truncate_mem_func(double (double)* @f, i64 64, i64 0, i64 32)
+  %r = call double %ptr(double %x)
+  ret double %r
+}
+
+; CONTEXT-LABEL: define internal double @__raptor_done_truncate_mem_func_ieee_64_to_mpfr_8_23_0_0_0_f(
+; CONTEXT: call void @__raptor_fprt_context_pop(i32 %raptor_context_depth)
+; CONTEXT-NEXT: musttail call double
+; CONTEXT-NEXT: ret double
+
+; SITES-LABEL: define internal double @__raptor_done_truncate_mem_func_ieee_64_to_mpfr_8_23_0_0_0_f(
+; SITES: store ptr %raptor_caller_site, ptr @__raptor_fprt_sample_site
+; SITES-NEXT: musttail call double
+; SITES-NEXT: ret double
@@ -0,0 +1,1179 @@
+//===- raptor-report.cpp - Report per-site statistics of Raptor runs ------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This tool reads the binary dumps written by the runtime (see raptor/Dump.h),
+// merges them and prints the top sites, the difference between two runs, or
+// exports them as CSV or JSON. It also projects the runtime of the functions of
+// a flop profile (see raptor/Profile.h) on a roofline machine model, exports
+// counter time series (see raptor/Series.h) as CSV, and computes the
+// sensitivities of streamed traces (see raptor/TraceFile.h).
+//
+// The dumps are memory mapped and merged in parallel. Sites are identified by
+// their location string so that dumps of different processes and runs can be
+// combined.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "raptor/Dump.h"
+#include "raptor/Series.h"
+#include "raptor/Tape.h"
+#include "raptor/TraceFile.h"
+
+namespace {
+
+struct Stats {
+  std::string_view op;
+  double l1_err = 0;
+  double rel_err = 0;
+  double max_rel_err = 0;
+  int64_t count = 0;
+  int64_t count_thresh = 0;
+  int64_t count_ignore = 0;
+  int64_t count_flip = 0;
+  int64_t cancel[RAPTOR_DUMP_CANCEL_BUCKETS] = {};
+
+  void merge(const Stats &other) {
+    if (op.empty())
+      op = other.op;
+    l1_err += other.l1_err;
+    rel_err += other.rel_err;
+    max_rel_err = std::max(max_rel_err, other.max_rel_err);
+    count += other.count;
+    count_thresh += other.count_thresh;
+    count_ignore += other.count_ignore;
+    count_flip += other.count_flip;
+    for (int i = 0; i < RAPTOR_DUMP_CANCEL_BUCKETS; i++)
+      cancel[i] += other.cancel[i];
+  }
+
+  double violationRate() const {
+    return count ? (double)count_thresh / count : 0;
+  }
+  double meanRelErr() const { return count ? rel_err / count : 0; }
+  // Number of operations which lost at least `bits` bits to cancellation.
+  int64_t cancellations(unsigned bits) const {
+    int64_t n = 0;
+    for (unsigned i = std::max(bits, 1u); i < RAPTOR_DUMP_CANCEL_BUCKETS; i++)
+      n += cancel[i];
+    return n;
+  }
+};
+
+typedef std::unordered_map<std::string_view, Stats> SiteMap;
+typedef std::vector<std::pair<std::string_view, Stats>> SiteVec;
+
+class Dump {
+public:
+  Dump() = default;
+  Dump(const Dump &) = delete;
+  Dump &operator=(const Dump &) = delete;
+
+  bool open(const char *path) {
+    Path = path;
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      perror(path);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+      perror(path);
+      close(fd);
+      return false;
+    }
+    Size = st.st_size;
+    if (Size) {
+      Data = (const char *)mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (Data == MAP_FAILED) {
+        perror(path);
+        Data = nullptr;
+        close(fd);
+        return false;
+      }
+    }
+    close(fd);
+    if (!Data || !raptor_dump_header_valid(header(), Size)) {
+      fprintf(stderr, "%s: not a valid raptor dump\n", path);
+      return false;
+    }
+    return true;
+  }
+
+  ~Dump() {
+    if (Data)
+      munmap((void *)Data, Size);
+  }
+
+  const raptor_dump_header *header() const {
+    return (const raptor_dump_header *)Data;
+  }
+  uint64_t numRecords() const { return header()->num_records; }
+  const raptor_dump_record &record(uint64_t i) const {
+    return ((const raptor_dump_record *)(Data + sizeof(raptor_dump_header)))[i];
+  }
+  uint64_t numCancel() const { return header()->num_cancel; }
+  const raptor_dump_cancel &cancel(uint64_t i) const {
+    return ((const raptor_dump_cancel *)(Data + header()->cancel_offset))[i];
+  }
+
+  // Returns false if the string reference is out of bounds.
+  bool string(uint64_t offset, std::string_view &str) const {
+    if (offset == RAPTOR_DUMP_NO_STRING) {
+      str = std::string_view();
+      return true;
+    }
+    uint64_t size = header()->strings_size;
+    if (offset >= size)
+      return false;
+    const char *begin = Data + header()->strings_offset + offset;
+    const char *end = (const char *)memchr(begin, 0, size - offset);
+    if (!end)
+      return false;
+    str = std::string_view(begin, end - begin);
+    return true;
+  }
+
+  const char *path() const { return Path; }
+
+private:
+  const char *Path = nullptr;
+  const char *Data = nullptr;
+  uint64_t Size = 0;
+};
+
+struct Options {
+  unsigned num = 20;
+  unsigned threads = 0;
+  unsigned cancelBits = 10;
+  std::string sort = "violations";
+  std::string machine;
+  std::string from = "double";
+};
+
+// Merges all dumps into one map of sites. Every thread merges chunks of
+// records into its own map, the per-thread maps are then combined pairwise.
+bool mergeDumps(const std::vector<const Dump *> &dumps, unsigned numThreads,
+                SiteMap &merged) {
+  const uint64_t chunkSize = 1 << 14;
+  std::vector<std::pair<const Dump *, uint64_t>> chunks;
+  for (const Dump *dump : dumps)
+    for (uint64_t i = 0; i < dump->numRecords(); i += chunkSize)
+      chunks.emplace_back(dump, i);
+
+  numThreads = std::max(1u, std::min<unsigned>(numThreads, chunks.size()));
+  std::vector<SiteMap> partial(numThreads);
+  std::atomic<size_t> nextChunk(0);
+  std::atomic<bool> valid(true);
+  auto worker = [&](unsigned tid) {
+    SiteMap &sites = partial[tid];
+    for (size_t c = nextChunk++; c < chunks.size(); c = nextChunk++) {
+      const Dump *dump = chunks[c].first;
+      uint64_t end = std::min(dump->numRecords(), chunks[c].second + chunkSize);
+      for (uint64_t i = chunks[c].second; i < end; i++) {
+        const raptor_dump_record &record = dump->record(i);
+        std::string_view loc;
+        Stats stats;
+        if (!dump->string(record.loc, loc) ||
+            !dump->string(record.op, stats.op)) {
+          fprintf(stderr, "%s: record %llu is corrupt\n", dump->path(),
+                  (unsigned long long)i);
+          valid = false;
+          return;
+        }
+        stats.l1_err = record.l1_err;
+        stats.rel_err = record.rel_err;
+        stats.max_rel_err = record.max_rel_err;
+        stats.count = record.count;
+        stats.count_thresh = record.count_thresh;
+        stats.count_ignore = record.count_ignore;
+        stats.count_flip = record.count_flip;
+        sites[loc].merge(stats);
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < numThreads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto &w : workers)
+    w.join();
+
+  for (unsigned stride = 1; stride < numThreads; stride *= 2) {
+    workers.clear();
+    for (unsigned t = 0; t + stride < numThreads; t += 2 * stride)
+      workers.emplace_back([&, t, stride]() {
+        for (auto &it : partial[t + stride])
+          partial[t][it.first].merge(it.second);
+        SiteMap().swap(partial[t + stride]);
+      });
+    for (auto &w : workers)
+      w.join();
+  }
+  merged.swap(partial[0]);
+
+  // The cancellation histograms are sparse, add them to the merged sites.
+  for (const Dump *dump : dumps) {
+    for (uint64_t i = 0; i < dump->numCancel(); i++) {
+      const raptor_dump_cancel &cancel = dump->cancel(i);
+      std::string_view loc;
+      if (cancel.record >= dump->numRecords() ||
+          !dump->string(dump->record(cancel.record).loc, loc)) {
+        fprintf(stderr, "%s: cancellation histogram %llu is corrupt\n",
+                dump->path(), (unsigned long long)i);
+        return false;
+      }
+      Stats &stats = merged[loc];
+      for (int b = 0; b < RAPTOR_DUMP_CANCEL_BUCKETS; b++)
+        stats.cancel[b] += cancel.bits[b];
+    }
+  }
+  return valid;
+}
+
+double sortKey(const Stats &stats, const Options &opts) {
+  const std::string &key = opts.sort;
+  if (key == "cancel")
+    return stats.cancellations(opts.cancelBits);
+  if (key == "count")
+    return stats.count;
+  if (key == "flips")
+    return stats.count_flip;
+  if (key == "rel")
+    return stats.meanRelErr();
+  if (key == "max")
+    return stats.max_rel_err;
+  if (key == "l1")
+    return stats.l1_err;
+  if (key == "rate")
+    return stats.violationRate();
+  return stats.count_thresh;
+}
+
+bool validSortKey(const std::string &key) {
+  for (const char *valid :
+       {"violations", "count", "flips", "rel", "max", "l1", "rate", "cancel"})
+    if (key == valid)
+      return true;
+  return false;
+}
+
+// Moves the `num` largest elements to the front of `sites` in order.
+template <typename T, typename KeyFn>
+void selectTop(std::vector<T> &sites, unsigned num, KeyFn key) {
+  num = std::min<size_t>(num, sites.size());
+  std::partial_sort(sites.begin(), sites.begin() + num, sites.end(),
+                    [&](const T &a, const T &b) {
+                      double ka = key(a), kb = key(b);
+                      if (ka != kb)
+                        return ka > kb;
+                      return a.first < b.first;
+                    });
+  sites.resize(num);
+}
+
+std::string str(std::string_view sv) { return std::string(sv); }
+
+void printTop(const SiteMap &merged, const Options &opts) {
+  SiteVec sites(merged.begin(), merged.end());
+  selectTop(sites, opts.num, [&](const SiteVec::value_type &site) {
+    return sortKey(site.second, opts);
+  });
+  printf("Information about top %zu of %zu sites sorted by %s.\n",
+         sites.size(), merged.size(), opts.sort.c_str());
+  std::string cancelHeader = "cancel>=" + std::to_string(opts.cancelBits);
+  printf("%12s %12s %9s %10s %12s %12s %12s %12s  %-16s %s\n", "violations",
+         "count", "rate", "flips", cancelHeader.c_str(), "mean rel",
+         "max rel", "L1", "op", "location");
+  for (auto &site : sites) {
+    const Stats &s = site.second;
+    printf("%12lld %12lld %8.3f%% %10lld %12lld %12.4e %12.4e %12.4e  %-16s "
+           "%s\n",
+           (long long)s.count_thresh, (long long)s.count,
+           100 * s.violationRate(), (long long)s.count_flip,
+           (long long)s.cancellations(opts.cancelBits), s.meanRelErr(),
+           s.max_rel_err, s.l1_err, str(s.op).c_str(),
+           str(site.first).c_str());
+  }
+}
+
+void printDiff(const SiteMap &base, const SiteMap &changed,
+               const Options &opts) {
+  typedef std::pair<std::string_view, std::pair<Stats, Stats>> DiffEntry;
+  std::vector<DiffEntry> sites;
+  for (auto &it : base) {
+    auto found = changed.find(it.first);
+    sites.push_back({it.first, {it.second, found != changed.end()
+                                               ? found->second
+                                               : Stats()}});
+  }
+  for (auto &it : changed)
+    if (!base.count(it.first))
+      sites.push_back({it.first, {Stats(), it.second}});
+
+  size_t total = sites.size();
+  selectTop(sites, opts.num, [&](const DiffEntry &site) {
+    return std::abs(sortKey(site.second.second, opts) -
+                    sortKey(site.second.first, opts));
+  });
+  printf("Top %zu of %zu sites by change in %s.\n", sites.size(), total,
+         opts.sort.c_str());
+  printf("%14s %14s %14s %12s %12s  %-16s %s\n", "base", "new", "delta",
+         "base rate", "new rate", "op", "location");
+  for (auto &site : sites) {
+    const Stats &b = site.second.first, &n = site.second.second;
+    double kb = sortKey(b, opts), kn = sortKey(n, opts);
+    printf("%14.6g %14.6g %+14.6g %11.3f%% %11.3f%%  %-16s %s\n", kb, kn,
+           kn - kb, 100 * b.violationRate(), 100 * n.violationRate(),
+           str(n.op.empty() ? b.op : n.op).c_str(), str(site.first).c_str());
+  }
+}
+
+SiteVec sortedByLocation(const SiteMap &merged) {
+  SiteVec sites(merged.begin(), merged.end());
+  std::sort(sites.begin(), sites.end(),
+            [](const SiteVec::value_type &a, const SiteVec::value_type &b) {
+              return a.first < b.first;
+            });
+  return sites;
+}
+
+void printCSVString(std::string_view s) {
+  putchar('"');
+  for (char c : s) {
+    if (c == '"')
+      putchar('"');
+    putchar(c);
+  }
+  putchar('"');
+}
+
+// Nonzero buckets of the cancellation histogram as "<bits>:<count>" separated
+// by `sep`, "all" stands for results which cancelled to exactly zero.
+std::string cancelHistogram(const Stats &s, const char *sep) {
+  std::string out;
+  for (int i = 1; i < RAPTOR_DUMP_CANCEL_BUCKETS; i++) {
+    if (!s.cancel[i])
+      continue;
+    if (!out.empty())
+      out += sep;
+    out += i == RAPTOR_DUMP_CANCEL_BUCKETS - 1 ? "all" : std::to_string(i);
+    out += ":" + std::to_string(s.cancel[i]);
+  }
+  return out;
+}
+
+void printCSV(const SiteMap &merged) {
+  printf("location,op,count,violations,ignored,flips,l1_err,rel_err,"
+         "max_rel_err,cancellation\n");
+  for (auto &site : sortedByLocation(merged)) {
+    const Stats &s = site.second;
+    printCSVString(site.first);
+    putchar(',');
+    printCSVString(s.op);
+    printf(",%lld,%lld,%lld,%lld,%.17g,%.17g,%.17g,%s\n", (long long)s.count,
+           (long long)s.count_thresh, (long long)s.count_ignore,
+           (long long)s.count_flip, s.l1_err, s.rel_err, s.max_rel_err,
+           cancelHistogram(s, " ").c_str());
+  }
+}
+
+void printJSONString(std::string_view s) {
+  putchar('"');
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if ((unsigned char)c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+void printJSONNumber(double d) {
+  if (std::isfinite(d))
+    printf("%.17g", d);
+  else
+    printf("null");
+}
+
+void printJSON(const SiteMap &merged) {
+  printf("[");
+  bool first = true;
+  for (auto &site : sortedByLocation(merged)) {
+    const Stats &s = site.second;
+    printf(first ? "\n  {\"location\": " : ",\n  {\"location\": ");
+    first = false;
+    printJSONString(site.first);
+    printf(", \"op\": ");
+    printJSONString(s.op);
+    printf(", \"count\": %lld, \"violations\": %lld, \"ignored\": %lld, "
+           "\"flips\": %lld, \"l1_err\": ",
+           (long long)s.count, (long long)s.count_thresh,
+           (long long)s.count_ignore, (long long)s.count_flip);
+    printJSONNumber(s.l1_err);
+    printf(", \"rel_err\": ");
+    printJSONNumber(s.rel_err);
+    printf(", \"max_rel_err\": ");
+    printJSONNumber(s.max_rel_err);
+    printf(", \"cancellation\": {");
+    bool firstBucket = true;
+    for (int i = 1; i < RAPTOR_DUMP_CANCEL_BUCKETS; i++) {
+      if (!s.cancel[i])
+        continue;
+      printf(firstBucket ? "\"%s\": %lld" : ", \"%s\": %lld",
+             i == RAPTOR_DUMP_CANCEL_BUCKETS - 1 ? "all"
+                                                 : std::to_string(i).c_str(),
+             (long long)s.cancel[i]);
+      firstBucket = false;
+    }
+    printf("}}");
+  }
+  printf("\n]\n");
+}
+
+// Roofline model of a machine, read from a file of `key = value` lines:
+//
+//   peak.double = 9.7T     # FLOP/s per precision (double, float, half, bf16)
+//   peak.float = 19.5T
+//   bandwidth = 1.5T       # memory bandwidth in bytes/s
+//
+// Values may have a k, M, G or T suffix, `#` starts a comment.
+struct Machine {
+  std::map<std::string, double> peak;
+  double bandwidth = 0;
+
+  // Returns the peak of `precision` or 0 if the model has none.
+  double peakOf(const std::string &precision) const {
+    auto found = peak.find(precision);
+    return found != peak.end() ? found->second : 0;
+  }
+};
+
+std::string trim(const std::string &s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string::npos)
+    return "";
+  return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+bool parseQuantity(const std::string &s, double &value) {
+  char *end;
+  value = strtod(s.c_str(), &end);
+  if (end == s.c_str())
+    return false;
+  switch (*end) {
+  case 'k':
+    value *= 1e3, end++;
+    break;
+  case 'M':
+    value *= 1e6, end++;
+    break;
+  case 'G':
+    value *= 1e9, end++;
+    break;
+  case 'T':
+    value *= 1e12, end++;
+    break;
+  }
+  return *end == 0 && value > 0;
+}
+
+bool loadMachine(const char *path, Machine &machine) {
+  std::ifstream in(path);
+  if (!in) {
+    perror(path);
+    return false;
+  }
+  std::string line;
+  for (unsigned lineno = 1; std::getline(in, line); lineno++) {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+    size_t eq = line.find('=');
+    double value;
+    std::string key = trim(line.substr(0, eq));
+    if (eq == std::string::npos ||
+        !parseQuantity(trim(line.substr(eq + 1)), value)) {
+      fprintf(stderr, "%s:%u: expected <key> = <positive number>\n", path,
+              lineno);
+      return false;
+    }
+    if (key == "bandwidth") {
+      machine.bandwidth = value;
+    } else if (key == "peak.double" || key == "peak.float" ||
+               key == "peak.half" || key == "peak.bf16") {
+      machine.peak[key.substr(5)] = value;
+    } else {
+      fprintf(stderr, "%s:%u: unknown key %s\n", path, lineno, key.c_str());
+      return false;
+    }
+  }
+  if (!machine.bandwidth || !machine.peakOf("double")) {
+    fprintf(stderr, "%s: the machine needs at least peak.double and "
+                    "bandwidth\n",
+            path);
+    return false;
+  }
+  return true;
+}
+
+// The counts of one function of a flop profile.
+struct FunctionCounts {
+  double trunc = 0, dbl = 0, flt = 0, half = 0;
+  double bytes = 0;
+
+  double flops() const { return trunc + dbl + flt + half; }
+};
+
+// Sums the function rows of the profiles, columns are looked up by the names in
+// the header so that profiles with additional columns can be read.
+bool readProfiles(const std::vector<std::string> &paths,
+                  std::map<std::string, FunctionCounts> &functions) {
+  for (const std::string &path : paths) {
+    std::ifstream in(path);
+    if (!in) {
+      perror(path.c_str());
+      return false;
+    }
+    std::map<std::string, size_t> columns;
+    std::string line;
+    while (std::getline(in, line)) {
+      std::vector<std::string> fields;
+      std::stringstream ss(line);
+      for (std::string field; std::getline(ss, field, '\t');)
+        fields.push_back(field);
+      if (line.rfind("# ", 0) == 0) {
+        fields[0] = fields[0].substr(2);
+        for (size_t i = 0; i < fields.size(); i++)
+          columns[fields[i]] = i;
+        continue;
+      }
+      if (fields.empty() || fields[0] != "function")
+        continue;
+      for (const char *column : {"trunc", "double", "float", "half", "loads",
+                                 "stores", "function"})
+        if (!columns.count(column) || columns[column] >= fields.size()) {
+          fprintf(stderr, "%s: not a raptor flop profile\n", path.c_str());
+          return false;
+        }
+      auto get = [&](const char *column) {
+        return atof(fields[columns[column]].c_str());
+      };
+      FunctionCounts &counts = functions[fields[columns["function"]]];
+      counts.trunc += get("trunc");
+      counts.dbl += get("double");
+      counts.flt += get("float");
+      counts.half += get("half");
+      counts.bytes += get("loads") + get("stores");
+    }
+    if (columns.empty()) {
+      fprintf(stderr, "%s: not a raptor flop profile\n", path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+double precisionBytes(const std::string &precision) {
+  return precision == "double" ? 8 : precision == "float" ? 4 : 2;
+}
+
+// Roofline time of `counts` with the truncated flops executed natively in
+// `target`. The memory traffic of the truncated part of a function, estimated
+// by its share of the flops, shrinks with the width of the target.
+double rooflineTime(const FunctionCounts &counts, const Machine &machine,
+                    const std::string &from, const std::string &target,
+                    bool *memoryBound = nullptr) {
+  std::map<std::string, double> flops = {
+      {"double", counts.dbl}, {"float", counts.flt}, {"half", counts.half}};
+  flops[target] += counts.trunc;
+  double compute = 0;
+  for (auto &[precision, n] : flops)
+    if (n)
+      compute += n / machine.peakOf(precision);
+  double bytes = counts.bytes;
+  if (counts.flops())
+    bytes -= counts.bytes * counts.trunc / counts.flops() *
+             (1 - precisionBytes(target) / precisionBytes(from));
+  double memory = bytes / machine.bandwidth;
+  if (memoryBound)
+    *memoryBound = memory > compute;
+  return std::max(compute, memory);
+}
+
+// Time of `counts` on the machine and the speedups of executing the truncated
+// flops natively in each of `targets`.
+struct Projection {
+  double time = 0;
+  bool memoryBound = false;
+  std::vector<double> projected;
+};
+
+Projection project(const FunctionCounts &counts, const Machine &machine,
+                   const std::string &from,
+                   const std::vector<std::string> &targets) {
+  Projection projection;
+  projection.time =
+      rooflineTime(counts, machine, from, from, &projection.memoryBound);
+  for (const std::string &target : targets)
+    projection.projected.push_back(
+        rooflineTime(counts, machine, from, target));
+  return projection;
+}
+
+void printRoofline(const std::map<std::string, FunctionCounts> &functions,
+                   const Machine &machine, const std::string &from,
+                   const Options &opts) {
+  FunctionCounts total;
+  for (auto &function : functions) {
+    total.trunc += function.second.trunc;
+    total.dbl += function.second.dbl;
+    total.flt += function.second.flt;
+    total.half += function.second.half;
+    total.bytes += function.second.bytes;
+  }
+  if ((total.flt || (from == "float" && total.trunc)) &&
+      !machine.peakOf("float")) {
+    fprintf(stderr, "the machine needs peak.float for this profile\n");
+    return;
+  }
+  if (total.half && !machine.peakOf("half")) {
+    fprintf(stderr, "the machine needs peak.half for this profile\n");
+    return;
+  }
+
+  std::vector<std::string> targets;
+  for (const char *target : {"float", "half", "bf16"})
+    if (machine.peakOf(target) && precisionBytes(target) < precisionBytes(from))
+      targets.push_back(target);
+
+  std::vector<std::pair<std::string, Projection>> rows;
+  Projection sum;
+  sum.projected.resize(targets.size());
+  double memoryTime = 0;
+  for (auto &function : functions) {
+    Projection projection = project(function.second, machine, from, targets);
+    // Functions are projected separately and their times summed.
+    sum.time += projection.time;
+    if (projection.memoryBound)
+      memoryTime += projection.time;
+    for (size_t t = 0; t < targets.size(); t++)
+      sum.projected[t] += projection.projected[t];
+    rows.emplace_back(function.first, projection);
+  }
+  sum.memoryBound = memoryTime > sum.time / 2;
+  selectTop(rows, opts.num, [](const std::pair<std::string, Projection> &row) {
+    return row.second.time;
+  });
+
+  printf("Roofline projection of the top %zu of %zu functions, truncated flops "
+         "are %s in the original program.\n",
+         rows.size(), functions.size(), from.c_str());
+  for (auto &[precision, peak] : machine.peak)
+    printf("  %-7s peak %10.4g FLOP/s, ridge point %8.3f flop/byte\n",
+           precision.c_str(), peak, peak / machine.bandwidth);
+  printf("%14s %14s %10s %8s %12s %8s", "flops", "bytes", "flop/byte",
+         "bound", "time [s]", "trunc");
+  for (const std::string &target : targets)
+    printf(" %8s", ("x" + target).c_str());
+  printf("  function\n");
+
+  auto printRow = [&](const std::string &name, const FunctionCounts &counts,
+                      const Projection &projection) {
+    printf("%14.6g %14.6g ", counts.flops(), counts.bytes);
+    if (counts.bytes)
+      printf("%10.3f", counts.flops() / counts.bytes);
+    else
+      printf("%10s", "-");
+    printf(" %8s %12.4e %7.2f%%",
+           projection.memoryBound ? "memory" : "compute", projection.time,
+           counts.flops() ? 100 * counts.trunc / counts.flops() : 0);
+    for (double projected : projection.projected)
+      printf(" %8.3f", projected ? projection.time / projected : 1.0);
+    printf("  %s\n", name.c_str());
+  };
+  for (auto &row : rows)
+    printRow(row.first, functions.at(row.first), row.second);
+  printRow("<total>", total, sum);
+}
+
+// Prints the samples of a time series as CSV, either the counters and the
+// operations and violations summed over all sites, or with `bySite` one row
+// per changed site and sample. Counts are cumulative.
+bool printSeries(const std::string &path, bool bySite) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    perror(path.c_str());
+    return false;
+  }
+  std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  const auto *header = (const raptor_series_header *)data.data();
+  if (!raptor_series_header_valid(header, data.size())) {
+    fprintf(stderr, "%s: not a valid raptor time series\n", path.c_str());
+    return false;
+  }
+
+  if (bySite)
+    printf("time,location,count,violations\n");
+  else
+    printf("time,trunc,double,float,half,vector,trunc_load,trunc_store,"
+           "original_load,original_store,count,violations\n");
+  std::vector<std::string> locations;
+  std::vector<std::pair<int64_t, int64_t>> sites; // Latest count, violations.
+  size_t offset = sizeof(raptor_series_header);
+  raptor_series_record record;
+  // A record the writer did not finish yet ends the series.
+  while (offset + sizeof(record) <= data.size()) {
+    memcpy(&record, data.data() + offset, sizeof(record));
+    offset += sizeof(record);
+    if (record.size > data.size() - offset)
+      break;
+    const char *payload = data.data() + offset;
+    offset += record.size;
+    if (record.type == RAPTOR_SERIES_SITE && record.size > sizeof(uint32_t)) {
+      uint32_t id;
+      memcpy(&id, payload, sizeof(id));
+      if (id >= locations.size()) {
+        locations.resize(id + 1);
+        sites.resize(id + 1);
+      }
+      locations[id].assign(payload + sizeof(id),
+                           strnlen(payload + sizeof(id),
+                                   record.size - sizeof(id)));
+      continue;
+    }
+    if (record.type != RAPTOR_SERIES_SAMPLE ||
+        record.size < sizeof(raptor_series_sample))
+      continue;
+    raptor_series_sample sample;
+    memcpy(&sample, payload, sizeof(sample));
+    uint64_t numSites =
+        std::min<uint64_t>(sample.num_sites,
+                           (record.size - sizeof(sample)) /
+                               sizeof(raptor_series_site_sample));
+    double time = sample.time_ns * 1e-9;
+    for (uint64_t i = 0; i < numSites; i++) {
+      raptor_series_site_sample site;
+      memcpy(&site,
+             payload + sizeof(sample) + i * sizeof(raptor_series_site_sample),
+             sizeof(site));
+      if (site.id >= sites.size())
+        continue;
+      sites[site.id] = {site.count, site.count_thresh};
+      if (bySite) {
+        printf("%.6f,", time);
+        printCSVString(locations[site.id]);
+        printf(",%lld,%lld\n", (long long)site.count,
+               (long long)site.count_thresh);
+      }
+    }
+    if (bySite)
+      continue;
+    const raptor_counters &c = sample.counters;
+    long long vector = 0, count = 0, violations = 0;
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+      vector += c.vector_flops[p];
+    for (auto &[siteCount, siteViolations] : sites) {
+      count += siteCount;
+      violations += siteViolations;
+    }
+    printf("%.6f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+           time, c.flops[RAPTOR_PRECISION_TRUNC],
+           c.flops[RAPTOR_PRECISION_DOUBLE], c.flops[RAPTOR_PRECISION_FLOAT],
+           c.flops[RAPTOR_PRECISION_HALF], vector, c.trunc_load,
+           c.trunc_store, c.original_load, c.original_store, count,
+           violations);
+  }
+  return true;
+}
+
+struct TraceRecord {
+  uint8_t type; // Kind of a value, RAPTOR_TRACE_OUTPUT or RAPTOR_TRACE_SITE.
+  uint8_t numInputs = 0;
+  uint64_t id = 0; // Of the value, or the output.
+  uint64_t site = 0;
+  double value = 0;
+  uint64_t inputs[3];
+  double derivatives[3];
+  std::string_view name; // Of a site.
+};
+
+// Decodes the records of one block, returns false if it is malformed.
+bool decodeTraceBlock(const raptor_trace_block &block,
+                      const std::vector<uint8_t> &payload,
+                      std::vector<TraceRecord> &records) {
+  records.clear();
+  const uint8_t *p = payload.data(), *end = p + payload.size();
+  uint64_t next = block.first_id;
+  while (p && p < end) {
+    TraceRecord r;
+    r.type = *p++;
+    uint64_t v;
+    if (r.type == RAPTOR_TRACE_OUTPUT) {
+      if (!(p = raptor_trace_get_varint(p, end, v)) || v > next)
+        return false;
+      r.id = next - v;
+    } else if (r.type == RAPTOR_TRACE_SITE) {
+      uint64_t len;
+      if (!(p = raptor_trace_get_varint(p, end, r.site)) ||
+          !(p = raptor_trace_get_varint(p, end, len)) ||
+          len > (uint64_t)(end - p))
+        return false;
+      r.name = std::string_view((const char *)p, len);
+      p += len;
+    } else if (r.type < RAPTOR_TRACE_OUTPUT) {
+      r.numInputs = r.type >> 2;
+      r.type &= RAPTOR_TAPE_KIND_MASK;
+      r.id = next++;
+      if (r.numInputs > 3 || !(p = raptor_trace_get_varint(p, end, r.site)) ||
+          end - p < (ptrdiff_t)sizeof(double))
+        return false;
+      memcpy(&r.value, p, sizeof(double));
+      p += sizeof(double);
+      for (unsigned i = 0; i < r.numInputs; i++) {
+        if (!(p = raptor_trace_get_varint(p, end, v)) || (v >> 2) > r.id)
+          return false;
+        r.inputs[i] = r.id - (v >> 2);
+        switch (v & 3) {
+        case RAPTOR_TRACE_DERIVATIVE_ONE:
+          r.derivatives[i] = 1;
+          break;
+        case RAPTOR_TRACE_DERIVATIVE_MINUS_ONE:
+          r.derivatives[i] = -1;
+          break;
+        case RAPTOR_TRACE_DERIVATIVE_ZERO:
+          r.derivatives[i] = 0;
+          break;
+        default:
+          if (end - p < (ptrdiff_t)sizeof(double))
+            return false;
+          memcpy(&r.derivatives[i], p, sizeof(double));
+          p += sizeof(double);
+        }
+      }
+    } else {
+      return false;
+    }
+    records.push_back(r);
+  }
+  return p == end && next == block.first_id + block.num_values;
+}
+
+// Computes the sensitivities of a streamed trace with the reverse sweep of
+// raptor/Tape.h. The blocks are read from the end of the file and only the
+// adjoints of values which still have to be visited are kept in memory.
+bool printTraceSensitivities(const std::string &path, const Options &opts) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) {
+    perror(path.c_str());
+    return false;
+  }
+  raptor_trace_header header;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      !raptor_trace_header_valid(&header)) {
+    fprintf(stderr, "%s: not a valid raptor trace\n", path.c_str());
+    fclose(f);
+    return false;
+  }
+  fseeko(f, 0, SEEK_END);
+  off_t pos = ftello(f);
+
+  std::unordered_map<uint64_t, double> adjoints;
+  std::unordered_set<uint64_t> outputs; // Seeded, not visited yet.
+  std::vector<std::string> siteNames;
+  std::vector<std::pair<double, uint64_t>> sites; // Sensitivity, values.
+  std::vector<uint8_t> payload;
+  std::vector<TraceRecord> records;
+  uint64_t numValues = 0;
+  bool valid = true;
+  while (valid && pos > (off_t)sizeof(header)) {
+    uint32_t size;
+    raptor_trace_block block;
+    off_t start = pos - sizeof(size) - (off_t)sizeof(block);
+    valid = start >= (off_t)sizeof(header) &&
+            !fseeko(f, pos - sizeof(size), SEEK_SET) &&
+            fread(&size, sizeof(size), 1, f) == 1 &&
+            (start -= size) >= (off_t)sizeof(header) &&
+            !fseeko(f, start, SEEK_SET) &&
+            fread(&block, sizeof(block), 1, f) == 1 && block.size == size;
+    if (!valid)
+      break;
+    payload.resize(size);
+    valid = fread(payload.data(), 1, size, f) == size &&
+            decodeTraceBlock(block, payload, records);
+    if (!valid)
+      break;
+    pos = start;
+
+    for (auto r = records.rbegin(); r != records.rend(); ++r) {
+      if (r->type == RAPTOR_TRACE_SITE) {
+        if (r->site >= siteNames.size())
+          siteNames.resize(r->site + 1);
+        siteNames[r->site] = std::string(r->name);
+        continue;
+      }
+      if (r->type == RAPTOR_TRACE_OUTPUT) {
+        // An output is seeded once no matter how often it was read.
+        if (outputs.insert(r->id).second)
+          adjoints[r->id] += 1;
+        continue;
+      }
+      numValues++;
+      double adjoint = 0;
+      auto found = adjoints.find(r->id);
+      if (found != adjoints.end()) {
+        adjoint = found->second;
+        adjoints.erase(found);
+      }
+      outputs.erase(r->id);
+      if (r->type == RAPTOR_TAPE_OP) {
+        if (r->site >= sites.size())
+          sites.resize(r->site + 1);
+        sites[r->site].first +=
+            adjoint * __raptor_tape_truncation_error(r->value);
+        sites[r->site].second++;
+      }
+      if (adjoint != 0)
+        for (unsigned i = 0; i < r->numInputs; i++)
+          adjoints[r->inputs[i]] += std::abs(r->derivatives[i]) * adjoint;
+    }
+  }
+  fclose(f);
+  if (!valid) {
+    fprintf(stderr, "%s: malformed block before offset %lld\n", path.c_str(),
+            (long long)pos);
+    return false;
+  }
+
+  std::vector<size_t> order;
+  for (size_t i = 0; i < sites.size(); i++)
+    if (sites[i].second)
+      order.push_back(i);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sites[a].first > sites[b].first;
+  });
+  if (order.size() > opts.num)
+    order.resize(opts.num);
+  printf("Sensitivity of the outputs to truncating each site from double to "
+         "float, over %llu traced values:\n",
+         (unsigned long long)numValues);
+  printf("%14s %12s  %s\n", "sensitivity", "values", "location");
+  for (size_t i : order)
+    printf("%14.6e %12llu  %s\n", sites[i].first,
+           (unsigned long long)sites[i].second,
+           i < siteNames.size() ? siteNames[i].c_str() : "unknown");
+  return true;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: raptor-report <command> [options] <dump>...\n"
+          "\n"
+          "commands:\n"
+          "  top <dump>...            merge the dumps and print the top sites\n"
+          "  diff <base> <new>        print the sites that changed the most,\n"
+          "                           each side may be a comma separated list\n"
+          "  csv <dump>...            export the merged dumps as CSV\n"
+          "  json <dump>...           export the merged dumps as JSON\n"
+          "  roofline -m <machine> <profile>...\n"
+          "                           project the runtime of the functions of\n"
+          "                           flop profiles (RAPTOR_FPRT_PROFILE) on a\n"
+          "                           machine model and the speedup of running\n"
+          "                           the truncated flops natively\n"
+          "  series <series>          export a counter time series\n"
+          "                           (RAPTOR_FPRT_SERIES) as CSV\n"
+          "  series-sites <series>    export the operations and violations of\n"
+          "                           every site over time as CSV\n"
+          "  trace <trace>            rank the sites of a streamed trace\n"
+          "                           (RAPTOR_FPRT_TRACE) by their sensitivity\n"
+          "\n"
+          "options:\n"
+          "  -n <num>                 number of sites to print (default 20)\n"
+          "  -s <key>                 sort by violations (default), rate, "
+          "count,\n"
+          "                           flips, rel, max, l1 or cancel\n"
+          "  -c <bits>                count cancellations which lost at least\n"
+          "                           <bits> bits (default 10)\n"
+          "  -j <num>                 number of threads used for merging\n"
+          "  -m <machine>             machine model, `key = value` lines with\n"
+          "                           peak.double, peak.float, peak.half,\n"
+          "                           peak.bf16 in FLOP/s and bandwidth in\n"
+          "                           bytes/s\n"
+          "  -f <precision>           precision the truncated flops have in\n"
+          "                           the original program (default double)\n");
+}
+
+bool openDumps(const std::vector<std::string> &paths,
+               std::vector<Dump> &storage, std::vector<const Dump *> &dumps) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!storage[i].open(paths[i].c_str()))
+      return false;
+    dumps.push_back(&storage[i]);
+  }
+  return true;
+}
+
+std::vector<std::string> splitList(const std::string &list) {
+  std::vector<std::string> items;
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    size_t end = list.find(',', begin);
+    if (end == std::string::npos)
+      end = list.size();
+    if (end > begin)
+      items.push_back(list.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return items;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  std::string command = argv[1];
+  Options opts;
+  std::vector<std::string> inputs;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "-n" || arg == "-s" || arg == "-j" || arg == "-c" ||
+         arg == "-m" || arg == "-f") &&
+        i + 1 < argc) {
+      if (arg == "-n")
+        opts.num = atoi(argv[++i]);
+      else if (arg == "-c")
+        opts.cancelBits = atoi(argv[++i]);
+      else if (arg == "-j")
+        opts.threads = atoi(argv[++i]);
+      else if (arg == "-m")
+        opts.machine = argv[++i];
+      else if (arg == "-f")
+        opts.from = argv[++i];
+      else
+        opts.sort = argv[++i];
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (!validSortKey(opts.sort)) {
+    fprintf(stderr, "unknown sort key %s\n", opts.sort.c_str());
+    return 1;
+  }
+  if (!opts.threads)
+    opts.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  if (command == "diff") {
+    if (inputs.size() != 2) {
+      usage();
+      return 1;
+    }
+    std::vector<std::string> basePaths = splitList(inputs[0]);
+    std::vector<std::string> newPaths = splitList(inputs[1]);
+    std::vector<Dump> baseStorage(basePaths.size()),
+        newStorage(newPaths.size());
+    std::vector<const Dump *> baseDumps, newDumps;
+    if (!openDumps(basePaths, baseStorage, baseDumps) ||
+        !openDumps(newPaths, newStorage, newDumps))
+      return 1;
+    SiteMap base, changed;
+    if (!mergeDumps(baseDumps, opts.threads, base) ||
+        !mergeDumps(newDumps, opts.threads, changed))
+      return 1;
+    printDiff(base, changed, opts);
+    return 0;
+  }
+
+  if (command == "roofline") {
+    if (inputs.empty() || opts.machine.empty()) {
+      usage();
+      return 1;
+    }
+    if (opts.from != "double" && opts.from != "float") {
+      fprintf(stderr, "truncated flops must come from double or float\n");
+      return 1;
+    }
+    Machine machine;
+    std::map<std::string, FunctionCounts> functions;
+    if (!loadMachine(opts.machine.c_str(), machine) ||
+        !readProfiles(inputs, functions))
+      return 1;
+    printRoofline(functions, machine, opts.from, opts);
+    return 0;
+  }
+
+  if (command == "series" || command == "series-sites") {
+    if (inputs.size() != 1) {
+      usage();
+      return 1;
+    }
+    return printSeries(inputs[0], command == "series-sites") ? 0 : 1;
+  }
+
+  if (command == "trace") {
+    if (inputs.size() != 1) {
+      usage();
+      return 1;
+    }
+    return printTraceSensitivities(inputs[0], opts) ? 0 : 1;
+  }
+
+  if (command != "top" && command != "csv" && command != "json") {
+    usage();
+    return 1;
+  }
+  if (inputs.empty()) {
+    usage();
+    return 1;
+  }
+  std::vector<Dump> storage(inputs.size());
+  std::vector<const Dump *> dumps;
+  if (!openDumps(inputs, storage, dumps))
+    return 1;
+  SiteMap merged;
+  if (!mergeDumps(dumps, opts.threads, merged))
+    return 1;
+  if (command == "top")
+    printTop(merged, opts);
+  else if (command == "csv")
+    printCSV(merged);
+  else
+    printJSON(merged);
+  return 0;
+}
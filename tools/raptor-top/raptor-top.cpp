@@ -0,0 +1,294 @@
+//===- raptor-top.cpp - Live flop rates of running Raptor programs --------===//
+//
+//                             Raptor Project
+//
+// Part of the Raptor Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This tool attaches to the shared memory segments of all programs on the node
+// running with RAPTOR_FPRT_SHM=1 (see raptor/Shm.h) and periodically prints
+// their truncated and native flop rates, totals and truncation fractions, one
+// row per process and a total for the node.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "raptor/Shm.h"
+
+namespace {
+
+struct Options {
+  double delay = 1;
+  int iterations = -1; // Forever.
+  bool batch = false;  // Do not clear the screen between updates.
+  std::string dir = "/dev/shm";
+};
+
+struct Totals {
+  long long flops[RAPTOR_NUM_PRECISIONS] = {};
+  long long loaded = 0;
+  long long stored = 0;
+  unsigned threads = 0;
+
+  long long native() const {
+    long long sum = 0;
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+      if (p != RAPTOR_PRECISION_TRUNC)
+        sum += flops[p];
+    return sum;
+  }
+  long long trunc() const { return flops[RAPTOR_PRECISION_TRUNC]; }
+
+  void add(const Totals &other) {
+    for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+      flops[p] += other.flops[p];
+    loaded += other.loaded;
+    stored += other.stored;
+    threads += other.threads;
+  }
+};
+
+struct Segment {
+  std::string name;
+  __raptor_shm_header *header = nullptr;
+  size_t size = 0;
+  Totals last;
+  std::chrono::steady_clock::time_point lastTime;
+  bool seen = false; // Present in the last scan.
+
+  Segment() = default;
+  Segment(const Segment &) = delete;
+  Segment &operator=(const Segment &) = delete;
+  ~Segment() {
+    if (header)
+      munmap(header, size);
+  }
+};
+
+// Copies the counters of a slot, retrying while its thread writes it. A thread
+// which counts in a tight loop can starve the reader, after a few attempts the
+// last copy is taken. Every counter is read atomically, so it is at most off by
+// the update in flight.
+void readSlot(const __raptor_counter_slot &slot, Totals &totals) {
+  long long counters[NUM_COUNTERS];
+  for (int attempt = 0; attempt < 100; attempt++) {
+    unsigned before = slot.seq.load(std::memory_order_acquire);
+    for (int i = 0; i < NUM_COUNTERS; i++)
+      counters[i] = slot.counters[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!(before & 1) && slot.seq.load(std::memory_order_relaxed) == before)
+      break;
+  }
+  for (int p = 0; p < RAPTOR_NUM_PRECISIONS; p++)
+    totals.flops[p] += counters[p];
+  totals.loaded +=
+      counters[ORIGINAL_LOAD_COUNTER] + counters[TRUNC_LOAD_COUNTER];
+  totals.stored +=
+      counters[ORIGINAL_STORE_COUNTER] + counters[TRUNC_STORE_COUNTER];
+  totals.threads++;
+}
+
+Totals readSegment(const __raptor_shm_header *header) {
+  Totals totals;
+  uint32_t num = std::min(header->num_slots.load(std::memory_order_acquire),
+                          header->max_slots);
+  const __raptor_counter_slot *slots =
+      __raptor_shm_slots(const_cast<__raptor_shm_header *>(header));
+  for (uint32_t i = 0; i < num; i++)
+    readSlot(slots[i], totals);
+  return totals;
+}
+
+bool attach(const Options &opts, const std::string &name, Segment &segment) {
+  std::string path = opts.dir + "/" + name;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(__raptor_shm_header)) {
+    close(fd);
+    return false;
+  }
+  void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED)
+    return false;
+  auto *header = (__raptor_shm_header *)mem;
+  // Skip segments of processes which were killed before they could unlink.
+  if (!__raptor_shm_header_valid(header, st.st_size) ||
+      (kill(header->pid, 0) && errno == ESRCH)) {
+    munmap(mem, st.st_size);
+    return false;
+  }
+  segment.name = name;
+  segment.header = header;
+  segment.size = st.st_size;
+  segment.lastTime = std::chrono::steady_clock::now();
+  segment.last = readSegment(header);
+  return true;
+}
+
+// Attaches to new segments and drops the ones which went away.
+void scan(const Options &opts, std::map<std::string, Segment> &segments) {
+  for (auto &[name, segment] : segments)
+    segment.seen = false;
+  if (DIR *dir = opendir(opts.dir.c_str())) {
+    while (struct dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.compare(0, strlen(RAPTOR_SHM_PREFIX), RAPTOR_SHM_PREFIX))
+        continue;
+      auto found = segments.find(name);
+      if (found != segments.end()) {
+        found->second.seen = true;
+        continue;
+      }
+      Segment &segment = segments[name];
+      if (attach(opts, name, segment))
+        segment.seen = true;
+      else
+        segments.erase(name);
+    }
+    closedir(dir);
+  }
+  // Processes unlink their segment at exit.
+  for (auto it = segments.begin(); it != segments.end();)
+    if (!it->second.seen)
+      it = segments.erase(it);
+    else
+      ++it;
+}
+
+std::string human(double value) {
+  const char *suffixes[] = {"", "k", "M", "G", "T", "P"};
+  int i = 0;
+  while (std::abs(value) >= 1000 && i < 5) {
+    value /= 1000;
+    i++;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), i ? "%.1f%s" : "%.0f%s", value, suffixes[i]);
+  return buf;
+}
+
+double percent(long long part, long long all) {
+  return all ? 100.0 * part / all : 0.0;
+}
+
+void printRow(const char *pid, unsigned threads, double truncRate,
+              double nativeRate, const Totals &totals, const char *command) {
+  long long all = totals.trunc() + totals.native();
+  printf("%8s %7u %10s %10s %6.1f%% %10s %10s %10s  %s\n", pid, threads,
+         human(truncRate).c_str(), human(nativeRate).c_str(),
+         percent(totals.trunc(), all), human(totals.trunc()).c_str(),
+         human(all).c_str(), human(totals.loaded + totals.stored).c_str(),
+         command);
+}
+
+void update(std::map<std::string, Segment> &segments, const Options &opts) {
+  if (!opts.batch)
+    printf("\033[H\033[2J");
+  printf("%8s %7s %10s %10s %7s %10s %10s %10s  %s\n", "PID", "THREADS",
+         "TRUNC/s", "NATIVE/s", "%TRUNC", "TRUNC", "FLOPS", "BYTES",
+         "COMMAND");
+  Totals node;
+  double nodeTrunc = 0, nodeNative = 0;
+  auto now = std::chrono::steady_clock::now();
+  for (auto &[name, segment] : segments) {
+    Totals totals = readSegment(segment.header);
+    double seconds =
+        std::chrono::duration<double>(now - segment.lastTime).count();
+    double truncRate = 0, nativeRate = 0;
+    if (seconds > 0) {
+      truncRate = (totals.trunc() - segment.last.trunc()) / seconds;
+      nativeRate = (totals.native() - segment.last.native()) / seconds;
+    }
+    segment.last = totals;
+    segment.lastTime = now;
+    node.add(totals);
+    nodeTrunc += truncRate;
+    nodeNative += nativeRate;
+
+    std::string pid = std::to_string(segment.header->pid);
+    if (segment.header->exited.load(std::memory_order_acquire))
+      pid += "*";
+    printRow(pid.c_str(), totals.threads, truncRate, nativeRate, totals,
+             segment.header->command);
+  }
+  if (segments.size() > 1)
+    printRow("total", node.threads, nodeTrunc, nodeNative, node, "");
+  if (segments.empty())
+    printf("no processes with RAPTOR_FPRT_SHM=1 found in %s\n",
+           opts.dir.c_str());
+  fflush(stdout);
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: raptor-top [-d <seconds>] [-n <iterations>] [-b] [-s <dir>]\n"
+          "\n"
+          "Shows the live flop rates of the programs running with\n"
+          "RAPTOR_FPRT_SHM=1 on this node. Rates are flops per second since\n"
+          "the last update, processes marked * have exited.\n"
+          "\n"
+          "  -d <seconds>     time between updates (default 1)\n"
+          "  -n <iterations>  number of updates before exiting\n"
+          "  -b               batch mode, do not clear the screen\n"
+          "  -s <dir>         where the segments are (default /dev/shm)\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "-d" || arg == "-n" || arg == "-s") && i + 1 < argc) {
+      if (arg == "-d")
+        opts.delay = atof(argv[++i]);
+      else if (arg == "-n")
+        opts.iterations = atoi(argv[++i]);
+      else
+        opts.dir = argv[++i];
+    } else if (arg == "-b") {
+      opts.batch = true;
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (!isatty(STDOUT_FILENO))
+    opts.batch = true;
+
+  std::map<std::string, Segment> segments;
+  scan(opts, segments);
+  for (int i = 0; opts.iterations < 0 || i < opts.iterations; i++) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.delay));
+    scan(opts, segments);
+    update(segments, opts);
+  }
+  return 0;
+}